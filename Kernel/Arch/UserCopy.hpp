@@ -0,0 +1,35 @@
+#pragma once
+#include <SystemTypes.hpp>
+
+namespace arch {
+	/**	Copy a buffer from user memory
+	 *
+	 * 	The buffer is copied directly through the user mapping of the current
+	 * 	address space. Pages that were not populated yet are faulted in on the
+	 * 	way. Accesses to unmapped memory are caught and stop the copy instead
+	 * 	of crashing the kernel. Must not be called with the VM lock of the
+	 * 	current process held, as resolving faults needs it.
+	 *
+	 * 	The copy runs with kernel privileges, and only checks that the buffer
+	 * 	lies in the lower half. Callers must make sure it lies in user mappings
+	 * 	first, see VMM::user_accessible_length.
+	 *
+	 * 	Returns the number of bytes that could NOT be copied, 0 on success.
+	 */
+	size_t copy_from_user(void* dst, void const* user_src, size_t len);
+
+	/**	Copy a buffer to user memory, see `copy_from_user`
+	 *
+	 * 	Returns the number of bytes that could NOT be copied, 0 on success.
+	 */
+	size_t copy_to_user(void* user_dst, void const* src, size_t len);
+
+	/**	Copy a NUL-terminated string of at most `len` bytes from user memory
+	 *
+	 * 	Returns the length of the string without the terminator, or `len` if no
+	 * 	terminator was found within the first `len` bytes (in which case `dst` is
+	 * 	not terminated). Returns a negative value when user memory could not be
+	 * 	accessed.
+	 */
+	int64 strncpy_from_user(char* dst, char const* user_src, size_t len);
+}
@@ -91,19 +91,132 @@ namespace arch {
 	///	 This pointer will usually point to physical memory and must not be used directly.
 	core::Result<PagingHandle> addralloc();
 	///  RECURSIVELY free the given top-level paging structure
-	///  This will free pages allocated on ALL levels of the structure
+	///  This will free pages allocated on ALL levels of the structure, except for the
+	///  kernel tables shared by all paging structures. User pages still mapped in the
+	///  structure lose a reference, and are freed if it was the last one.
+	///  The structure must not be loaded on any node.
 	core::Error addrfree(PagingHandle);
 	///  Clone a given paging structure
 	///  This allocates a new top-level paging structure and clones all existing mappings
 	///  from the source structure. Further modifications to the paging structure will
 	///  only affect the clone, not the original mappings (with exception to the kernel
 	///  ranges which must be shared across all paging structures).
+	///  User pages are not copied, but shared between both structures and referenced
+	///  in the page frame database. Writable ones are mapped read-only copy-on-write
+	///  in both, and must be unshared with `addrunshare` on the first write. Large user
+	///  pages of the source are split into regular pages first, so that they can be shared.
 	core::Result<PagingHandle> addrclone(PagingHandle root);
 
 	///  Create a mapping between virt <-> phys in the given paging structure
 	core::Error addrmap(PagingHandle, void* pptr, void* vptr, PageFlags flags);
+	///  Map a physically contiguous range of `len` bytes at the given virtual address
+	///  Each level of the paging structure is walked once for the whole range, and
+	///  large/huge pages are used automatically wherever the alignment of both ranges
+	///  allows it (the Large/Huge flags are ignored). Parts of the range that are
+	///  already covered by a table keep using it. Entries that are present already are
+	///  never replaced, and fail the call with EntityAlreadyExists. The addresses and length
+	///  must be page-aligned. On failure, part of the range may have been mapped already.
+	core::Error addrmap_range(PagingHandle, void* pptr, void* vptr, size_t len, PageFlags flags);
+	///  Batch of pending TLB invalidations for a paging structure
+	///  Unmapping through a gather only modifies the paging structure, and the
+	///  stale translations are dropped from the TLBs of all nodes at once when
+	///  the gather is flushed. This allows unmapping a range of pages at the
+	///  cost of a single cross-node shootdown. Physical pages that were unmapped
+	///  through a gather must not be reused before it is flushed.
+	class TlbGather {
+	public:
+		explicit TlbGather(PagingHandle handle) noexcept
+		    : m_handle(handle) {}
+
+		TlbGather(TlbGather const&) = delete;
+		TlbGather& operator=(TlbGather const&) = delete;
+
+		~TlbGather() { flush(); }
+
+		///  Record that `size` bytes starting at the given address were unmapped
+		void add(void* vptr, size_t size) {
+			const auto start = reinterpret_cast<uintptr_t>(vptr);
+			if(m_pages == 0 || start < m_start) {
+				m_start = start;
+			}
+			if(m_pages == 0 || start + size > m_end) {
+				m_end = start + size;
+			}
+			m_pages += (size + 0x1000 - 1) / 0x1000;
+		}
+
+		[[nodiscard]] constexpr bool empty() const { return m_pages == 0; }
+
+		[[nodiscard]] constexpr PagingHandle handle() const { return m_handle; }
+
+		///  Free the physical page once the gathered range was invalidated
+		///  This is used for paging tables that were unlinked from the structure, as
+		///  other nodes may still walk through them until their TLBs are flushed.
+		void defer_free(void* page);
+
+		///  Invalidate the gathered range on all nodes that may have it cached
+		///  and wait for them to finish
+		void flush();
+		///  Invalidate the gathered range on the current node only
+		///  This is only safe for ranges that were never reachable from other nodes.
+		void flush_local();
+	private:
+		PagingHandle m_handle;
+		uintptr_t m_start {};
+		uintptr_t m_end {};
+		size_t m_pages {};
+		//  Pages to free after the flush, chained through their first word
+		void* m_deferred {};
+
+		void free_deferred();
+
+		constexpr void reset() {
+			m_start = 0;
+			m_end = 0;
+			m_pages = 0;
+		}
+	};
+
 	///  Unmap a given virtual address
+	///  The translation is invalidated on all nodes before returning.
 	core::Error addrunmap(PagingHandle, void* vptr);
+	///  Unmap a given virtual address, deferring the TLB invalidation to the gather
+	core::Error addrunmap(PagingHandle, void* vptr, TlbGather&);
+	///  Unmap all pages in a range of `len` bytes, deferring the TLB invalidation to the gather
+	///  Unmapped parts of the range are skipped. Large and huge pages must either lie
+	///  entirely within the range or entirely outside of it.
+	core::Error addrunmap_range(PagingHandle, void* vptr, size_t len, TlbGather&);
+	///  Translate a virtual address to the physical address it is mapped to
+	core::Result<void*> addrtranslate(PagingHandle, void* vptr);
+
+	///  Pages mapped at an address before and after breaking copy-on-write sharing
+	struct UnshareResult {
+		void* old_page;
+		void* new_page;
+	};
+	///  Resolve a write to a copy-on-write page
+	///  Gives the paging structure a private, writable copy of the page containing the
+	///  given address, and drops its reference to the shared page. When no other mapping
+	///  references the page anymore, it is made writable in place instead. Returns the
+	///  same page for both when no copy was made.
+	core::Result<UnshareResult> addrunshare(PagingHandle, void* vptr);
+	///  Prepare merging the pages mapped in a large page-aligned range into a single large page
+	///  All pages in the range must be mapped with the same permissions and must not be
+	///  shared with other paging structures. The range is write-protected, and the physical
+	///  addresses of its pages are written to `pages`, one for every page of the range. Each
+	///  page gets an extra reference, so that it stays around while the caller copies it to
+	///  the large page without holding the VM lock.
+	core::Error addrcollapse_prepare(PagingHandle, void* vptr, void** pages);
+	///  Replace a range prepared by addrcollapse_prepare with the large page at `pptr`
+	///  Fails if any entry of the range changed since it was prepared. Writes to the range
+	///  make it writable again, and cancel the collapse. The references taken by the prepare
+	///  step are dropped either way, and on success the caller is responsible for freeing
+	///  the old pages.
+	core::Error addrcollapse_commit(PagingHandle, void* vptr, void* pptr, void* const* pages);
+	///  Fill the page at the given virtual address with zeros, bypassing the CPU caches
+	///  where the platform supports it. Used for clearing pages ahead of time, which
+	///  should not evict the working set of the CPU doing it.
+	void zero_page_nontemporal(void* vptr);
 
 	///  Physical pointer container class
 	///  This can be used to distinguish between virtual and physical pointers
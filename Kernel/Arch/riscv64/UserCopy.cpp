@@ -0,0 +1,13 @@
+#include <Arch/UserCopy.hpp>
+
+size_t arch::copy_from_user(void*, void const*, size_t len) {
+	return len;
+}
+
+size_t arch::copy_to_user(void*, void const*, size_t len) {
+	return len;
+}
+
+int64 arch::strncpy_from_user(char*, char const*, size_t) {
+	return -1;
+}
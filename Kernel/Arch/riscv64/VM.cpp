@@ -1,5 +1,7 @@
 #include <Arch/VM.hpp>
 #include <Core/Error/Error.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <string.h>
 
 core::Result<arch::PagingHandle> arch::addralloc() {
 	return core::Result<arch::PagingHandle> { core::Error::Unsupported };
@@ -17,6 +19,63 @@ core::Error arch::addrmap(PagingHandle, void*, void*, PageFlags) {
 	return core::Error::Unsupported;
 }
 
+core::Error arch::addrmap_range(PagingHandle, void*, void*, size_t, PageFlags) {
+	return core::Error::Unsupported;
+}
+
 core::Error arch::addrunmap(PagingHandle, void*) {
 	return core::Error::Unsupported;
 }
+
+core::Error arch::addrunmap(PagingHandle, void*, TlbGather&) {
+	return core::Error::Unsupported;
+}
+
+core::Error arch::addrunmap_range(PagingHandle, void*, size_t, TlbGather&) {
+	return core::Error::Unsupported;
+}
+
+core::Result<void*> arch::addrtranslate(PagingHandle, void*) {
+	return core::Result<void*> { core::Error::Unsupported };
+}
+
+core::Result<arch::UnshareResult> arch::addrunshare(PagingHandle, void*) {
+	return core::Result<arch::UnshareResult> { core::Error::Unsupported };
+}
+
+core::Error arch::addrcollapse_prepare(PagingHandle, void*, void**) {
+	return core::Error::Unsupported;
+}
+
+core::Error arch::addrcollapse_commit(PagingHandle, void*, void*, void* const*) {
+	return core::Error::Unsupported;
+}
+
+void arch::zero_page_nontemporal(void* vptr) {
+	memset(vptr, 0x0, 0x1000);
+}
+
+void arch::TlbGather::defer_free(void* page) {
+	*PhysPtr<void*> { static_cast<void**>(page) } = m_deferred;
+	m_deferred = page;
+}
+
+void arch::TlbGather::free_deferred() {
+	while(m_deferred) {
+		auto* next = *PhysPtr<void*> { static_cast<void**>(m_deferred) };
+		core::mem::free_pages(core::mem::PageAllocation { .base = m_deferred, .order = 0, .flags = {} });
+		m_deferred = next;
+	}
+}
+
+void arch::TlbGather::flush() {
+	flush_local();
+}
+
+void arch::TlbGather::flush_local() {
+	if(!empty()) {
+		asm volatile("sfence.vma" : : : "memory");
+		reset();
+	}
+	free_deferred();
+}
@@ -1,6 +1,9 @@
 #include <Arch/VM.hpp>
 #include <Arch/x86_64/ACPI.hpp>
 #include <Core/Log/Logger.hpp>
+#include <Core/Mem/Layout.hpp>
+#include <Core/Mem/NUMA.hpp>
+#include <LibFormat/Formatters/Pointer.hpp>
 #include <LibGeneric/List.hpp>
 #include <Structs/KOptional.hpp>
 
@@ -71,3 +74,151 @@ KOptional<PhysPtr<ACPISDTHeader>> ACPI::find_table(uint32_t signature) {
 	}
 	return {};
 }
+
+//  Proximity domains are sparse identifiers, nodes are numbered densely in the order they appear in the SRAT
+static constinit uint32_t s_node_domains[CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+static constinit size_t s_node_count {};
+//  NUMA node of every local APIC ID
+static constinit uint8_t s_apic_nodes[256] {};
+
+//  Get the node of the given proximity domain, assigning a new one if it wasn't seen yet
+static uint32_t node_for_domain(uint32_t domain) {
+	for(size_t node = 0; node < s_node_count; ++node) {
+		if(s_node_domains[node] == domain) {
+			return node;
+		}
+	}
+	if(s_node_count >= CONFIG_CORE_MEM_NUMA_MAX_NODES) {
+		log.warning("Too many NUMA nodes, proximity domain {} is treated as node 0", domain);
+		return 0;
+	}
+	s_node_domains[s_node_count] = domain;
+	return s_node_count++;
+}
+
+void ACPI::parse_numa() {
+	auto maybe_srat = ACPI::find_table(ACPI::table_srat_sig);
+	if(!maybe_srat.has_value()) {
+		log.debug("SRAT not present, assuming a single NUMA node");
+		return;
+	}
+	PhysAddr srat = PhysAddr { maybe_srat.unwrap().get() };
+	auto const& srat_header = *maybe_srat.unwrap();
+
+	unsigned offset = sizeof(SRATHeader);
+	while(offset + sizeof(SRATEntryHeader) <= srat_header.m_length) {
+		auto const& entry = *(srat + offset).as<SRATEntryHeader>();
+		if(entry.m_length < sizeof(SRATEntryHeader) || offset + entry.m_length > srat_header.m_length) {
+			log.error("Malformed SRAT entry at offset {}", offset);
+			break;
+		}
+		//  Entries are only read when they are large enough for the structure of their type
+		const auto fits = [&entry, offset](size_t size) {
+			if(entry.m_length < size) {
+				log.warning("Ignoring truncated SRAT entry of type {} at offset {}", entry.m_type, offset);
+				return false;
+			}
+			return true;
+		};
+
+		switch(entry.m_type) {
+			case 0: {
+				if(!fits(sizeof(SRATLocalApicAffinity))) {
+					break;
+				}
+				auto const& affinity = *(srat + offset).as<SRATLocalApicAffinity>();
+				if(!(affinity.m_flags & 1)) {
+					break;
+				}
+				const uint32_t domain = affinity.m_proximity_domain_lo |
+				                        (static_cast<uint32_t>(affinity.m_proximity_domain_hi[0]) << 8u) |
+				                        (static_cast<uint32_t>(affinity.m_proximity_domain_hi[1]) << 16u) |
+				                        (static_cast<uint32_t>(affinity.m_proximity_domain_hi[2]) << 24u);
+				const auto node = node_for_domain(domain);
+				s_apic_nodes[affinity.m_apic_id] = node;
+				log.debug("APIC_ID={} on node {} (domain {})", affinity.m_apic_id, node, domain);
+				break;
+			}
+			case 1: {
+				if(!fits(sizeof(SRATMemoryAffinity))) {
+					break;
+				}
+				auto const& affinity = *(srat + offset).as<SRATMemoryAffinity>();
+				if(!(affinity.m_flags & 1)) {
+					break;
+				}
+				const auto base = static_cast<uint64_t>(affinity.m_base_hi) << 32u | affinity.m_base_lo;
+				const auto length = static_cast<uint64_t>(affinity.m_length_hi) << 32u | affinity.m_length_lo;
+				const auto node = node_for_domain(affinity.m_proximity_domain);
+				log.debug("Memory {x} - {x} on node {} (domain {})", Format::ptr((void*)base),
+				          Format::ptr((void*)(base + length)), node, affinity.m_proximity_domain);
+				if(const auto err = core::mem::set_node((void*)base, length, node); err != core::Error::Ok) {
+					log.warning("Failed to tag memory with node {}: {}", node, err);
+				}
+				break;
+			}
+			case 2: {
+				if(!fits(sizeof(SRATLocalX2ApicAffinity))) {
+					break;
+				}
+				auto const& affinity = *(srat + offset).as<SRATLocalX2ApicAffinity>();
+				if(!(affinity.m_flags & 1)) {
+					break;
+				}
+				const auto node = node_for_domain(affinity.m_proximity_domain);
+				//  Only xAPIC IDs are used by the kernel, larger IDs can't be targeted anyway
+				if(affinity.m_x2apic_id < sizeof(s_apic_nodes)) {
+					s_apic_nodes[affinity.m_x2apic_id] = node;
+				}
+				log.debug("x2APIC_ID={} on node {} (domain {})", affinity.m_x2apic_id, node,
+				          affinity.m_proximity_domain);
+				break;
+			}
+			default: break;
+		}
+		offset += entry.m_length;
+	}
+
+	if(s_node_count == 0) {
+		log.debug("SRAT has no enabled entries, assuming a single NUMA node");
+		return;
+	}
+
+	//  Distances are indexed by proximity domain, translate them to nodes
+	uint8_t distances[CONFIG_CORE_MEM_NUMA_MAX_NODES * CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+	bool has_distances = false;
+	if(auto maybe_slit = ACPI::find_table(ACPI::table_slit_sig); maybe_slit.has_value()) {
+		PhysAddr slit = PhysAddr { maybe_slit.unwrap().get() };
+		auto const& slit_header = *slit.as<SLITHeader>();
+		const auto localities = slit_header.m_locality_count;
+		const uint64_t matrix_size = slit_header.m_header.m_length >= sizeof(SLITHeader)
+		                                     ? slit_header.m_header.m_length - sizeof(SLITHeader)
+		                                     : 0;
+		//  The locality count comes from firmware, check it against the table before squaring it
+		has_distances = localities != 0 && localities <= matrix_size && localities * localities <= matrix_size;
+		for(size_t from = 0; from < s_node_count && has_distances; ++from) {
+			for(size_t to = 0; to < s_node_count && has_distances; ++to) {
+				const auto row = s_node_domains[from];
+				const auto column = s_node_domains[to];
+				if(row >= localities || column >= localities) {
+					has_distances = false;
+					break;
+				}
+				distances[from * s_node_count + to] =
+				        *(slit + sizeof(SLITHeader) + row * localities + column).as<uint8_t>();
+			}
+		}
+		if(!has_distances) {
+			log.warning("SLIT does not cover all proximity domains, ignoring it");
+		}
+	}
+
+	if(const auto err = core::mem::numa_init(s_node_count, has_distances ? distances : nullptr);
+	   err != core::Error::Ok) {
+		log.error("Failed to initialize the NUMA topology: {}", err);
+	}
+}
+
+uint32_t ACPI::numa_node_for_apic(uint8_t apic_id) {
+	return s_apic_nodes[apic_id];
+}
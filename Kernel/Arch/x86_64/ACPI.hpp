@@ -23,10 +23,72 @@ struct ACPISDTHeader {
 	uint32_t m_creator_revision;
 } __attribute__((packed));
 
+struct SRATHeader {
+	ACPISDTHeader m_header;
+	uint32_t m_reserved0;
+	uint64_t m_reserved1;
+} __attribute__((packed));
+
+struct SRATEntryHeader {
+	uint8_t m_type;
+	uint8_t m_length;
+} __attribute__((packed));
+
+struct SRATLocalApicAffinity {
+	SRATEntryHeader m_entry;
+	uint8_t m_proximity_domain_lo;
+	uint8_t m_apic_id;
+	uint32_t m_flags;
+	uint8_t m_sapic_eid;
+	uint8_t m_proximity_domain_hi[3];
+	uint32_t m_clock_domain;
+} __attribute__((packed));
+
+struct SRATMemoryAffinity {
+	SRATEntryHeader m_entry;
+	uint32_t m_proximity_domain;
+	uint16_t m_reserved0;
+	uint32_t m_base_lo;
+	uint32_t m_base_hi;
+	uint32_t m_length_lo;
+	uint32_t m_length_hi;
+	uint32_t m_reserved1;
+	uint32_t m_flags;
+	uint64_t m_reserved2;
+} __attribute__((packed));
+
+struct SRATLocalX2ApicAffinity {
+	SRATEntryHeader m_entry;
+	uint16_t m_reserved0;
+	uint32_t m_proximity_domain;
+	uint32_t m_x2apic_id;
+	uint32_t m_flags;
+	uint32_t m_clock_domain;
+	uint32_t m_reserved1;
+} __attribute__((packed));
+
+struct SLITHeader {
+	ACPISDTHeader m_header;
+	uint64_t m_locality_count;
+} __attribute__((packed));
+
 namespace ACPI {
 	static const uint64_t rsdp_signature = 0x2052545020445352;
 	static const uint32_t table_apic_sig = 0x43495041;
+	static const uint32_t table_srat_sig = 0x54415253;
+	static const uint32_t table_slit_sig = 0x54494C53;
 
 	void parse_tables();
 	KOptional<PhysPtr<ACPISDTHeader>> find_table(uint32_t signature);
+
+	/*	Read the NUMA topology from the SRAT and SLIT tables, if present.
+	 *	Physical memory is tagged with the nodes it is local to, and the topology
+	 *	is reported to core::mem. Must be called after parse_tables.
+	 */
+	void parse_numa();
+
+	/*	Get the NUMA node of the CPU with the given local APIC ID.
+	 *	Returns node 0 when the topology is not known.
+	 */
+	uint32_t numa_node_for_apic(uint8_t apic_id);
 }
\ No newline at end of file
@@ -137,6 +137,35 @@ void APIC::find_local_base() {
 	s_local_apic_base = PhysAddr { (void*)static_cast<uintptr_t>(local_apic) };
 }
 
+void APIC::enable_local(bool is_bootstrap) {
+	constexpr uint32 lvt_masked = 1u << 16u;
+	constexpr uint32 lvt_extint = 0b111u << 8u;
+	constexpr uint32 lvt_nmi = 0b100u << 8u;
+	constexpr uint32 siv_enable = 1u << 8u;
+	constexpr uint32 spurious_vector = 0xFF;
+
+	//  Virtual wire mode, PIC interrupts are only delivered to the bootstrap node
+	lapic_write(LAPICReg::LVTLINT0, is_bootstrap ? lvt_extint : lvt_masked);
+	lapic_write(LAPICReg::LVTLINT1, is_bootstrap ? lvt_nmi : lvt_masked);
+	lapic_write(LAPICReg::SIV, siv_enable | spurious_vector);
+}
+
+uint8 APIC::local_id() {
+	return lapic_read(LAPICReg::APICID) >> 24u;
+}
+
+void APIC::send_ipi(uint8 apic_id, uint8 vector) {
+	constexpr uint32 delivery_pending = 1u << 12u;
+
+	//  Wait for the previous IPI to be accepted first
+	while(lapic_read(LAPICReg::ICRLow) & delivery_pending) {
+		asm volatile("pause");
+	}
+	lapic_write(LAPICReg::ICRHi, static_cast<uint32>(apic_id) << 24u);
+	//  Writing the low half sends the IPI (fixed delivery, physical destination)
+	lapic_write(LAPICReg::ICRLow, vector);
+}
+
 gen::StaticVector<uint8, 512> const& APIC::ap_list() {
 	return s_ap_ids;
 }
@@ -31,6 +31,17 @@ namespace APIC {
 	uint32 lapic_read(LAPICReg);
 	void lapic_write(LAPICReg, uint32);
 
+	/*  Enable the local APIC of the current node, so that it can receive IPIs.
+	 *  The bootstrap node keeps receiving 8259 PIC interrupts through LINT0.
+	 */
+	void enable_local(bool is_bootstrap);
+	/*  Get the local APIC ID of the current node
+	 */
+	uint8 local_id();
+	/*  Send a fixed IPI with the given vector to the node with the given APIC ID
+	 */
+	void send_ipi(uint8 apic_id, uint8 vector);
+
 	gen::StaticVector<uint8, 512> const& ap_list();
 	uint8 ap_bootstrap_id();
 }
\ No newline at end of file
@@ -2,7 +2,10 @@
 #include <Arch/x86_64/CPUID.hpp>
 #include <Arch/x86_64/GDT.hpp>
 #include <Arch/x86_64/PortIO.hpp>
+#include <Arch/x86_64/TLB.hpp>
 #include <Core/Log/Logger.hpp>
+#include <Core/MP/MP.hpp>
+#include <LibGeneric/Algorithm.hpp>
 #include <Process/Process.hpp>
 #include <Syscalls/Syscall.hpp>
 #include <SystemTypes.hpp>
@@ -26,6 +29,9 @@ void CPU::initialize_features() {
 	if(CPUID::has_LAPIC()) {
 		log.info("|- LAPIC");
 	}
+	if(arch::tlb::enable_pcid()) {
+		log.info("|- PCID");
+	}
 
 	wrmsr(0xC0000080, (uint64_t)new_efer);
 
@@ -36,12 +42,32 @@ void CPU::initialize_features() {
 	wrmsr(0xC0000082, (uint64_t)_ukernel_syscall_entry);
 	//  Flag mask - clear IF on syscall entry
 	wrmsr(0xC0000084, 1u << 9u);
+
+	//  Make read-only pages read-only for the kernel too, so that copies to
+	//  user memory fault on copy-on-write pages instead of writing through them
+	set_cr0(cr0() | (1u << 16u));
 }
 
-extern "C" void _switch_to_asm(Thread*, Thread*);
+extern "C" void _switch_to_asm(Thread*, Thread*, uint64 cr3);
+
+static inline uint64 read_tsc() {
+	uint32 low, high;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return static_cast<uint64>(high) << 32u | low;
+}
 
 void CPU::switch_to(Thread* prev, Thread* next) {
-	_switch_to_asm(prev, next);
+	this_cpu()->platform.switch_start = read_tsc();
+	_switch_to_asm(prev, next, arch::tlb::prepare_switch(next->paging_handle()));
+
+	//  Running as `prev` again, switched to by another thread on this node.
+	//  Newly created threads start elsewhere and are not accounted for.
+	auto& platform = this_cpu()->platform;
+	const auto cycles = read_tsc() - platform.switch_start;
+	auto& stats = platform.switch_stats;
+	++stats.count;
+	stats.cycles += cycles;
+	stats.max_cycles = gen::max(stats.max_cycles, cycles);
 }
 
 void CPU::set_kernel_gs_base(void* p) {
@@ -60,6 +86,12 @@ uint64_t CPU::get_gs_base() {
 	return rdmsr(0xC0000101);
 }
 
+uint64 CPU::cr0() {
+	uint64 data = 0;
+	asm volatile("mov %0, %%cr0" : "=a"(data)::);
+	return data;
+}
+
 uint64 CPU::cr2() {
 	uint64 data = 0;
 	asm volatile("mov %0, %%cr2" : "=a"(data)::);
@@ -72,6 +104,24 @@ uint64 CPU::cr3() {
 	return data;
 }
 
+uint64 CPU::cr4() {
+	uint64 data = 0;
+	asm volatile("mov %0, %%cr4" : "=a"(data)::);
+	return data;
+}
+
+void CPU::set_cr0(uint64 data) {
+	asm volatile("mov %%cr0, %0" : : "r"(data) : "memory");
+}
+
+void CPU::set_cr3(uint64 data) {
+	asm volatile("mov %%cr3, %0" : : "r"(data) : "memory");
+}
+
+void CPU::set_cr4(uint64 data) {
+	asm volatile("mov %%cr4, %0" : : "r"(data) : "memory");
+}
+
 extern "C" [[noreturn]] void _bootstrap_user(PtraceRegs* regs);
 
 [[noreturn]] void CPU::jump_to_user(PtraceRegs* regs) {
@@ -11,8 +11,13 @@ public:
 	static void set_kernel_gs_base(void*);
 	static uint64_t get_kernel_gs_base();
 	static uint64_t get_gs_base();
+	static uint64 cr0();
 	static uint64 cr2();
 	static uint64 cr3();
+	static uint64 cr4();
+	static void set_cr0(uint64);
+	static void set_cr3(uint64);
+	static void set_cr4(uint64);
 	static void set_gs_base(void*);
 
 	[[noreturn]] static void jump_to_user(PtraceRegs* regs);
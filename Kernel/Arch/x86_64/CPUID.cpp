@@ -31,3 +31,9 @@ bool CPUID::has_LAPIC() {
 	__get_cpuid(0x1, &eax, &_unused, &_unused, &edx);
 	return edx & (1u << 9u);
 }
+
+bool CPUID::has_PCID() {
+	unsigned int eax {}, ecx {}, _unused, edx {};
+	__get_cpuid(0x1, &eax, &_unused, &ecx, &edx);
+	return ecx & (1u << 17u);
+}
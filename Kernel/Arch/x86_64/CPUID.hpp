@@ -6,4 +6,5 @@ namespace CPUID {
 	bool has_SEP();
 	bool has_RDRAND();
 	bool has_LAPIC();
+	bool has_PCID();
 }
\ No newline at end of file
@@ -47,6 +47,13 @@ namespace Exception {
 	};
 	typedef Response (*HandlerFunction)(PtraceRegs* frame, uint8 vector);
 
+	///  Entry of the exception fixup table
+	///  Faults on the instruction at `fault_ip` resume execution at `fixup_ip`.
+	struct FixupEntry {
+		uint64 fault_ip;
+		uint64 fixup_ip;
+	};
+
 	Response handle_uncaught(PtraceRegs*, uint8 vector);
 	Response handle_page_fault(PtraceRegs*, uint8);
 }
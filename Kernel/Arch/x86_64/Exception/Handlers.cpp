@@ -1,4 +1,6 @@
+#include <Arch/VM.hpp>
 #include <Arch/x86_64/CPU.hpp>
+#include <Arch/x86_64/LinkscriptSyms.hpp>
 #include <Core/Log/Logger.hpp>
 #include <Core/MP/MP.hpp>
 #include <Process/Process.hpp>
@@ -76,9 +78,51 @@ Exception::Response Exception::handle_uncaught(PtraceRegs* pt, uint8 vector) {
 	return Exception::Response::TerminateThread;
 }
 
+//  Look up the fixup address for a faulting kernel instruction, or zero if it has none.
+//  The table only lists the few instructions accessing user memory, a linear search is enough.
+static uint64 find_fixup(uint64 rip) {
+	auto* entry = reinterpret_cast<Exception::FixupEntry const*>(&_ukernel_ex_table_start);
+	auto* end = reinterpret_cast<Exception::FixupEntry const*>(&_ukernel_ex_table_end);
+	for(; entry < end; ++entry) {
+		if(entry->fault_ip == rip) {
+			return entry->fixup_ip;
+		}
+	}
+	return 0;
+}
+
 Exception::Response Exception::handle_page_fault(PtraceRegs* pt, uint8) {
+	//  Page fault error code bits
+	static constexpr uint64 PF_PRESENT = 1u << 0u;
+	static constexpr uint64 PF_WRITE = 1u << 1u;
+
 	const auto thread = this_cpu()->current_thread();
+	auto* fault_address = reinterpret_cast<void*>(CPU::cr2());
+
+	//  Accesses to user memory may hit a page of an anonymous mapping that was not
+	//  populated yet, or a write to a page shared copy-on-write. This is also the
+	//  case for kernel accesses to user memory.
+	const bool is_user_address = fault_address < KERNEL_VM_START;
+	if(thread && is_user_address) {
+		auto& vmm = thread->parent()->vmm();
+		if(!(pt->origin & PF_PRESENT) && vmm.populate_page(fault_address)) {
+			return Response::Resume;
+		}
+		if((pt->origin & PF_PRESENT) && (pt->origin & PF_WRITE) && vmm.unshare_page(fault_address)) {
+			return Response::Resume;
+		}
+	}
+
+	//  Kernel accesses to user memory that can't be resolved fail the access instead
+	const bool is_kernel_mode = (pt->cs & 3) == 0;
+	if(is_kernel_mode) {
+		if(const auto fixup = find_fixup(pt->rip); fixup != 0) {
+			pt->rip = fixup;
+			return Response::Resume;
+		}
+	}
 
+	log.error("Page fault at {x}, error code={x}", Format::ptr(fault_address), pt->origin);
 	dump_registers(pt);
 
 	if(!thread) {
@@ -1,10 +1,16 @@
 #include <Arch/x86_64/PtraceRegs.hpp>
+#include <Arch/x86_64/TLB.hpp>
 #include <Core/IRQ/InterruptDisabler.hpp>
 #include <Core/IRQ/IRQ.hpp>
 #include <Core/MP/MP.hpp>
 #include <Scheduler/Scheduler.hpp>
 
 extern "C" void _kernel_irq_dispatch(uint8_t irq, PtraceRegs* interrupt_trap_frame) {
+	//  Shootdowns are answered directly, as the initiator is spinning until we do
+	if(irq == arch::tlb::SHOOTDOWN_VECTOR) {
+		arch::tlb::handle_shootdown_ipi();
+		return;
+	}
 	core::irq::dispatch(core::irq::IrqId { irq }, interrupt_trap_frame);
 	this_cpu()->scheduler->interrupt_return_common();
 }
@@ -15,6 +15,8 @@ extern unsigned char _ukernel_preloader_physical[];
 extern unsigned char _ukernel_physical_start[];
 extern unsigned char _ukernel_text_start[];
 extern unsigned char _ukernel_text_end[];
+extern unsigned char _ukernel_ex_table_start[];
+extern unsigned char _ukernel_ex_table_end[];
 extern unsigned char _ukernel_virt_kstack_start[];
 extern unsigned char _ukernel_virt_kstack_end[];
 extern unsigned char _ukernel_shared_start[];
@@ -1,9 +1,11 @@
 #include "Boot.hpp"
 #include <Arch/VM.hpp>
+#include <Arch/x86_64/ACPI.hpp>
 #include <Arch/x86_64/APIC.hpp>
 #include <Arch/x86_64/CPU.hpp>
 #include <Arch/x86_64/Interrupt/IDT.hpp>
 #include <Arch/x86_64/MP/CpuBootstrapPage.hpp>
+#include <Arch/x86_64/TLB.hpp>
 #include <Core/Log/Logger.hpp>
 #include <Kernel/ksleep.hpp>
 #include <Process/Process.hpp>
@@ -53,15 +55,18 @@ void arch::mp::boot_aps() {
 		//  Pass the data page address
 		*(code_page.template as<uint16 volatile>() + 1) = (uintptr_t)data_page.get();
 
-		auto idle_task = Scheduler::create_idle_task(ap_id);
+		auto* ap_environment = core::mp::create_environment();
+		ap_environment->platform.apic_id = ap_id;
+		ap_environment->numa_node = ACPI::numa_node_for_apic(ap_id);
+		//  The idle task runs on the AP only, so its stack should be local to it
+		auto idle_task = Scheduler::create_idle_task(ap_id, ap_environment->numa_node);
 
 		CpuBootstrapPage bootstrap_struct {};
 		bootstrap_struct.real_gdtr_offset = (uintptr_t)data_page.get() + offsetof(CpuBootstrapPage, real_mode_gdt);
 		bootstrap_struct.compat_gdtr_offset = (uintptr_t)data_page.get() + offsetof(CpuBootstrapPage, compat_mode_gdt);
 		bootstrap_struct.long_gdtr_offset = (uintptr_t)data_page.get() + offsetof(CpuBootstrapPage, long_mode_gdt);
 		bootstrap_struct.cr3 = (uintptr_t)idle_task->parent()->vmm().paging_handle();
-		bootstrap_struct.ap_environment = core::mp::create_environment();
-		bootstrap_struct.ap_environment->platform.apic_id = ap_id;
+		bootstrap_struct.ap_environment = ap_environment;
 		bootstrap_struct.idle_task = idle_task;
 		bootstrap_struct.rsp = idle_task->irq_task_frame();
 		bootstrap_struct.code_page = code_page.get();
@@ -134,6 +139,8 @@ extern "C" void _ap_entrypoint(core::mp::Environment* env, Thread* idle_task, Ph
 
 	IDT::init_ap();
 	CPU::initialize_features();
+	APIC::enable_local(false);
+	arch::tlb::enable_shootdown();
 
 	//  Clean up bootstrap pages
 	idle_task->parent()->vmm().addrunmap(code_page.get());
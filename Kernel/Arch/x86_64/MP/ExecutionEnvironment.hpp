@@ -1,9 +1,20 @@
 #pragma once
 #include <Arch/x86_64/CPU.hpp>
 #include <Arch/x86_64/GDT.hpp>
+#include <Arch/x86_64/TLB.hpp>
 #include "SystemTypes.hpp"
 
 namespace arch::mp {
+	//  Context switch statistics of a node, see CPU::switch_to
+	struct SwitchStats {
+		uint64 count;      //  Switches that returned into a previously running thread
+		uint64 cycles;     //  TSC cycles spent in those switches
+		uint64 max_cycles; //  Longest switch
+		uint64 cr3_skipped;//  Switches between threads sharing the loaded paging handle
+		uint64 cr3_kept;   //  Switches that kept the cached translations of the next handle
+		uint64 cr3_flushed;//  Switches that flushed the translations of the next handle
+	};
+
 	struct ExecutionEnvironment {
 		ExecutionEnvironment* self_reference { this };//  0, store self reference for quick fetching
 		Thread* thread {};                            //  8
@@ -11,6 +22,14 @@ namespace arch::mp {
 		uint64 _scratch {};                           //  24, only used in SysEntry to temporarily preserve user rsp
 		TSS tss {};
 		GDT gdt { tss };
+		void* active_paging_handle {};//  Paging handle loaded on this node, used for targeting TLB shootdowns
+		bool tlb_shootdown_online {}; //  Node can receive TLB shootdown IPIs
+		bool tlb_shootdown_pending {};//  Node must process the TLB shootdown request in flight
+		void* pcid_handles[CONFIG_ARCH_X86_64_TLB_PCID_SLOTS] {};//  Paging handle assigned to PCID `slot + 1`
+		uint32 pcid_stale {};                                     //  Bitmask of slots with stale cached translations
+		uint32 pcid_victim {};                                    //  Slot to reassign next
+		uint64 switch_start {};                                   //  TSC value at the start of the switch in flight
+		SwitchStats switch_stats {};
 	};
 
 	static_assert(offsetof(ExecutionEnvironment, self_reference) == 0x0,
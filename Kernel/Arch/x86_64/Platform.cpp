@@ -9,8 +9,10 @@
 #include <Arch/x86_64/PCI/PCI.hpp>
 #include <Arch/x86_64/Serial.hpp>
 #include <Arch/x86_64/SerialConsole.hpp>
+#include <Arch/x86_64/TLB.hpp>
 #include <Arch/x86_64/VGAConsole.hpp>
 #include <Core/Error/Error.hpp>
+#include <Core/Mem/GFP.hpp>
 #include <Core/Mem/VM.hpp>
 #include <Core/MP/MP.hpp>
 #include <Memory/VMM.hpp>
@@ -42,7 +44,13 @@ core::Error arch::platform_init() {
 	PCI::discover();
 	Syscall::init();
 	ACPI::parse_tables();
+	ACPI::parse_numa();
 	APIC::discover();
+	//  The bootstrap environment was created before the APIC was discovered
+	this_cpu()->platform.apic_id = APIC::local_id();
+	this_cpu()->numa_node = ACPI::numa_node_for_apic(APIC::local_id());
+	APIC::enable_local(true);
+	arch::tlb::enable_shootdown();
 	arch::mp::boot_aps();
 
 	return core::Error::Ok;
@@ -64,3 +72,13 @@ void* arch::mp::environment_get() {
 	};
 	return static_cast<void*>(read_env());
 }
+
+void platform_idle() {
+	while(true) {
+		//  Clear pages for later allocations while there is nothing else to do. The
+		//  idle task is preempted as usual once a thread becomes runnable.
+		if(core::mem::zero_pool_refill(CONFIG_CORE_MEM_GFP_ZERO_POOL_BATCH) == 0) {
+			asm volatile("hlt");
+		}
+	}
+}
@@ -0,0 +1,291 @@
+#include "TLB.hpp"
+#include <Arch/VM.hpp>
+#include <Arch/x86_64/APIC.hpp>
+#include <Arch/x86_64/CPU.hpp>
+#include <Arch/x86_64/CPUID.hpp>
+#include <Core/IRQ/InterruptDisabler.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <Core/MP/MP.hpp>
+#include <LibGeneric/Spinlock.hpp>
+#include <SystemTypes.hpp>
+
+/*  Ranges spanning more pages than this are invalidated by flushing the entire TLB */
+#define CONFIG_ARCH_X86_64_TLB_FLUSH_ALL_THRESHOLD (32)
+
+/*  Tag translations with PCIDs when supported, so that they survive context switches */
+#define CONFIG_ARCH_X86_64_TLB_PCID (1)
+/*  Don't reload CR3 when switching between threads that share a paging handle.
+ *  With both this and CONFIG_ARCH_X86_64_TLB_PCID disabled, every switch reloads CR3 and flushes the TLB. */
+#define CONFIG_ARCH_X86_64_TLB_SKIP_CR3_RELOAD (1)
+
+static_assert(CONFIG_ARCH_X86_64_TLB_PCID_SLOTS > 0 && CONFIG_ARCH_X86_64_TLB_PCID_SLOTS < 32,
+              "PCID slots must fit in the stale slot bitmask");
+
+static constexpr uint64 CR4_PGE = 1u << 7u;
+static constexpr uint64 CR4_PCIDE = 1u << 17u;
+//  Loading CR3 with this bit set keeps the translations cached for the PCID
+static constexpr uint64 CR3_NOFLUSH = 1ul << 63u;
+
+struct ShootdownRequest {
+	uintptr_t start;
+	uintptr_t end;
+	bool full;
+};
+
+//  Serializes shootdowns, only one request can be in flight at a time
+static constinit gen::Spinlock s_shootdown_lock {};
+//  Request in flight, only modified with s_shootdown_lock held
+static constinit ShootdownRequest s_request {};
+//  Number of nodes that did not acknowledge the request in flight yet
+static constinit uint32 s_pending_acks {};
+//  PCIDs are in use, the same on all nodes
+static constinit bool s_pcid_enabled {};
+
+static bool is_full_flush(uintptr_t start, uintptr_t end) {
+	return (end - start) / 0x1000 > CONFIG_ARCH_X86_64_TLB_FLUSH_ALL_THRESHOLD;
+}
+
+//  Shared kernel translations are global, and not tagged with a PCID
+static bool is_global_range(uintptr_t start, uintptr_t end) {
+	return start >= reinterpret_cast<uintptr_t>(KERNEL_VM_SHARED_START) &&
+	       end - 1 <= reinterpret_cast<uintptr_t>(KERNEL_VM_SHARED_END);
+}
+
+//  Make the node flush the translations of the handle the next time it switches to it
+static void mark_stale_on(arch::mp::ExecutionEnvironment& platform, arch::PagingHandle handle) {
+	for(size_t slot = 0; slot < CONFIG_ARCH_X86_64_TLB_PCID_SLOTS; ++slot) {
+		if(__atomic_load_n(&platform.pcid_handles[slot], __ATOMIC_RELAXED) == handle) {
+			__atomic_or_fetch(&platform.pcid_stale, 1u << slot, __ATOMIC_SEQ_CST);
+		}
+	}
+}
+
+/*	Make all nodes flush the translations cached for the handle the next time
+ * 	they switch to it. Nodes that have the handle loaded are not affected
+ * 	until they switch away, and must be invalidated directly.
+ *
+ * 	This must happen before checking the active handles of other nodes. A node
+ * 	switching to the handle publishes it before reading its stale slots, so
+ * 	it either sees the mark or receives the shootdown.
+ */
+static void mark_stale(arch::PagingHandle handle) {
+	if(!s_pcid_enabled) {
+		return;
+	}
+	if(!core::mp::is_environment_available()) {
+		mark_stale_on(this_cpu()->platform, handle);
+		return;
+	}
+	for(size_t node = 0; node < core::mp::environment_count(); ++node) {
+		if(auto* env = core::mp::environment_for_node(node)) {
+			mark_stale_on(env->platform, handle);
+		}
+	}
+}
+
+//  Drop translations of the given range from the TLB of the current node
+static void invalidate_local(uintptr_t start, uintptr_t end, bool full) {
+	if(!full) {
+		for(auto address = start; address < end; address += 0x1000) {
+			asm volatile("invlpg [%0]\n" : : "r"(address) : "memory");
+		}
+		return;
+	}
+
+	//  Reloading CR3 keeps global translations around, toggling CR4.PGE drops them too
+	const auto cr4 = CPU::cr4();
+	if(cr4 & CR4_PGE) {
+		CPU::set_cr4(cr4 & ~CR4_PGE);
+		CPU::set_cr4(cr4);
+	} else {
+		CPU::set_cr3(CPU::cr3());
+	}
+}
+
+//  Process the request in flight if the current node was asked to
+static void process_pending() {
+	auto& platform = this_cpu()->platform;
+	if(!__atomic_exchange_n(&platform.tlb_shootdown_pending, false, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	invalidate_local(s_request.start, s_request.end, s_request.full);
+	__atomic_sub_fetch(&s_pending_acks, 1, __ATOMIC_RELEASE);
+}
+
+/*	Invalidate the range on all other nodes that may have it cached, and
+ * 	wait until all of them are done. Must be called with interrupts disabled.
+ *
+ * 	Kernel translations are shared by all paging structures, so they are
+ * 	invalidated everywhere. User translations only need to be invalidated
+ * 	on nodes that have the paging structure loaded, as switching to it
+ * 	later on flushes the stale translations anyway.
+ */
+static void shootdown(arch::PagingHandle handle, uintptr_t start, uintptr_t end, bool full) {
+	if(!core::mp::is_environment_available()) {
+		return;
+	}
+	const auto node_count = core::mp::environment_count();
+	if(node_count < 2) {
+		return;
+	}
+
+	//  Another node may be waiting for us to acknowledge its request,
+	//  which we can't receive as an IPI with interrupts disabled.
+	while(!s_shootdown_lock.try_lock()) {
+		process_pending();
+		asm volatile("pause");
+	}
+
+	s_request = ShootdownRequest { .start = start, .end = end, .full = full };
+	//  The paging structure changes must be visible before checking the
+	//  active handles of other nodes, see arch::tlb::prepare_switch
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	const bool is_kernel = start >= reinterpret_cast<uintptr_t>(KERNEL_VM_START);
+	auto* self = this_cpu();
+	for(size_t node = 0; node < node_count; ++node) {
+		auto* env = core::mp::environment_for_node(node);
+		if(!env || env == self) {
+			continue;
+		}
+		auto& platform = env->platform;
+		if(!__atomic_load_n(&platform.tlb_shootdown_online, __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		if(!is_kernel && __atomic_load_n(&platform.active_paging_handle, __ATOMIC_RELAXED) != handle) {
+			continue;
+		}
+		__atomic_add_fetch(&s_pending_acks, 1, __ATOMIC_RELAXED);
+		__atomic_store_n(&platform.tlb_shootdown_pending, true, __ATOMIC_RELEASE);
+		APIC::send_ipi(platform.apic_id, arch::tlb::SHOOTDOWN_VECTOR);
+	}
+
+	while(__atomic_load_n(&s_pending_acks, __ATOMIC_ACQUIRE) != 0) {
+		asm volatile("pause");
+	}
+	s_shootdown_lock.unlock();
+}
+
+void arch::TlbGather::defer_free(void* page) {
+	*PhysPtr<void*> { static_cast<void**>(page) } = m_deferred;
+	m_deferred = page;
+}
+
+void arch::TlbGather::free_deferred() {
+	while(m_deferred) {
+		auto* next = *PhysPtr<void*> { static_cast<void**>(m_deferred) };
+		core::mem::free_pages(core::mem::PageAllocation { .base = m_deferred, .order = 0, .flags = {} });
+		m_deferred = next;
+	}
+}
+
+void arch::TlbGather::flush() {
+	if(!empty()) {
+		const bool global = is_global_range(m_start, m_end);
+		//  INVLPG only drops paging-structure caches of the current PCID, freed kernel
+		//  tables may still be cached for other PCIDs and require a full flush
+		const bool full = is_full_flush(m_start, m_end) || (global && m_deferred && s_pcid_enabled);
+
+		core::irq::InterruptDisabler id {};
+		if(!global) {
+			mark_stale(m_handle);
+		}
+		invalidate_local(m_start, m_end, full);
+		shootdown(m_handle, m_start, m_end, full);
+		reset();
+	}
+	free_deferred();
+}
+
+void arch::TlbGather::flush_local() {
+	if(!empty()) {
+		const bool global = is_global_range(m_start, m_end);
+		const bool full = is_full_flush(m_start, m_end) || (global && m_deferred && s_pcid_enabled);
+
+		core::irq::InterruptDisabler id {};
+		if(!global) {
+			mark_stale_on(this_cpu()->platform, m_handle);
+		}
+		invalidate_local(m_start, m_end, full);
+		reset();
+	}
+	free_deferred();
+}
+
+void arch::tlb::enable_shootdown() {
+	auto& platform = this_cpu()->platform;
+	__atomic_store_n(&platform.active_paging_handle,
+	                 reinterpret_cast<PagingHandle>(CPU::cr3() & PAGING_ADDRESS_MASK), __ATOMIC_RELAXED);
+	__atomic_store_n(&platform.tlb_shootdown_online, true, __ATOMIC_RELEASE);
+}
+
+bool arch::tlb::enable_pcid() {
+#if CONFIG_ARCH_X86_64_TLB_PCID
+	//  Kernel translations are shared between PCIDs by making them global
+	if(!CPUID::has_PCID() || !(CPU::cr4() & CR4_PGE)) {
+		return false;
+	}
+	//  CR3 is loaded with PCID 0 at this point, which is never given out to
+	//  paging handles, so that it can be used whenever PCIDs are not known.
+	CPU::set_cr4(CPU::cr4() | CR4_PCIDE);
+	s_pcid_enabled = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint64 arch::tlb::prepare_switch(PagingHandle handle) {
+	auto& platform = this_cpu()->platform;
+	auto& stats = platform.switch_stats;
+#if CONFIG_ARCH_X86_64_TLB_SKIP_CR3_RELOAD
+	if(__atomic_load_n(&platform.active_paging_handle, __ATOMIC_RELAXED) == handle) {
+		++stats.cr3_skipped;
+		return 0;
+	}
+#endif
+
+	__atomic_store_n(&platform.active_paging_handle, handle, __ATOMIC_RELAXED);
+	if(!s_pcid_enabled) {
+		//  Loading CR3 is serializing, so the store is visible to shootdown
+		//  initiators before any translations of the new handle are cached.
+		++stats.cr3_flushed;
+		return reinterpret_cast<uint64>(handle);
+	}
+	//  Stale slots must only be checked after the active handle is visible, see mark_stale
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	size_t slot = 0;
+	while(slot < CONFIG_ARCH_X86_64_TLB_PCID_SLOTS && platform.pcid_handles[slot] != handle) {
+		++slot;
+	}
+	bool keep;
+	if(slot < CONFIG_ARCH_X86_64_TLB_PCID_SLOTS) {
+		const auto bit = 1u << slot;
+		keep = !(__atomic_fetch_and(&platform.pcid_stale, ~bit, __ATOMIC_ACQ_REL) & bit);
+	} else {
+		//  Evict the translations of another handle, loading CR3 without the no-flush bit drops them
+		slot = platform.pcid_victim;
+		platform.pcid_victim = (slot + 1) % CONFIG_ARCH_X86_64_TLB_PCID_SLOTS;
+		__atomic_store_n(&platform.pcid_handles[slot], handle, __ATOMIC_RELAXED);
+		__atomic_and_fetch(&platform.pcid_stale, ~(1u << slot), __ATOMIC_RELAXED);
+		keep = false;
+	}
+
+	if(keep) {
+		++stats.cr3_kept;
+	} else {
+		++stats.cr3_flushed;
+	}
+	return reinterpret_cast<uint64>(handle) | (slot + 1) | (keep ? CR3_NOFLUSH : 0);
+}
+
+void arch::tlb::release_handle(PagingHandle handle) {
+	core::irq::InterruptDisabler id {};
+	mark_stale(handle);
+}
+
+void arch::tlb::handle_shootdown_ipi() {
+	process_pending();
+	APIC::lapic_write(LAPICReg::EOI, 0);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <Arch/VM.hpp>
+#include <SystemTypes.hpp>
+
+/*  Number of address spaces per node that keep their translations cached across context switches */
+#define CONFIG_ARCH_X86_64_TLB_PCID_SLOTS (8)
+
+namespace arch::tlb {
+	///  Interrupt vector used for TLB shootdown IPIs
+	static constexpr uint8 SHOOTDOWN_VECTOR = 0xF0;
+
+	///  Allow the current node to receive TLB shootdowns
+	///  Must be called once the local APIC of the node was enabled.
+	void enable_shootdown();
+	///  Enable process-context identifiers on the current node, if supported
+	///  Returns true if PCIDs are in use.
+	bool enable_pcid();
+	///  Record the paging handle that is about to be loaded on the current node
+	///  Returns the value to load into CR3, or zero if the handle is already loaded.
+	uint64 prepare_switch(PagingHandle);
+	///  Drop the translations cached for the paging handle on all nodes
+	///  Must be called before the handle is freed, as its page may be reused for another one.
+	void release_handle(PagingHandle);
+	///  Handle a shootdown IPI received by the current node
+	void handle_shootdown_ipi();
+}
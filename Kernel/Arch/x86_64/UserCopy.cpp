@@ -0,0 +1,48 @@
+#include <Arch/UserCopy.hpp>
+#include <SystemTypes.hpp>
+
+extern "C" size_t _x86_copy_user(void* dst, void const* src, size_t len);
+extern "C" int64 _x86_strncpy_user(char* dst, char const* src, size_t len);
+
+//  End of the canonical lower half. Accesses to non-canonical addresses raise #GP
+//  instead of a page fault, which the fixup table does not cover.
+static constexpr uintptr_t USER_VM_END = 0x0000800000000000;
+
+//  Check that the range lies entirely in the lower half, the copy routines
+//  themselves happily access kernel memory. This does not check the U bit of
+//  the pages, callers check the range against the user mappings of the process.
+static bool is_user_range(void const* ptr, size_t len) {
+	const auto start = reinterpret_cast<uintptr_t>(ptr);
+	const auto limit = USER_VM_END;
+	return start <= limit && len <= limit - start;
+}
+
+size_t arch::copy_from_user(void* dst, void const* user_src, size_t len) {
+	if(!is_user_range(user_src, len)) {
+		return len;
+	}
+	return _x86_copy_user(dst, user_src, len);
+}
+
+size_t arch::copy_to_user(void* user_dst, void const* src, size_t len) {
+	if(!is_user_range(user_dst, len)) {
+		return len;
+	}
+	return _x86_copy_user(user_dst, src, len);
+}
+
+int64 arch::strncpy_from_user(char* dst, char const* user_src, size_t len) {
+	//  The string may end well before the end of user memory, only the start is checked up front
+	const auto limit = USER_VM_END;
+	const auto start = reinterpret_cast<uintptr_t>(user_src);
+	if(start >= limit) {
+		return -1;
+	}
+	const auto bounded_len = len < limit - start ? len : limit - start;
+	const auto result = _x86_strncpy_user(dst, user_src, bounded_len);
+	//  Ran into the end of user memory before finding the terminator
+	if(bounded_len < len && result == static_cast<int64>(bounded_len)) {
+		return -1;
+	}
+	return result;
+}
@@ -2,12 +2,22 @@
 #include <Arch/VM.hpp>
 #include <Arch/x86_64/CPUID.hpp>
 #include <Arch/x86_64/LinkscriptSyms.hpp>
+#include <Arch/x86_64/TLB.hpp>
 #include <Core/Assert/Panic.hpp>
 #include <Core/Error/Error.hpp>
 #include <Core/Mem/GFP.hpp>
+#include <Core/Mem/PageFrame.hpp>
 #include <string.h>
 #include <SystemTypes.hpp>
 
+//  Large page flag of PDEs, huge page flag of PDPTEs, both are located at the same bit
+static constexpr uint64 LARGE_PAGE_FLAG = static_cast<uint64>(arch::FlagPDE::LargePage);
+static_assert(LARGE_PAGE_FLAG == static_cast<uint64>(arch::FlagPDPTE::HugePage));
+//  Size of the virtual address range covered by an entry of a PML4, PDPT and PD respectively
+static constexpr uintptr_t PML4E_SPAN = 0x8000000000;
+static constexpr uintptr_t PDPTE_SPAN = 0x40000000;
+static constexpr uintptr_t PDE_SPAN = 0x200000;
+
 //  Identity map the given paging handle
 static inline arch::PagingTable* idmap_handle(arch::PagingHandle handle) {
 	return reinterpret_cast<arch::PagingTable*>(idmap(handle));
@@ -21,19 +31,189 @@ static inline arch::PagingTable* idmap_entry_to_table(arch::PagingEntry* entry)
 	return reinterpret_cast<arch::PagingTable*>(idmap(entry->getaddr()));
 }
 
+//  Check if the PML4 entry covering the address is shared by all paging structures
+static inline bool is_shared_pml4e(void* vptr) {
+	const auto index = arch::index_pml4e(vptr);
+	return index >= arch::index_pml4e(KERNEL_VM_SHARED_START) && index <= arch::index_pml4e(KERNEL_VM_SHARED_END);
+}
+
+static bool is_table_empty(arch::PagingTable* table) {
+	for(size_t i = 0; i < 512; ++i) {
+		if(table->data[i] & static_cast<uint64>(arch::EntryFlags::Present)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+//  Unlink the table pointed to by the entry, the table is freed once the gather is flushed
+static void release_table(arch::PagingEntry* entry, arch::TlbGather& gather) {
+	gather.defer_free(entry->getaddr());
+	entry->data = 0;
+}
+
 core::Result<arch::PagingHandle> arch::addralloc() {
-	auto maybe_page = core::mem::allocate_pages(0, {});
+	auto maybe_page = core::mem::allocate_pages(0, core::mem::PageAllocFlags::Zeroed);
 	if(maybe_page.has_error()) {
 		return core::Result<arch::PagingHandle> { core::Error::NoMem };
 	}
 	auto allocation = maybe_page.destructively_move_data();
-	memset(idmap(allocation.base), 0x0, allocation.size());
 	return core::Result<arch::PagingHandle> { static_cast<PagingHandle>(allocation.base) };
 }
 
-core::Error arch::addrfree(PagingHandle) {
-	//  TODO: Walk the page tables and free all intermediate pages we've allocated
-	core::panic("arch::addrfree unimplemented on x86_64!");
+//  Size of the virtual address range covered by a single entry of a table
+//  at the given level (see clone_table)
+template<size_t Level>
+static constexpr uintptr_t entry_span() {
+	return 1ul << (12u + 9u * Level);
+}
+
+//  Drop the references held by a leaf entry of a user page
+static void release_user_pages(arch::PagingEntry* entry, size_t count, arch::TlbGather& gather) {
+	auto* base = static_cast<uint8*>(entry->getaddr());
+	for(size_t i = 0; i < count; ++i) {
+		if(core::mem::page_unref(base + i * 0x1000)) {
+			gather.defer_free(base + i * 0x1000);
+		}
+	}
+}
+
+//  Tear down a paging table, see clone_table for the meaning of `Level` and `base`
+//  Pages mapped by the table are only released if they are user pages, as kernel
+//  mappings in the lower half (V86 buffers, etc.) point to memory not owned by the table.
+template<size_t Level>
+static void free_table(arch::PagingTable* table, arch::TlbGather& gather, uintptr_t base) {
+	using namespace arch;
+	for(size_t i = 0; i < 512; ++i) {
+		if constexpr(Level == 3) {
+			//  Shared kernel tables are owned by the root paging structure
+			if(i >= index_pml4e(KERNEL_VM_SHARED_START) && i <= index_pml4e(KERNEL_VM_SHARED_END)) {
+				continue;
+			}
+		}
+		auto* entry = reinterpret_cast<arch::PagingEntry*>(table->data + i);
+		if(!entry->get(EntryFlags::Present)) {
+			continue;
+		}
+
+		auto address = base + i * entry_span<Level>();
+		if constexpr(Level == 3) {
+			//  Sign-extend addresses of the upper half
+			if(i >= 256) {
+				address |= 0xFFFF000000000000;
+			}
+		}
+
+		const bool is_leaf = Level == 0 || ((Level == 1 || Level == 2) && (entry->data & LARGE_PAGE_FLAG));
+		if(is_leaf) {
+			if(entry->get(EntryFlags::User)) {
+				release_user_pages(entry, entry_span<Level>() / 0x1000, gather);
+			}
+			gather.add(reinterpret_cast<void*>(address), entry_span<Level>());
+			entry->data = 0;
+			continue;
+		}
+		if constexpr(Level > 0) {
+			free_table<Level - 1>(idmap_entry_to_table(entry), gather, address);
+			release_table(entry, gather);
+		}
+	}
+}
+
+//  Tear down a clone that failed part way, see clone_table. Only the entries before `end`
+//  were cloned, later ones still point to the tables and pages of the source and are
+//  left alone. The clone was never loaded, so it is freed without invalidating TLBs.
+template<size_t Level>
+static void discard_clone(arch::PagingTable* clone, size_t end) {
+	using namespace arch;
+	for(size_t i = 0; i < end; ++i) {
+		if constexpr(Level == 3) {
+			if(i >= index_pml4e(KERNEL_VM_SHARED_START) && i <= index_pml4e(KERNEL_VM_SHARED_END)) {
+				continue;
+			}
+		}
+		auto* entry = reinterpret_cast<arch::PagingEntry*>(clone->data + i);
+		if(!entry->get(EntryFlags::Present)) {
+			continue;
+		}
+		//  User large pages are always split before cloning, large leaves here are kernel mappings
+		const bool is_leaf = Level == 0 || ((Level == 1 || Level == 2) && (entry->data & LARGE_PAGE_FLAG));
+		if(is_leaf) {
+			if(Level == 0 && entry->get(EntryFlags::User) && core::mem::page_unref(entry->getaddr())) {
+				core::mem::free_pages(core::mem::PageAllocation { .base = entry->getaddr(), .order = 0, .flags = {} });
+			}
+			continue;
+		}
+		if constexpr(Level > 0) {
+			discard_clone<Level - 1>(idmap_entry_to_table(entry), 512);
+		}
+	}
+	core::mem::free_pages(core::mem::PageAllocation { .base = idunmap(clone), .order = 0, .flags = {} });
+}
+
+//  Give write access back to copy-on-write pages of the source of a failed clone, that are
+//  no longer shared with anybody. This is what the first write fault would do otherwise.
+template<size_t Level>
+static void restore_writable(arch::PagingTable* table) {
+	using namespace arch;
+	for(size_t i = 0; i < 512; ++i) {
+		if constexpr(Level == 3) {
+			if(i >= index_pml4e(KERNEL_VM_SHARED_START) && i <= index_pml4e(KERNEL_VM_SHARED_END)) {
+				continue;
+			}
+		}
+		auto* entry = reinterpret_cast<arch::PagingEntry*>(table->data + i);
+		if(!entry->get(EntryFlags::Present)) {
+			continue;
+		}
+		if constexpr(Level == 0) {
+			if(entry->get(EntryFlags::User) && entry->get(FlagPTE::CopyOnWrite) &&
+			   core::mem::page_refcount(entry->getaddr()) == 1) {
+				entry->set(FlagPTE::CopyOnWrite, false);
+				entry->set(EntryFlags::RW, true);
+			}
+		} else if(!((Level == 1 || Level == 2) && (entry->data & LARGE_PAGE_FLAG))) {
+			restore_writable<Level - 1>(idmap_entry_to_table(entry));
+		}
+	}
+}
+
+core::Error arch::addrfree(PagingHandle handle) {
+	if(!handle) {
+		return core::Error::InvalidArgument;
+	}
+
+	TlbGather gather { handle };
+	free_table<3>(idmap_handle(handle), gather, 0);
+	arch::tlb::release_handle(handle);
+	gather.defer_free(handle);
+	gather.flush();
+	return core::Error::Ok;
+}
+
+//  Replace a large page entry with a table of regular entries mapping the same memory
+//  with the same permissions. The caller must invalidate the range covered by the entry.
+static core::Error split_large_entry(arch::PagingEntry* entry) {
+	using namespace arch;
+
+	auto maybe_page = core::mem::allocate_pages(0, {});
+	if(maybe_page.has_error()) {
+		return core::Error::NoMem;
+	}
+	auto* table_page = maybe_page.destructively_move_data().base;
+	auto* table = idmap_handle(table_page);
+
+	//  Bit 7 is the page size flag in the directory entry, but PAT in regular entries
+	const auto flags = entry->data & ~PAGING_ADDRESS_MASK & ~static_cast<uint64>(FlagPDE::LargePage);
+	auto* base = static_cast<uint8*>(entry->getaddr());
+	for(size_t i = 0; i < 512; ++i) {
+		table->data[i] = flags | reinterpret_cast<uint64>(base + i * 0x1000);
+	}
+
+	entry->data = 0;
+	entry->reset(EntryFlags::Present | EntryFlags::RW | EntryFlags::User);
+	entry->setaddr(table_page);
+	return core::Error::Ok;
 }
 
 //  Clone paging tables
@@ -42,12 +222,12 @@ core::Error arch::addrfree(PagingHandle) {
 //  	1: PD
 //  	2: PDPT
 //  	3: PML4
+//  `base` is the virtual address covered by the first entry of the table. Entries of the
+//  source structure that are changed to copy-on-write are added to `source_gather`.
 template<size_t Level = 3>
-core::Result<arch::PagingTable*> clone_table(arch::PagingTable* table) {
+core::Result<arch::PagingTable*> clone_table(arch::PagingTable* table, arch::TlbGather& source_gather,
+                                             uintptr_t base = 0) {
 	using namespace arch;
-	//  Large/huge page flag is located at the same bit
-	static constexpr uint64 LARGE_PAGE_FLAG = 1U << 7U;
-
 	auto maybe_page = core::mem::allocate_pages(0, {});
 	if(maybe_page.has_error()) {
 		return core::Result<arch::PagingTable*> { core::Error::NoMem };
@@ -74,18 +254,33 @@ core::Result<arch::PagingTable*> clone_table(arch::PagingTable* table) {
 		if constexpr(Level == 2 || Level == 1) {
 			//  If this table can contain large/huge pags, and the entry has the flag set,
 			//  do not process it, as it won't contain a table address.
-			if(new_table->data[i] & LARGE_PAGE_FLAG) {
+			const bool is_user_large = Level == 1 && (new_table->data[i] & static_cast<uint64>(EntryFlags::User));
+			if((new_table->data[i] & LARGE_PAGE_FLAG) && !is_user_large) {
 				continue;
 			}
+			//  Large user pages are split in the source first, so that the regular
+			//  pages they consist of can be shared copy-on-write below.
+			if(new_table->data[i] & LARGE_PAGE_FLAG) {
+				auto* source = reinterpret_cast<arch::PagingEntry*>(table->data + i);
+				if(split_large_entry(source) != core::Error::Ok) {
+					discard_clone<Level>(new_table, i);
+					return core::Result<arch::PagingTable*> { core::Error::NoMem };
+				}
+				source_gather.add(reinterpret_cast<void*>(base + i * entry_span<Level>()), entry_span<Level>());
+				new_table->data[i] = table->data[i];
+			}
 		}
 		auto* entry = reinterpret_cast<arch::PagingEntry*>(new_table->data + i);
 		if(entry->get(arch::EntryFlags::Present)) {
-			auto maybe_subtable = clone_table<Level - 1>(idmap_handle(entry->getaddr()));
+			auto maybe_subtable = clone_table<Level - 1>(idmap_handle(entry->getaddr()), source_gather,
+			                                             base + i * entry_span<Level>());
 			if(maybe_subtable.has_error()) {
+				//  The subtable cleaned up after itself, the entry still points to the source
+				discard_clone<Level>(new_table, i);
 				return core::Result<arch::PagingTable*> { core::Error::NoMem };
 			}
 			arch::PagingTable* subtable = maybe_subtable.destructively_move_data();
-			entry->setaddr(subtable);
+			entry->setaddr(idunmap(subtable));
 		}
 	}
 
@@ -94,9 +289,13 @@ core::Result<arch::PagingTable*> clone_table(arch::PagingTable* table) {
 
 //  Clone paging tables
 //  Specialization for Level=0 to terminate recursive template instantiation
-//  Here, table points to a PT.
+//  Here, table points to a PT. User pages are shared with the clone instead
+//  of being copied, see arch::addrclone.
 template<>
-core::Result<arch::PagingTable*> clone_table<0>(arch::PagingTable* table) {
+core::Result<arch::PagingTable*> clone_table<0>(arch::PagingTable* table, arch::TlbGather& source_gather,
+                                                uintptr_t base) {
+	using namespace arch;
+
 	auto maybe_page = core::mem::allocate_pages(0, {});
 	if(maybe_page.has_error()) {
 		return core::Result<arch::PagingTable*> { core::Error::NoMem };
@@ -106,6 +305,40 @@ core::Result<arch::PagingTable*> clone_table<0>(arch::PagingTable* table) {
 
 	//  Copy over the original table contents
 	memcpy(new_table, table, 0x1000);
+
+	for(size_t i = 0; i < 512; ++i) {
+		auto* source = reinterpret_cast<PagingEntry*>(table->data + i);
+		auto* entry = reinterpret_cast<PagingEntry*>(new_table->data + i);
+		if(!source->get(EntryFlags::Present) || !source->get(EntryFlags::User)) {
+			continue;
+		}
+
+		auto* page = source->getaddr();
+		if(core::mem::page_ref(page) != core::Error::Ok) {
+			//  The page can't be shared, give the clone a copy of its own instead
+			auto maybe_copy = core::mem::allocate_pages(0, {});
+			if(maybe_copy.has_error()) {
+				discard_clone<0>(new_table, i);
+				return core::Result<arch::PagingTable*> { core::Error::NoMem };
+			}
+			auto* copy = maybe_copy.destructively_move_data().base;
+			memcpy(idmap(copy), idmap(page), 0x1000);
+			entry->setaddr(copy);
+			continue;
+		}
+
+		//  Pages write-protected by a collapse in progress are writable as well, sharing them cancels the collapse
+		if(source->get(EntryFlags::RW) || source->get(FlagPTE::Collapsing)) {
+			source->set(EntryFlags::RW, false);
+			source->set(FlagPTE::Collapsing, false);
+			source->set(FlagPTE::CopyOnWrite, true);
+			entry->set(EntryFlags::RW, false);
+			entry->set(FlagPTE::Collapsing, false);
+			entry->set(FlagPTE::CopyOnWrite, true);
+			source_gather.add(reinterpret_cast<void*>(base + i * 0x1000), 0x1000);
+		}
+	}
+
 	return core::Result<arch::PagingTable*> { new_table };
 }
 
@@ -114,8 +347,13 @@ core::Result<arch::PagingHandle> arch::addrclone(arch::PagingHandle handle) {
 		return core::Result<arch::PagingHandle> { core::Error::InvalidArgument };
 	}
 
-	auto maybe_pml4 = clone_table<>(idmap_handle(handle));
+	//  Pages of the source that became read-only must be flushed from the TLBs
+	TlbGather source_gather { handle };
+	auto maybe_pml4 = clone_table<>(idmap_handle(handle), source_gather);
 	if(maybe_pml4.has_error()) {
+		//  The partial clone was torn down, pages it shared are only referenced by the source again.
+		//  Large pages split for the clone stay split.
+		restore_writable<3>(idmap_handle(handle));
 		return core::Result<arch::PagingHandle> { core::Error::NoMem };
 	}
 	auto* pml4 = maybe_pml4.destructively_move_data();
@@ -131,12 +369,11 @@ static arch::PagingTable* ensure_table(arch::PagingTable* table, void* vptr) {
 
 	arch::PagingEntry* table_entry = (table->*IndexerMemberFunction)(vptr);
 	if(!table_entry->get(arch::EntryFlags::Present)) {
-		auto maybe_page = core::mem::allocate_pages(0, {});
+		auto maybe_page = core::mem::allocate_pages(0, core::mem::PageAllocFlags::Zeroed);
 		if(maybe_page.has_error()) {
 			return nullptr;
 		}
 		auto page = maybe_page.destructively_move_data();
-		memset(idmap(page.base), 0x0, 0x1000);
 
 		//  For top-level structures (above PTEs), set the most permissive flags. Also set
 		//  user/supervisor flags on intermediates based on virtual address, not the mapping
@@ -154,17 +391,22 @@ static arch::PagingTable* ensure_table(arch::PagingTable* table, void* vptr) {
 	return idmap_entry_to_table(table_entry);
 }
 
-static constexpr arch::EntryFlags entry_flags_from_request(arch::PageFlags flags) {
+//  Flags of a leaf entry mapping the given address
+//  Shared kernel mappings are the same in all paging structures, and are made global
+//  so that they are kept in the TLB across address space switches.
+static uint64 entry_flags_from_request(arch::PageFlags flags, void* vptr) {
 	using namespace arch;
-	auto entry_flags = EntryFlags::Present;
+	auto entry_flags = static_cast<uint64>(EntryFlags::Present);
 	if(flags & PageFlags::User) {
-		entry_flags = entry_flags | EntryFlags::User;
+		entry_flags |= static_cast<uint64>(EntryFlags::User);
+	} else if(is_shared_pml4e(vptr)) {
+		entry_flags |= static_cast<uint64>(FlagPTE::Global);
 	}
 	if(flags & PageFlags::Write) {
-		entry_flags = entry_flags | EntryFlags::RW;
+		entry_flags |= static_cast<uint64>(EntryFlags::RW);
 	}
 	if(!(flags & PageFlags::Execute)) {
-		entry_flags = entry_flags | EntryFlags::ExecuteDisable;
+		entry_flags |= static_cast<uint64>(EntryFlags::ExecuteDisable);
 	}
 	return entry_flags;
 }
@@ -186,7 +428,7 @@ static core::Error addrmap_4k(arch::PagingHandle handle, void* pptr, void* vptr,
 		return core::Error::NoMem;
 	}
 	auto* pte = pt->get_pte(vptr);
-	pte->reset(entry_flags_from_request(flags));
+	pte->reset(entry_flags_from_request(flags, vptr));
 	pte->setaddr(pptr);
 
 	return core::Error::Ok;
@@ -209,10 +451,30 @@ static core::Error addrmap_2m(arch::PagingHandle handle, void* pptr, void* vptr,
 		return core::Error::NoMem;
 	}
 	auto* pde = pd->get_pde(vptr);
-	pde->reset(entry_flags_from_request(flags));
+	//  A table left behind by earlier mappings can be replaced, as long as it is empty
+	void* old_table = nullptr;
+	if(pde->get(EntryFlags::Present) && !pde->get(FlagPDE::LargePage)) {
+		auto* pt = idmap_entry_to_table(pde);
+		for(size_t i = 0; i < 512; ++i) {
+			if(pt->data[i] & static_cast<uint64>(EntryFlags::Present)) {
+				return core::Error::EntityAlreadyExists;
+			}
+		}
+		old_table = pde->getaddr();
+		pde->data = 0;
+	}
+	pde->reset(entry_flags_from_request(flags, vptr));
 	pde->set(FlagPDE::LargePage, true);
 	pde->setaddr(pptr);
 
+	//  Other nodes may still walk through the cached table, it can only be freed once they dropped it
+	if(old_table) {
+		TlbGather gather { handle };
+		gather.add(vptr, 0x200000);
+		gather.flush();
+		core::mem::free_pages(core::mem::PageAllocation { .base = old_table, .order = 0, .flags = {} });
+	}
+
 	return core::Error::Ok;
 }
 
@@ -232,7 +494,7 @@ static core::Error addrmap_1g(arch::PagingHandle handle, void* pptr, void* vptr,
 		return core::Error::NoMem;
 	}
 	auto* pdpte = pdpt->get_pdpte(vptr);
-	pdpte->reset(entry_flags_from_request(flags));
+	pdpte->reset(entry_flags_from_request(flags, vptr));
 	pdpte->set(FlagPDPTE::HugePage, true);
 	pdpte->setaddr(pptr);
 
@@ -255,7 +517,168 @@ core::Error arch::addrmap(PagingHandle handle, void* pptr, void* vptr, PageFlags
 	return addrmap_4k(handle, pptr, vptr, flags);
 }
 
+//  End of the range covered by the entry containing the address, clamped to the given end
+static uint8* entry_end(uint8* vptr, uintptr_t span, uint8* end) {
+	auto* next = reinterpret_cast<uint8*>((reinterpret_cast<uintptr_t>(vptr) | (span - 1)) + 1);
+	//  The last entry of the address space wraps around
+	return (next > vptr && next < end) ? next : end;
+}
+
+//  Check whether a single large/huge entry can map the next `span` bytes of the range
+static bool can_map_whole(arch::PagingEntry* entry, uint8* vptr, uint8* pptr, uint8* end, uintptr_t span) {
+	const bool aligned = ((reinterpret_cast<uintptr_t>(vptr) | reinterpret_cast<uintptr_t>(pptr)) & (span - 1)) == 0;
+	//  Existing tables may map pages outside of the range, and present large entries
+	//  are never replaced, as their translations may be cached and their pages in use
+	return aligned && !entry->get(arch::EntryFlags::Present) && static_cast<uintptr_t>(end - vptr) >= span;
+}
+
+core::Error arch::addrmap_range(PagingHandle handle, void* pptr, void* vptr, size_t len, PageFlags flags) {
+	if(!handle || !is_page_aligned(pptr) || !is_page_aligned(vptr) || (len & 0xFFF) != 0) {
+		return core::Error::InvalidArgument;
+	}
+	if(!(flags & PageFlags::Execute) && !CPUID::has_NXE()) {
+		return core::Error::Unsupported;
+	}
+	const auto entry_flags = entry_flags_from_request(flags, vptr);
+
+	auto* pml4 = idmap_handle(handle);
+	auto* virt = static_cast<uint8*>(vptr);
+	auto* phys = static_cast<uint8*>(pptr);
+	auto* const end = virt + len;
+	while(virt < end) {
+		auto* pdpt = ensure_table<&PagingTable::get_pml4e>(pml4, virt);
+		if(!pdpt) {
+			return core::Error::NoMem;
+		}
+		auto* const pml4e_end = entry_end(virt, PML4E_SPAN, end);
+		while(virt < pml4e_end) {
+			auto* pdpte = pdpt->get_pdpte(virt);
+			if(CPUID::has_huge_pages() && can_map_whole(pdpte, virt, phys, pml4e_end, PDPTE_SPAN)) {
+				pdpte->data = entry_flags | static_cast<uint64>(FlagPDPTE::HugePage);
+				pdpte->setaddr(phys);
+				virt += PDPTE_SPAN;
+				phys += PDPTE_SPAN;
+				continue;
+			}
+			if(pdpte->get(EntryFlags::Present) && pdpte->get(FlagPDPTE::HugePage)) {
+				return core::Error::EntityAlreadyExists;
+			}
+			auto* pd = ensure_table<&PagingTable::get_pdpte>(pdpt, virt);
+			if(!pd) {
+				return core::Error::NoMem;
+			}
+
+			auto* const pdpte_end = entry_end(virt, PDPTE_SPAN, pml4e_end);
+			while(virt < pdpte_end) {
+				auto* pde = pd->get_pde(virt);
+				if(can_map_whole(pde, virt, phys, pdpte_end, PDE_SPAN)) {
+					pde->data = entry_flags | static_cast<uint64>(FlagPDE::LargePage);
+					pde->setaddr(phys);
+					virt += PDE_SPAN;
+					phys += PDE_SPAN;
+					continue;
+				}
+				if(pde->get(EntryFlags::Present) && pde->get(FlagPDE::LargePage)) {
+					return core::Error::EntityAlreadyExists;
+				}
+				auto* pt = ensure_table<&PagingTable::get_pde>(pd, virt);
+				if(!pt) {
+					return core::Error::NoMem;
+				}
+
+				auto* const pde_end = entry_end(virt, PDE_SPAN, pdpte_end);
+				for(; virt < pde_end; virt += 0x1000, phys += 0x1000) {
+					auto* pte = pt->get_pte(virt);
+					if(pte->get(EntryFlags::Present)) {
+						return core::Error::EntityAlreadyExists;
+					}
+					pte->data = entry_flags;
+					pte->setaddr(phys);
+				}
+			}
+		}
+	}
+	return core::Error::Ok;
+}
+
+core::Error arch::addrunmap_range(PagingHandle handle, void* vptr, size_t len, TlbGather& gather) {
+	if(!handle || !is_page_aligned(vptr) || (len & 0xFFF) != 0) {
+		return core::Error::InvalidArgument;
+	}
+
+	auto* pml4 = idmap_handle(handle);
+	auto* virt = static_cast<uint8*>(vptr);
+	auto* const end = virt + len;
+	while(virt < end) {
+		auto* pml4e = pml4->get_pml4e(virt);
+		auto* const pml4e_end = entry_end(virt, PML4E_SPAN, end);
+		if(!pml4e->get(EntryFlags::Present)) {
+			virt = pml4e_end;
+			continue;
+		}
+		auto* pdpt = idmap_entry_to_table(pml4e);
+		while(virt < pml4e_end) {
+			auto* pdpte = pdpt->get_pdpte(virt);
+			auto* const pdpte_end = entry_end(virt, PDPTE_SPAN, pml4e_end);
+			if(!pdpte->get(EntryFlags::Present)) {
+				virt = pdpte_end;
+				continue;
+			}
+			if(pdpte->get(FlagPDPTE::HugePage)) {
+				if(!is_huge_page_aligned(virt) || static_cast<uintptr_t>(pdpte_end - virt) != PDPTE_SPAN) {
+					return core::Error::InvalidArgument;
+				}
+				pdpte->data = 0;
+				gather.add(virt, PDPTE_SPAN);
+				virt = pdpte_end;
+				continue;
+			}
+			auto* pd = idmap_entry_to_table(pdpte);
+			while(virt < pdpte_end) {
+				auto* pde = pd->get_pde(virt);
+				auto* const pde_end = entry_end(virt, PDE_SPAN, pdpte_end);
+				if(!pde->get(EntryFlags::Present)) {
+					virt = pde_end;
+					continue;
+				}
+				if(pde->get(FlagPDE::LargePage)) {
+					if(!is_large_page_aligned(virt) || static_cast<uintptr_t>(pde_end - virt) != PDE_SPAN) {
+						return core::Error::InvalidArgument;
+					}
+					pde->data = 0;
+					gather.add(virt, PDE_SPAN);
+					virt = pde_end;
+					continue;
+				}
+				auto* pt = idmap_entry_to_table(pde);
+				for(; virt < pde_end; virt += 0x1000) {
+					auto* pte = pt->get_pte(virt);
+					if(pte->get(EntryFlags::Present)) {
+						pte->data = 0;
+						gather.add(virt, 0x1000);
+					}
+				}
+				if(is_table_empty(pt)) {
+					release_table(pde, gather);
+				}
+			}
+			if(is_table_empty(pd)) {
+				release_table(pdpte, gather);
+			}
+		}
+		if(!is_shared_pml4e(pml4e_end - 1) && is_table_empty(pdpt)) {
+			release_table(pml4e, gather);
+		}
+	}
+	return core::Error::Ok;
+}
+
 core::Error arch::addrunmap(arch::PagingHandle handle, void* vptr) {
+	TlbGather gather { handle };
+	return addrunmap(handle, vptr, gather);
+}
+
+core::Error arch::addrunmap(arch::PagingHandle handle, void* vptr, TlbGather& gather) {
 	if(!handle || !is_page_aligned(vptr)) {
 		return core::Error::InvalidArgument;
 	}
@@ -277,31 +700,316 @@ core::Error arch::addrunmap(arch::PagingHandle handle, void* vptr) {
 		}
 		pdpte->set(EntryFlags::Present, false);
 		pdpte->setaddr(nullptr);
-		return core::Error::Ok;
+		gather.add(vptr, 0x40000000);
+	} else {
+		auto* pd = idmap_entry_to_table(pdpte);
+		auto* pde = pd->get_pde(vptr);
+		if(!pde->get(EntryFlags::Present)) {
+			return core::Error::EntityMissing;
+		}
+		if(pde->get(FlagPDE::LargePage)) {
+			if(!is_large_page_aligned(vptr)) {
+				return core::Error::InvalidArgument;
+			}
+			pde->set(EntryFlags::Present, false);
+			pde->setaddr(nullptr);
+			gather.add(vptr, 0x200000);
+		} else {
+			auto* pt = idmap_entry_to_table(pde);
+			auto* pte = pt->get_pte(vptr);
+			if(!pte->get(EntryFlags::Present)) {
+				return core::Error::EntityMissing;
+			}
+			pte->set(EntryFlags::Present, false);
+			pte->setaddr(nullptr);
+			gather.add(vptr, 0x1000);
+
+			if(!is_table_empty(pt)) {
+				return core::Error::Ok;
+			}
+			release_table(pde, gather);
+		}
+		if(!is_table_empty(pd)) {
+			return core::Error::Ok;
+		}
+		release_table(pdpte, gather);
+	}
+
+	//  The shared kernel tables are referenced by all paging structures and must stay
+	if(!is_shared_pml4e(vptr) && is_table_empty(pdpt)) {
+		release_table(pml4e, gather);
+	}
+	return core::Error::Ok;
+}
+
+core::Result<void*> arch::addrtranslate(arch::PagingHandle handle, void* vptr) {
+	if(!handle) {
+		return core::Result<void*> { core::Error::InvalidArgument };
+	}
+	const auto address = reinterpret_cast<uintptr_t>(vptr);
+
+	auto* pml4 = idmap_handle(handle);
+	auto* pml4e = pml4->get_pml4e(vptr);
+	if(!pml4e->get(EntryFlags::Present)) {
+		return core::Result<void*> { core::Error::EntityMissing };
+	}
+
+	auto* pdpt = idmap_entry_to_table(pml4e);
+	auto* pdpte = pdpt->get_pdpte(vptr);
+	if(!pdpte->get(EntryFlags::Present)) {
+		return core::Result<void*> { core::Error::EntityMissing };
+	}
+	if(pdpte->get(FlagPDPTE::HugePage)) {
+		return core::Result<void*> { static_cast<uint8*>(pdpte->getaddr()) + (address & 0x3FFFFFFF) };
 	}
 
 	auto* pd = idmap_entry_to_table(pdpte);
 	auto* pde = pd->get_pde(vptr);
 	if(!pde->get(EntryFlags::Present)) {
-		return core::Error::EntityMissing;
+		return core::Result<void*> { core::Error::EntityMissing };
 	}
 	if(pde->get(FlagPDE::LargePage)) {
-		if(!is_large_page_aligned(vptr)) {
-			return core::Error::InvalidArgument;
+		return core::Result<void*> { static_cast<uint8*>(pde->getaddr()) + (address & 0x1FFFFF) };
+	}
+
+	auto* pt = idmap_entry_to_table(pde);
+	auto* pte = pt->get_pte(vptr);
+	if(!pte->get(EntryFlags::Present)) {
+		return core::Result<void*> { core::Error::EntityMissing };
+	}
+	return core::Result<void*> { static_cast<uint8*>(pte->getaddr()) + (address & 0xFFF) };
+}
+
+core::Result<arch::UnshareResult> arch::addrunshare(arch::PagingHandle handle, void* vptr) {
+	if(!handle || !is_page_aligned(vptr)) {
+		return core::Result<UnshareResult> { core::Error::InvalidArgument };
+	}
+
+	auto* pml4 = idmap_handle(handle);
+	auto* pml4e = pml4->get_pml4e(vptr);
+	if(!pml4e->get(EntryFlags::Present)) {
+		return core::Result<UnshareResult> { core::Error::EntityMissing };
+	}
+
+	auto* pdpt = idmap_entry_to_table(pml4e);
+	auto* pdpte = pdpt->get_pdpte(vptr);
+	if(!pdpte->get(EntryFlags::Present)) {
+		return core::Result<UnshareResult> { core::Error::EntityMissing };
+	}
+	//  Large and huge pages are never shared copy-on-write, but a write fault may
+	//  race with a collapse that made the range writable again (see addrcollapse_commit)
+	if(pdpte->get(FlagPDPTE::HugePage)) {
+		if(!pdpte->get(EntryFlags::RW)) {
+			return core::Result<UnshareResult> { core::Error::InvalidArgument };
+		}
+		auto* page = static_cast<uint8*>(pdpte->getaddr()) + (reinterpret_cast<uintptr_t>(vptr) & 0x3FFFFFFF);
+		return core::Result<UnshareResult> { UnshareResult { .old_page = page, .new_page = page } };
+	}
+
+	auto* pd = idmap_entry_to_table(pdpte);
+	auto* pde = pd->get_pde(vptr);
+	if(!pde->get(EntryFlags::Present)) {
+		return core::Result<UnshareResult> { core::Error::EntityMissing };
+	}
+	if(pde->get(FlagPDE::LargePage)) {
+		if(!pde->get(EntryFlags::RW)) {
+			return core::Result<UnshareResult> { core::Error::InvalidArgument };
 		}
-		pde->set(EntryFlags::Present, false);
-		pde->setaddr(nullptr);
-		return core::Error::Ok;
+		auto* page = static_cast<uint8*>(pde->getaddr()) + (reinterpret_cast<uintptr_t>(vptr) & 0x1FFFFF);
+		return core::Result<UnshareResult> { UnshareResult { .old_page = page, .new_page = page } };
 	}
 
 	auto* pt = idmap_entry_to_table(pde);
 	auto* pte = pt->get_pte(vptr);
 	if(!pte->get(EntryFlags::Present)) {
+		return core::Result<UnshareResult> { core::Error::EntityMissing };
+	}
+	auto* page = pte->getaddr();
+	//  Already unshared, the fault came from a stale read-only translation
+	if(pte->get(EntryFlags::RW)) {
+		return core::Result<UnshareResult> { UnshareResult { .old_page = page, .new_page = page } };
+	}
+	//  Written to while being collapsed into a large page, which cancels the collapse
+	if(pte->get(FlagPTE::Collapsing)) {
+		pte->set(FlagPTE::Collapsing, false);
+		pte->set(EntryFlags::RW, true);
+		asm volatile("invlpg [%0]\n" : : "r"(vptr) : "memory");
+		return core::Result<UnshareResult> { UnshareResult { .old_page = page, .new_page = page } };
+	}
+	if(!pte->get(FlagPTE::CopyOnWrite)) {
+		return core::Result<UnshareResult> { core::Error::InvalidArgument };
+	}
+
+	//  Nobody else maps the page anymore, take it over. Upgrading permissions
+	//  needs no shootdown, stale translations only cause a spurious fault.
+	if(core::mem::page_refcount(page) == 1) {
+		pte->set(FlagPTE::CopyOnWrite, false);
+		pte->set(EntryFlags::RW, true);
+		asm volatile("invlpg [%0]\n" : : "r"(vptr) : "memory");
+		return core::Result<UnshareResult> { UnshareResult { .old_page = page, .new_page = page } };
+	}
+
+	auto maybe_copy = core::mem::allocate_pages(0, {});
+	if(maybe_copy.has_error()) {
+		return core::Result<UnshareResult> { core::Error::NoMem };
+	}
+	auto* copy = maybe_copy.destructively_move_data().base;
+	memcpy(idmap(copy), idmap(page), 0x1000);
+
+	pte->setaddr(copy);
+	pte->set(FlagPTE::CopyOnWrite, false);
+	pte->set(EntryFlags::RW, true);
+	//  Other nodes running the same address space must stop reading the shared page
+	TlbGather gather { handle };
+	gather.add(vptr, 0x1000);
+	gather.flush();
+
+	//  The other users may have dropped their references in the meantime
+	if(core::mem::page_unref(page)) {
+		core::mem::free_pages(core::mem::PageAllocation { .base = page, .order = 0, .flags = {} });
+	}
+	return core::Result<UnshareResult> { UnshareResult { .old_page = page, .new_page = copy } };
+}
+
+//  Only private pages with identical permissions can be merged into a large page
+static constexpr uint64 COLLAPSE_PERMISSION_MASK = static_cast<uint64>(
+        arch::EntryFlags::Present | arch::EntryFlags::RW | arch::EntryFlags::User | arch::EntryFlags::ExecuteDisable);
+
+//  Find the page table mapping the large page-aligned range, nullptr if the range is not mapped with one
+static arch::PagingTable* collapse_table(arch::PagingHandle handle, void* vptr, arch::PagingEntry** pde_out) {
+	using namespace arch;
+	auto* pml4e = idmap_handle(handle)->get_pml4e(vptr);
+	if(!pml4e->get(EntryFlags::Present)) {
+		return nullptr;
+	}
+	auto* pdpte = idmap_entry_to_table(pml4e)->get_pdpte(vptr);
+	if(!pdpte->get(EntryFlags::Present) || pdpte->get(FlagPDPTE::HugePage)) {
+		return nullptr;
+	}
+	auto* pde = idmap_entry_to_table(pdpte)->get_pde(vptr);
+	if(!pde->get(EntryFlags::Present) || pde->get(FlagPDE::LargePage)) {
+		return nullptr;
+	}
+	*pde_out = pde;
+	return idmap_entry_to_table(pde);
+}
+
+//  Drop the references taken by addrcollapse_prepare, freeing pages that were unmapped in the meantime
+static void collapse_release(void* const* pages, size_t count) {
+	for(size_t i = 0; i < count; ++i) {
+		if(core::mem::page_unref(pages[i])) {
+			core::mem::free_pages(core::mem::PageAllocation { .base = pages[i], .order = 0, .flags = {} });
+		}
+	}
+}
+
+core::Error arch::addrcollapse_prepare(arch::PagingHandle handle, void* vptr, void** pages) {
+	if(!handle || !is_large_page_aligned(vptr)) {
+		return core::Error::InvalidArgument;
+	}
+	PagingEntry* pde;
+	auto* pt = collapse_table(handle, vptr, &pde);
+	if(!pt) {
+		return core::Error::EntityMissing;
+	}
+
+	const auto permissions = pt->data[0] & COLLAPSE_PERMISSION_MASK;
+	for(size_t i = 0; i < 512; ++i) {
+		auto* pte = reinterpret_cast<PagingEntry*>(pt->data + i);
+		if(!pte->get(EntryFlags::Present) || (pte->data & COLLAPSE_PERMISSION_MASK) != permissions ||
+		   pte->get(FlagPTE::CopyOnWrite) || pte->get(FlagPTE::Collapsing) ||
+		   core::mem::page_refcount(pte->getaddr()) != 1) {
+			return core::Error::InvalidArgument;
+		}
+	}
+	for(size_t i = 0; i < 512; ++i) {
+		pages[i] = reinterpret_cast<PagingEntry*>(pt->data + i)->getaddr();
+		if(core::mem::page_ref(pages[i]) != core::Error::Ok) {
+			collapse_release(pages, i);
+			return core::Error::InvalidArgument;
+		}
+	}
+
+	//  Write-protect the range, so that no write is lost while the pages are copied
+	if(permissions & static_cast<uint64>(EntryFlags::RW)) {
+		for(size_t i = 0; i < 512; ++i) {
+			auto* pte = reinterpret_cast<PagingEntry*>(pt->data + i);
+			pte->set(EntryFlags::RW, false);
+			pte->set(FlagPTE::Collapsing, true);
+		}
+		TlbGather gather { handle };
+		gather.add(vptr, 0x200000);
+		gather.flush();
+	}
+	return core::Error::Ok;
+}
+
+core::Error arch::addrcollapse_commit(arch::PagingHandle handle, void* vptr, void* pptr, void* const* pages) {
+	if(!handle || !is_large_page_aligned(vptr) || !is_large_page_aligned(pptr)) {
+		collapse_release(pages, 512);
+		return core::Error::InvalidArgument;
+	}
+	PagingEntry* pde;
+	auto* pt = collapse_table(handle, vptr, &pde);
+	if(!pt) {
+		collapse_release(pages, 512);
 		return core::Error::EntityMissing;
 	}
 
-	pte->set(EntryFlags::Present, false);
-	pte->setaddr(nullptr);
+	//  Any write, unmap, remap or copy-on-write share of the range since it was prepared shows up here
+	const bool writable = reinterpret_cast<PagingEntry*>(pt->data)->get(FlagPTE::Collapsing);
+	const auto permissions = pt->data[0] & COLLAPSE_PERMISSION_MASK;
+	bool unchanged = true;
+	for(size_t i = 0; i < 512 && unchanged; ++i) {
+		auto* pte = reinterpret_cast<PagingEntry*>(pt->data + i);
+		unchanged = pte->get(EntryFlags::Present) && pte->getaddr() == pages[i] &&
+		            (pte->data & COLLAPSE_PERMISSION_MASK) == permissions &&
+		            pte->get(FlagPTE::Collapsing) == writable && !pte->get(FlagPTE::CopyOnWrite) &&
+		            core::mem::page_refcount(pages[i]) == 2;
+	}
+	if(!unchanged) {
+		//  Upgrading permissions needs no shootdown, stale translations only cause a spurious fault
+		for(size_t i = 0; i < 512; ++i) {
+			auto* pte = reinterpret_cast<PagingEntry*>(pt->data + i);
+			if(pte->get(FlagPTE::Collapsing)) {
+				pte->set(FlagPTE::Collapsing, false);
+				pte->set(EntryFlags::RW, true);
+			}
+		}
+		collapse_release(pages, 512);
+		return core::Error::InvalidArgument;
+	}
+
+	auto* table_page = pde->getaddr();
+	pde->data = permissions | (writable ? static_cast<uint64>(EntryFlags::RW) : 0) |
+	            static_cast<uint64>(FlagPDE::LargePage);
+	pde->setaddr(pptr);
+	TlbGather gather { handle };
+	gather.add(vptr, 0x200000);
+	gather.flush();
 
+	core::mem::free_pages(core::mem::PageAllocation { .base = table_page, .order = 0, .flags = {} });
+	collapse_release(pages, 512);
 	return core::Error::Ok;
 }
+
+void arch::zero_page_nontemporal(void* vptr) {
+	auto* line = static_cast<uint8*>(vptr);
+	const uint64 zero = 0;
+	//  One cache line per iteration, so that write-combining buffers are filled completely
+	for(size_t i = 0; i < 0x1000; i += 64) {
+		asm volatile("movnti [%0], %1\n"
+		             "movnti [%0 + 8], %1\n"
+		             "movnti [%0 + 16], %1\n"
+		             "movnti [%0 + 24], %1\n"
+		             "movnti [%0 + 32], %1\n"
+		             "movnti [%0 + 40], %1\n"
+		             "movnti [%0 + 48], %1\n"
+		             "movnti [%0 + 56], %1\n"
+		             :
+		             : "r"(line + i), "r"(zero)
+		             : "memory");
+	}
+	//  Non-temporal stores are weakly ordered, they must be visible before the page is handed out
+	asm volatile("sfence" ::: "memory");
+}
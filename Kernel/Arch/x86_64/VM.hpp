@@ -79,6 +79,11 @@ namespace arch {
 
 	//  PTE-specific flags
 	enum class FlagPTE : uint64 {
+		//  Software-defined: page is shared copy-on-write, and is writable once unshared
+		CopyOnWrite = 1 << 9u,
+		//  Software-defined: page was write-protected while it is copied into a large page,
+		//  and becomes writable again (cancelling the collapse) when written to
+		Collapsing = 1 << 10u,
 		Global = 1 << 8u,
 		PAT = 1 << 7u,
 		Dirty = 1 << 6u,
@@ -2,7 +2,7 @@
 
 section .text
 
-;  rdi - prev task, rsi - next task
+;  rdi - prev task, rsi - next task, rdx - value to load into cr3, or 0 to keep the current one
 global _switch_to_asm
 _switch_to_asm:
     SAVE_REGS_CALLEE
@@ -13,9 +13,11 @@ _switch_to_asm:
     ;  Restore frame of next task
     mov rsp, [rsi + 0x0]
 
-    ;  Restore cr3 of next task
-    mov rax, [rsi + 0x18]
-    mov cr3, rax
+    ;  Restore cr3 of next task, unless it shares the paging structure with prev
+    test rdx, rdx
+    jz .keep_cr3
+    mov cr3, rdx
+.keep_cr3:
 
     popfq
     RESTORE_REGS_CALLEE
@@ -0,0 +1,49 @@
+;  User memory access primitives
+;  Every instruction that touches user memory has an entry in the exception
+;  fixup table. When it faults on memory that can't be made accessible, the
+;  page fault handler resumes execution at the fixup address instead.
+
+%macro FIXUP 2
+    section .ex_table progbits alloc noexec nowrite align=8
+    dq %1, %2
+    section .text
+%endmacro
+
+section .text
+
+;  rdi - destination, rsi - source, rdx - byte count
+;  Returns the number of bytes that were not copied in rax
+global _x86_copy_user
+_x86_copy_user:
+    mov rcx, rdx
+    ;  On fault, rcx holds the number of bytes left
+.copy:
+    rep movsb
+    xor rax, rax
+    ret
+.fault:
+    mov rax, rcx
+    ret
+FIXUP _x86_copy_user.copy, _x86_copy_user.fault
+
+;  rdi - destination, rsi - source, rdx - maximum byte count
+;  Returns the string length in rax, rdx if unterminated, -1 on fault
+global _x86_strncpy_user
+_x86_strncpy_user:
+    xor rax, rax
+.next:
+    cmp rax, rdx
+    je .done
+.load:
+    mov cl, byte [rsi + rax]
+    mov byte [rdi + rax], cl
+    test cl, cl
+    jz .done
+    inc rax
+    jmp .next
+.done:
+    ret
+.fault:
+    mov rax, -1
+    ret
+FIXUP _x86_strncpy_user.load, _x86_strncpy_user.fault
@@ -70,6 +70,20 @@ vm86_irq:
     mov rax, cr3
     lea rbx, [edi + (vm86_saved_cr3 - vm86_shellcode_start)]
     mov [rbx], rax
+    ;  Save CR4
+    mov rax, cr4
+    lea rbx, [edi + (vm86_saved_cr4 - vm86_shellcode_start)]
+    mov [rbx], rax
+    ;  Paging can't be disabled with PCIDs enabled, switch to PCID 0 and turn them off.
+    ;  PCID 0 is never given out to address spaces, so translations cached under it are harmless.
+    test rax, (1 << 17)
+    jz .pcid_disabled
+    mov rbx, cr3
+    and rbx, ~0xFFF
+    mov cr3, rbx
+    and rax, ~(1 << 17)
+    mov cr4, rax
+.pcid_disabled:
     ;  Save full-width GDTR
     lea rax, [edi + (vm86_saved_gdtr - vm86_shellcode_start)]
     sgdt [rax]
@@ -270,6 +284,8 @@ bits 32
     ;  FIXME: Narrowing CR3 to 32-bit, will cause a total failure if a processes' CR3 is in physical memory >4 GiB
     lea eax, [edi + OFFSETOF(vm86_saved_cr3)]
     mov eax, [eax]
+    ;  Drop the PCID, it is restored once back in long mode
+    and eax, ~0xFFF
     mov cr3, eax
     ;  Re-enable paging
     mov eax, cr0
@@ -313,6 +329,13 @@ vm86_return_long_stage2:
     lea rax, [edi + OFFSETOF(vm86_saved_kgsbase)]
     mov rax, [rax]
     WRITEMSR 0xC0000102
+    ;  Restore CR4, which re-enables PCIDs if they were used, and then the full CR3
+    lea rax, [edi + OFFSETOF(vm86_saved_cr4)]
+    mov rax, [rax]
+    mov cr4, rax
+    lea rax, [edi + OFFSETOF(vm86_saved_cr3)]
+    mov rax, [rax]
+    mov cr3, rax
 
     ;  Copy over the registers back to the kernel regs structure
     pop rax
@@ -367,6 +390,9 @@ align 8
 vm86_saved_cr3:
     dq 0x0
 align 8
+vm86_saved_cr4:
+    dq 0x0
+align 8
 vm86_saved_gdtr:
     dw 0x0
     dq 0x0
@@ -20,7 +20,7 @@ CREATE_LOGGER("core::mp", ::core::log::LogLevel::Debug);
 	//  If this is a new node, set the kernel environment
 	if(!arch::mp::environment_get()) {
 		auto* core_env = core::mp::create_environment();
-		arch::mp::environment_set(core_env);
+		core::mp::install_environment(core_env);
 	}
 	::log.info("Bootstrapping node {}", this_cpu()->node_id);
 
@@ -7,6 +7,7 @@ static constexpr const size_t max_supported_nodes = 32;
 static constinit core::mp::Environment s_environments[max_supported_nodes] {};
 static constinit size_t s_next_env {};
 static constinit gen::Spinlock s_lock {};
+static constinit bool s_environment_available { false };
 
 core::mp::Environment* core::mp::create_environment() {
 	gen::LockGuard lock { s_lock };
@@ -20,3 +21,25 @@ core::mp::Environment* core::mp::create_environment() {
 
 	return env;
 }
+
+void core::mp::install_environment(core::mp::Environment* env) {
+	arch::mp::environment_set(env);
+	s_environment_available = true;
+}
+
+bool core::mp::is_environment_available() {
+	return s_environment_available;
+}
+
+size_t core::mp::environment_count() {
+	gen::LockGuard lock { s_lock };
+	return s_next_env;
+}
+
+core::mp::Environment* core::mp::environment_for_node(uint64 node_id) {
+	gen::LockGuard lock { s_lock };
+	if(node_id >= s_next_env) {
+		return nullptr;
+	}
+	return &s_environments[node_id];
+}
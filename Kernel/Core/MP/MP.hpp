@@ -1,5 +1,7 @@
 #pragma once
 #include <Arch/MP.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <Core/Mem/Heap.hpp>
 #include <SystemTypes.hpp>
 #ifdef ARCH_IS_x86_64
 #	include <Arch/x86_64/MP/ExecutionEnvironment.hpp>
@@ -16,6 +18,10 @@ namespace core::mp {
 		Thread* thread;
 		Scheduler* scheduler;
 		uint64 node_id;
+		//  NUMA node the CPU belongs to, see core::mem::numa_current_node
+		uint32 numa_node;
+		core::mem::PageCache page_cache;
+		core::mem::HeapCache heap_cache;
 
 		constexpr Thread* current_thread() { return thread; }
 
@@ -23,6 +29,26 @@ namespace core::mp {
 	};
 
 	Environment* create_environment();
+
+	/*	Install the environment for the current node.
+	 */
+	void install_environment(Environment*);
+
+	/*	Check whether node environments can be used.
+	 *
+	 * 	This becomes true once the bootstrap node installs its environment.
+	 * 	Every node started afterwards installs its own environment before
+	 * 	executing any kernel code, so this_cpu() is safe to use from then on.
+	 */
+	bool is_environment_available();
+
+	/*	Get the number of environments that were created.
+	 */
+	size_t environment_count();
+
+	/*	Get the environment of the node with the given ID.
+	 */
+	Environment* environment_for_node(uint64 node_id);
 	[[noreturn]] void bootstrap_this_node(Thread* idle_task = nullptr, Thread* init = nullptr);
 }
 
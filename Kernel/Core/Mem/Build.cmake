@@ -1,6 +1,18 @@
+# Track heap allocations per call site, which can be inspected with the kernel debugger
+option(CONFIG_CORE_MEM_HEAP_ACCOUNTING "Enable per-call-site heap accounting" OFF)
+
 add_kernel_sources(
     GFP.cpp
+    ObjectCache.cpp
     Layout.cpp
     VM.cpp
     Heap.cpp
-)
\ No newline at end of file
+    PageFrame.cpp
+    NUMA.cpp
+    Shrinker.cpp
+)
+if(CONFIG_CORE_MEM_HEAP_ACCOUNTING)
+    target_compile_definitions(KernelELF
+        PRIVATE CONFIG_CORE_MEM_HEAP_ACCOUNTING=1
+    )
+endif()
@@ -1,204 +1,749 @@
 #include <Arch/VM.hpp>
 #include <Core/Error/Error.hpp>
+#include <Core/IRQ/InterruptDisabler.hpp>
 #include <Core/Log/Logger.hpp>
 #include <Core/Mem/GFP.hpp>
 #include <Core/Mem/Layout.hpp>
-#include <LibAllocator/Arena.hpp>
-#include <LibAllocator/ChunkAllocator.hpp>
-#include <LibAllocator/SlabAllocator.hpp>
+#include <Core/Mem/NUMA.hpp>
+#include <Core/Mem/PageFrame.hpp>
+#include <Core/Mem/Shrinker.hpp>
+#ifdef ARCH_IS_x86_64
+#	include <Core/MP/MP.hpp>
+#endif
 #include <LibFormat/Formatters/Pointer.hpp>
+#include <LibGeneric/Algorithm.hpp>
 #include <LibGeneric/LockGuard.hpp>
-#include <LibGeneric/Memory.hpp>
-#include <LibGeneric/Optional.hpp>
 #include <LibGeneric/Spinlock.hpp>
+#include <Structs/KOptional.hpp>
+#include <string.h>
 
 CREATE_LOGGER("core::mem::gfp", core::log::LogLevel::Debug);
 
-struct AllocatorBase {
-	//  Pointer to the next allocator
-	AllocatorBase* next;
-	//  Pointer to the start of the allocator region
-	void* start;
-	//  Size of the allocator region
-	//  This is not an indicator of how much memory is availble, but is
-	//  used to determine the allocator that a given block is allocated in.
-	size_t size;
-
-	//  Handle a given allocation request
-	virtual void* allocate(size_t order, core::mem::PageAllocFlags flags) = 0;
-	//  Free an allocation that was previously given out by this allocator
-	virtual core::Error free(core::mem::PageAllocation) = 0;
+/*	A range of physical memory managed by a buddy allocator.
+ *
+ * 	Blocks of order N span 2^N pages and are aligned to their size in the
+ * 	physical address space. Free blocks are kept in per-order lists that are
+ * 	linked through the page frame database, so free memory is never touched
+ * 	by the allocator itself. Every Usable region of the physical memory layout
+ * 	is claimed as a separate zone at boot. Zones are local to a single NUMA
+ * 	node, and are split once the platform reports where the nodes are.
+ */
+struct Zone {
+	uint32 free_lists[CONFIG_CORE_MEM_GFP_MAX_ORDER + 1];
+	size_t free_pages;
+	size_t managed_pages;
+	uint8* start;
+	uint8* end;
+	uint32 node;
+};
+
+//  Protects all GFP data, always held with interrupts disabled so that
+//  PageAllocFlags::Atomic requests can be made from interrupt context
+static constinit gen::Spinlock s_lock {};
+static constinit Zone s_zones[CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS] {};
+static constinit size_t s_zone_count {};
+//  Free pages in all zones, written with the GFP lock held
+static constinit size_t s_free_pages {};
+//  Physical memory was claimed, whether successfully or not
+static constinit bool s_initialized {};
+
+/*	Pre-zeroed single pages of a NUMA node.
+ *
+ * 	Idle CPUs take free pages of their node and clear them ahead of time, so
+ * 	that PageAllocFlags::Zeroed requests don't have to do it on the critical
+ * 	path. Pages in the pool are not counted as free, and are given back to
+ * 	the zones by a shrinker under memory pressure.
+ */
+struct ZeroPool {
+	void* pages[CONFIG_CORE_MEM_GFP_ZERO_POOL_SIZE];
+	size_t count;
+	//  Protects the pool, held with interrupts disabled
+	gen::Spinlock lock;
+	//  Statistics
+	size_t hits;
+	size_t misses;
+	size_t refilled;
 };
 
-struct SlabBasedPageAllocator : public AllocatorBase {
-	SlabBasedPageAllocator(liballoc::Arena arena)
-	    : slab(liballoc::Arena { idmap(arena.base), arena.length }, 0x1000) {
-		AllocatorBase::start = arena.base;
-		AllocatorBase::size = arena.length;
+static size_t zero_pool_reclaimable();
+static size_t zero_pool_shrink(size_t target);
+
+static constinit ZeroPool s_zero_pools[CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+static constinit core::mem::Shrinker s_zero_pool_shrinker {
+	.name = "ZeroPool",
+	.count = &zero_pool_reclaimable,
+	.scan = &zero_pool_shrink,
+};
+static constinit bool s_zero_pool_shrinker_registered {};
+
+static void list_insert(Zone& zone, uint32 index, size_t order) {
+	auto* frame = core::mem::page_frame_at(index);
+	frame->flags = core::mem::PageFrameFlags::Free;
+	frame->order = order;
+	frame->prev = core::mem::PAGE_FRAME_NONE;
+	frame->next = zone.free_lists[order];
+	if(frame->next != core::mem::PAGE_FRAME_NONE) {
+		core::mem::page_frame_at(frame->next)->prev = index;
+	}
+	zone.free_lists[order] = index;
+}
+
+static void list_remove(Zone& zone, uint32 index, size_t order) {
+	auto* frame = core::mem::page_frame_at(index);
+	if(frame->prev != core::mem::PAGE_FRAME_NONE) {
+		core::mem::page_frame_at(frame->prev)->next = frame->next;
+	} else {
+		zone.free_lists[order] = frame->next;
+	}
+	if(frame->next != core::mem::PAGE_FRAME_NONE) {
+		core::mem::page_frame_at(frame->next)->prev = frame->prev;
+	}
+	frame->flags = core::mem::PageFrameFlags::None;
+	frame->next = core::mem::PAGE_FRAME_NONE;
+	frame->prev = core::mem::PAGE_FRAME_NONE;
+}
+
+static void* zone_allocate(Zone& zone, size_t order) {
+	//  Find the smallest free block that can fit the request
+	size_t current_order = order;
+	while(current_order <= CONFIG_CORE_MEM_GFP_MAX_ORDER &&
+	      zone.free_lists[current_order] == core::mem::PAGE_FRAME_NONE) {
+		++current_order;
+	}
+	if(current_order > CONFIG_CORE_MEM_GFP_MAX_ORDER) {
+		return nullptr;
+	}
+
+	const auto index = zone.free_lists[current_order];
+	list_remove(zone, index, current_order);
+
+	//  Split the block, returning the upper halves to the free lists
+	while(current_order > order) {
+		--current_order;
+		list_insert(zone, index + (1u << current_order), current_order);
 	}
 
-	void* allocate(size_t order, core::mem::PageAllocFlags) override {
-		ENSURE(order == 0);
-		auto* ptr = slab.allocate();
-		if(!ptr) {
-			return nullptr;
+	zone.free_pages -= 1ul << order;
+	__atomic_store_n(&s_free_pages, s_free_pages - (1ul << order), __ATOMIC_RELAXED);
+	return core::mem::page_frame_address(index);
+}
+
+static void zone_free(Zone& zone, void* base, size_t order) {
+	auto* block = static_cast<uint8*>(base);
+	const auto zone_index = core::mem::page_frame(block)->zone;
+	zone.free_pages += 1ul << order;
+	__atomic_store_n(&s_free_pages, s_free_pages + (1ul << order), __ATOMIC_RELAXED);
+
+	//  Merge with the buddy for as long as it is free and of the same order
+	while(order < CONFIG_CORE_MEM_GFP_MAX_ORDER) {
+		auto* buddy = reinterpret_cast<uint8*>(reinterpret_cast<uintptr_t>(block) ^ core::mem::order_to_size(order));
+		auto* buddy_frame = core::mem::page_frame(buddy);
+		if(!buddy_frame || !(buddy_frame->flags & core::mem::PageFrameFlags::Free) || buddy_frame->order != order ||
+		   buddy_frame->zone != zone_index) {
+			break;
 		}
-		return idunmap(ptr);
+		list_remove(zone, core::mem::page_frame_index(buddy_frame), order);
+		block = block < buddy ? block : buddy;
+		++order;
 	}
+	list_insert(zone, core::mem::page_frame_index(core::mem::page_frame(block)), order);
+}
 
-	core::Error free(core::mem::PageAllocation alloc) override {
-		ENSURE(alloc.order == 0);
-		slab.free(idmap(alloc.base));
-		return core::Error::Ok;
+//  Get the class of memory in the zone. Zones only ever span multiple classes when
+//  they could not be split, in which case the highest one is used.
+static core::mem::ZoneType zone_type(Zone const& zone) {
+	const auto end = reinterpret_cast<uintptr_t>(zone.end);
+	if(end <= CONFIG_CORE_MEM_GFP_DMA_LIMIT) {
+		return core::mem::ZoneType::DMA;
+	}
+	if(end <= CONFIG_CORE_MEM_GFP_DMA32_LIMIT) {
+		return core::mem::ZoneType::DMA32;
 	}
+	return core::mem::ZoneType::Normal;
+}
 
-	liballoc::SlabAllocator slab;
-};
+//  Get the highest class of memory that can be used for a request
+static core::mem::ZoneType highest_zone_type(core::mem::PageAllocFlags flags) {
+	if(flags & core::mem::PageAllocFlags::DMA) {
+		return core::mem::ZoneType::DMA;
+	}
+	if(flags & core::mem::PageAllocFlags::DMA32) {
+		return core::mem::ZoneType::DMA32;
+	}
+	return core::mem::ZoneType::Normal;
+}
 
-//  Protects all GFP data
-static constinit gen::Spinlock s_lock {};
-//  Root physical memory allocator, initialized at boot time
-static constinit AllocatorBase* s_root {};
+/*	Hand over the page-aligned range to a new zone, carving it into the
+ * 	largest naturally aligned blocks. Must be called with the GFP lock held.
+ */
+static void zone_create_locked(uint8* start, uint8* end, uint32 node) {
+	const auto zone_index = s_zone_count++;
+	auto& zone = s_zones[zone_index];
+	for(auto& list : zone.free_lists) {
+		list = core::mem::PAGE_FRAME_NONE;
+	}
+	zone.start = start;
+	zone.end = end;
+	zone.node = node;
+
+	for(auto* page = start; page < end; page += 0x1000) {
+		auto* frame = core::mem::page_frame(page);
+		frame->flags = core::mem::PageFrameFlags::None;
+		frame->zone = zone_index;
+	}
 
-/*	Find the next allocator of a given size that can potentially satisfy a
- * 	given allocation request for `order`. This does not mean that the
- * 	allocator will actually be able to fulfill the request due to alignment
- * 	and simply not having enough memory, but allows us to quickly filter
- * 	out allocators that will never be able to give us what we want.
+	auto* block = start;
+	while(block < end) {
+		const auto pfn = reinterpret_cast<uintptr_t>(block) >> 12u;
+		size_t order = CONFIG_CORE_MEM_GFP_MAX_ORDER;
+		while(order > 0 && ((pfn & ((1ul << order) - 1)) != 0 || block + core::mem::order_to_size(order) > end)) {
+			--order;
+		}
+		list_insert(zone, core::mem::page_frame_index(core::mem::page_frame(block)), order);
+		zone.free_pages += 1ul << order;
+		zone.managed_pages += 1ul << order;
+		__atomic_store_n(&s_free_pages, s_free_pages + (1ul << order), __ATOMIC_RELAXED);
+		block += core::mem::order_to_size(order);
+	}
+}
+
+static KOptional<size_t> zone_split_locked(size_t zone_index, uint8* at);
+
+/*	Split zones that cross the given address, so that zones never span more
+ * 	than one class of memory. Must be called with the GFP lock held.
  */
-static AllocatorBase* find_next_allocator_satisfying_order(AllocatorBase* start_at, size_t order) {
-	if(!start_at) {
-		return nullptr;
+static void zone_split_all_locked(uint8* at) {
+	//  Zones created by splitting are appended, and lie above `at`
+	const auto count = s_zone_count;
+	for(size_t index = 0; index < count; ++index) {
+		if(s_zones[index].start < at && at < s_zones[index].end && !zone_split_locked(index, at).has_value()) {
+			::log.warning("Out of zones, zone {x} - {x} crosses {x}", Format::ptr(s_zones[index].start),
+			              Format::ptr(s_zones[index].end), Format::ptr(at));
+		}
 	}
+}
 
-	const auto request_size = core::mem::order_to_size(order);
-	auto* current = start_at;
-	while(current) {
-		if(current->size >= request_size) {
-			return current;
+/*	Claim all Usable physical memory, and create the page frame database
+ * 	covering it. Must be called with the GFP lock held.
+ */
+static void initialize_locked() {
+	s_initialized = true;
+
+	//  Find the range of physical memory that the database has to cover
+	struct {
+		uintptr_t lowest = ~0ul;
+		uintptr_t highest = 0ul;
+	} bounds;
+	core::mem::for_each_region([&bounds](core::mem::Region region) {
+		if(region.type != core::mem::RegionType::Usable) {
+			return;
+		}
+		bounds.lowest = gen::min(bounds.lowest, reinterpret_cast<uintptr_t>(region.start) & ~0xFFFul);
+		bounds.highest = gen::max(bounds.highest, (reinterpret_cast<uintptr_t>(region.end()) + 0xFFF) & ~0xFFFul);
+	});
+	if(bounds.lowest >= bounds.highest) {
+		::log.error("No usable physical memory found");
+		return;
+	}
+	if(const auto err = core::mem::page_frames_create(bounds.lowest >> 12u, (bounds.highest - bounds.lowest) >> 12u);
+	   err != core::Error::Ok) {
+		::log.error("Failed to create the page frame database: {}", err);
+		return;
+	}
+
+	//  Collect the regions first, as they can't be claimed while iterating over the layout.
+	//  The database itself took part of the Usable memory, so the regions may have changed.
+	struct {
+		core::mem::Region regions[CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS];
+		size_t count = 0;
+	} usable;
+	core::mem::for_each_region([&usable](core::mem::Region region) {
+		if(region.type == core::mem::RegionType::Usable && usable.count < CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS) {
+			usable.regions[usable.count++] = region;
+		}
+	});
+
+	size_t claimed = 0;
+	for(size_t i = 0; i < usable.count; ++i) {
+		auto const& region = usable.regions[i];
+		auto* start = reinterpret_cast<uint8*>((reinterpret_cast<uintptr_t>(region.start) + 0xFFF) & ~0xFFFul);
+		auto* end = reinterpret_cast<uint8*>(reinterpret_cast<uintptr_t>(region.end()) & ~0xFFFul);
+		if(start >= end) {
+			continue;
 		}
-		current = current->next;
+		if(core::mem::request_range(start, end - start, core::mem::RegionType::Allocator).has_error()) {
+			::log.warning("Failed to claim physical memory {x} - {x}", Format::ptr(start), Format::ptr(end));
+			continue;
+		}
+		zone_create_locked(start, end, region.node);
+		claimed += end - start;
 	}
+	zone_split_all_locked(reinterpret_cast<uint8*>(CONFIG_CORE_MEM_GFP_DMA_LIMIT));
+	zone_split_all_locked(reinterpret_cast<uint8*>(CONFIG_CORE_MEM_GFP_DMA32_LIMIT));
+	::log.info("Claimed {} KiB of physical memory in {} zones", claimed / 1024, s_zone_count);
+}
 
+/*	Put a free block on the lists of the zone on its side of `at`, splitting
+ * 	it into halves if it crosses over. Must be called with the GFP lock held.
+ */
+static void zone_split_insert(Zone& lower, Zone& upper, uint8* block, size_t order, uint8* at) {
+	if(block + core::mem::order_to_size(order) <= at || block >= at) {
+		auto& zone = block >= at ? upper : lower;
+		list_insert(zone, core::mem::page_frame_index(core::mem::page_frame(block)), order);
+		zone.free_pages += 1ul << order;
+		return;
+	}
+	//  `at` is page-aligned, so single pages never cross over
+	zone_split_insert(lower, upper, block, order - 1, at);
+	zone_split_insert(lower, upper, block + core::mem::order_to_size(order - 1), order - 1, at);
+}
+
+/*	Split the zone in two at the given page-aligned address, moving the
+ * 	upper part to a new zone. Returns the index of the new zone, or nullopt
+ * 	if no more zones can be created. Must be called with the GFP lock held.
+ */
+static KOptional<size_t> zone_split_locked(size_t zone_index, uint8* at) {
+	if(s_zone_count >= CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS) {
+		return {};
+	}
+	const auto upper_index = s_zone_count++;
+	auto& lower = s_zones[zone_index];
+	auto& upper = s_zones[upper_index];
+	for(auto& list : upper.free_lists) {
+		list = core::mem::PAGE_FRAME_NONE;
+	}
+	upper.start = at;
+	upper.end = lower.end;
+	upper.node = lower.node;
+	upper.free_pages = 0;
+	upper.managed_pages = (upper.end - upper.start) / 0x1000;
+	lower.end = at;
+	lower.managed_pages -= upper.managed_pages;
+
+	//  Pages must be moved first, so that buddies are never merged across the split
+	for(auto* page = upper.start; page < upper.end; page += 0x1000) {
+		core::mem::page_frame(page)->zone = upper_index;
+	}
+
+	//  Halves of split blocks only go to lower orders, which are walked later on
+	for(size_t order = CONFIG_CORE_MEM_GFP_MAX_ORDER + 1; order-- > 0;) {
+		auto index = lower.free_lists[order];
+		while(index != core::mem::PAGE_FRAME_NONE) {
+			const auto next = core::mem::page_frame_at(index)->next;
+			auto* block = static_cast<uint8*>(core::mem::page_frame_address(index));
+			if(block + core::mem::order_to_size(order) > at) {
+				list_remove(lower, index, order);
+				lower.free_pages -= 1ul << order;
+				zone_split_insert(lower, upper, block, order, at);
+			}
+			index = next;
+		}
+	}
+	return upper_index;
+}
+
+/*	Allocate a block of the given order from the zones of a single node, with
+ * 	memory of at most the given class. Higher classes are tried first, so that
+ * 	memory addressable by legacy devices is kept for as long as possible.
+ * 	Must be called with the GFP lock held. Returns nullptr on failure.
+ */
+static void* allocate_block_on_node_locked(size_t order, core::mem::ZoneType highest, uint32 node) {
+	if(!s_initialized) {
+		initialize_locked();
+	}
+	for(size_t type = static_cast<size_t>(highest) + 1; type-- > 0;) {
+		for(size_t zone = 0; zone < s_zone_count; ++zone) {
+			if(s_zones[zone].node != node || static_cast<size_t>(zone_type(s_zones[zone])) != type) {
+				continue;
+			}
+			if(auto* ptr = zone_allocate(s_zones[zone], order)) {
+				return ptr;
+			}
+		}
+	}
 	return nullptr;
 }
 
-/*	Find the allocator that was used for allocating the given request.
+/*	Allocate a block of the given order from the zones, trying the zones
+ * 	of the closest nodes first. Must be called with the GFP lock held.
+ * 	Returns nullptr on failure.
  */
-static AllocatorBase* find_allocator_for_allocation(core::mem::PageAllocation allocation) {
-	auto* current = s_root;
-	while(current) {
-		if(allocation.base >= current->start && allocation.size() <= current->size) {
-			return current;
+static void* allocate_block_locked(size_t order, core::mem::PageAllocFlags flags, uint32 node) {
+	if(!s_initialized) {
+		initialize_locked();
+	}
+	//  The last free pages are kept for requests that can't wait for reclaim
+	const bool reserve = flags & (core::mem::PageAllocFlags::Atomic | core::mem::PageAllocFlags::HighPriority);
+	if(!reserve && s_free_pages < CONFIG_CORE_MEM_GFP_WATERMARK_MIN + (1ul << order)) {
+		return nullptr;
+	}
+
+	const auto highest = highest_zone_type(flags);
+	const auto* fallback = core::mem::numa_fallback_order(node);
+	for(size_t i = 0; i < core::mem::numa_node_count(); ++i) {
+		if(auto* ptr = allocate_block_on_node_locked(order, highest, fallback[i])) {
+			return ptr;
 		}
-		current = current->next;
 	}
 	return nullptr;
 }
 
-/*	Allocate an object of a given type `T` using the allocalloc heap.
- * 	The object is constructed in place using the given constructor
- * 	arguments and a pointer to it is returned.
- */
-template<typename T, typename... Args>
-static T* allocalloc(Args... args) {
-	//  Allocator for allocating the allocators (yo dawg)
-	static gen::Optional<liballoc::ChunkAllocator> s_allocalloc {};
-
-	//  The allocator isn't initialized yet.
-	//  This will happen exclusively at boot time, at which
-	//  point the initial allocalloc region is requested.
-	//	Avoiding dependency on the main kernel heap makes GFP semi-freestanding,
-	//	allowing GFP usage almost immediately after the kernel is reached.
-	if(!s_allocalloc.has_value()) {
-		void* pstart;
-		const auto maybe_handle = core::mem::request(CONFIG_CORE_MEM_GFP_DEFAULT_ALLOCALLOC_SIZE, 0x1000,
-		                                             core::mem::RegionType::Allocator, pstart);
-		if(maybe_handle.has_error()) {
-			return nullptr;
-		}
-		//  LEAK: Leaking the region handle, as we probably won't ever need to free this
-		void* vstart = idmap(pstart);
-		s_allocalloc = liballoc::ChunkAllocator {
-			liballoc::Arena { vstart, CONFIG_CORE_MEM_GFP_DEFAULT_ALLOCALLOC_SIZE },
-		};
+//  Give every page of the block a single reference held by the new owner
+static void mark_allocated(void* base, size_t order) {
+	auto* frame = core::mem::page_frame(base);
+	frame->order = order;
+	for(size_t i = 0; i < (1ul << order); ++i) {
+		frame[i].refcount = 1;
+	}
+}
+
+//  Drop all references to the pages of a block that is being freed
+static void mark_freed(void* base, size_t order) {
+	auto* frame = core::mem::page_frame(base);
+	if(!frame) {
+		return;
+	}
+	for(size_t i = 0; i < (1ul << order); ++i) {
+		frame[i].refcount = 0;
 	}
-	return gen::construct_at<T>((T*)s_allocalloc.unwrap().allocate(sizeof(T)), gen::forward<Args>(args)...);
 }
 
-/*	Create a new allocator, using an incoming allocation request as a hint,
- * 	and store it in the allocator list.
+/*	Free single pages held by a per-CPU page cache or a pre-zeroed pool are
+ * 	marked, so that freeing them again is caught instead of handing the page
+ * 	out to two owners later on.
  */
-static AllocatorBase* create_allocator_for_request(size_t order, core::mem::PageAllocFlags flags) {
-	constexpr const size_t default_request_size = 32 * 1024 * 1024;
+static void mark_cached(void* page) {
+	core::mem::page_frame(page)->flags = core::mem::PageFrameFlags::Cached;
+}
 
-	//	FIXME: Currenly, ignore the request entirely and just create
-	//  a new allocator of constant size.
-	(void)order;
-	(void)flags;
+static void clear_cached(void* page) {
+	core::mem::page_frame(page)->flags = core::mem::PageFrameFlags::None;
+}
 
-	void* pstart;
-	const auto maybe_handle =
-	        core::mem::request(default_request_size, 0x1000, core::mem::RegionType::Allocator, pstart);
-	if(maybe_handle.has_error()) {
-		return nullptr;
+//  Check whether a page that is being freed may be put in a cache. Pages that
+//  GFP does not own, or that are already free, are left for free_block_locked
+//  to report.
+static bool is_cacheable(void* page) {
+	auto* frame = core::mem::page_frame(page);
+	const bool aligned = (reinterpret_cast<uintptr_t>(page) & 0xFFFul) == 0;
+	return frame && aligned &&
+	       !(frame->flags & (core::mem::PageFrameFlags::Reserved | core::mem::PageFrameFlags::Free |
+	                         core::mem::PageFrameFlags::Cached));
+}
+
+/*	Check whether any page of the block is already free. Only the first page of a
+ * 	free block is marked, so blocks merged into a larger free block (for example,
+ * 	as its upper buddy) are found by looking at the naturally aligned blocks of
+ * 	every higher order that cover the block. Must be called with the GFP lock held.
+ */
+static bool is_free_locked(void* base, size_t order) {
+	const auto zone = core::mem::page_frame(base)->zone;
+	for(size_t covering_order = order; covering_order <= CONFIG_CORE_MEM_GFP_MAX_ORDER; ++covering_order) {
+		const auto covering = reinterpret_cast<uintptr_t>(base) & ~(core::mem::order_to_size(covering_order) - 1);
+		auto* frame = core::mem::page_frame(reinterpret_cast<void*>(covering));
+		if(!frame || frame->zone != zone) {
+			break;
+		}
+		if((frame->flags & core::mem::PageFrameFlags::Free) && frame->order >= covering_order) {
+			return true;
+		}
+	}
+	//  Smaller free blocks within the block
+	auto* first = core::mem::page_frame(base);
+	for(size_t i = 1; i < (1ul << order); ++i) {
+		if(first[i].flags & core::mem::PageFrameFlags::Free) {
+			return true;
+		}
 	}
+	return false;
+}
 
-	auto* allocator = allocalloc<SlabBasedPageAllocator>(liballoc::Arena { pstart, default_request_size });
-	if(!allocator) {
-		(void)core::mem::free(maybe_handle.data());
+/*	Return a block to the zone it was allocated from.
+ * 	Must be called with the GFP lock held.
+ */
+static void free_block_locked(core::mem::PageAllocation alloc) {
+	auto* frame = core::mem::page_frame(alloc.base);
+	const bool aligned = (reinterpret_cast<uintptr_t>(alloc.base) & (alloc.size() - 1)) == 0;
+	if(!frame || !aligned || alloc.order > CONFIG_CORE_MEM_GFP_MAX_ORDER ||
+	   (frame->flags & core::mem::PageFrameFlags::Reserved)) {
+		::log.warning("BUG: Invalid free of base={x} order={}", Format::ptr(alloc.base), alloc.order);
+		return;
+	}
+	if((frame->flags & core::mem::PageFrameFlags::Cached) || is_free_locked(alloc.base, alloc.order)) {
+		::log.warning("BUG: Double free of base={x} order={}", Format::ptr(alloc.base), alloc.order);
+		return;
+	}
+	mark_freed(alloc.base, alloc.order);
+	//  Blocks allocated before a zone was split may cross into the other zone
+	if(alloc.order > 0 && core::mem::page_frame(alloc.last())->zone != frame->zone) {
+		const auto half = core::mem::order_to_size(alloc.order - 1);
+		const auto order = alloc.order - 1;
+		auto* upper = static_cast<uint8*>(alloc.base) + half;
+		free_block_locked(core::mem::PageAllocation { .base = alloc.base, .order = order, .flags = alloc.flags });
+		free_block_locked(core::mem::PageAllocation { .base = upper, .order = order, .flags = alloc.flags });
+		return;
+	}
+	zone_free(s_zones[frame->zone], alloc.base, alloc.order);
+}
+
+/*	Get the page cache of the current node. Returns nullptr when per-CPU
+ * 	caches can't be used yet, which is the case during early boot before
+ * 	the node environment is installed.
+ */
+static core::mem::PageCache* this_cpu_page_cache() {
+#ifdef ARCH_IS_x86_64
+	if(!core::mp::is_environment_available()) {
 		return nullptr;
 	}
-	//  Link the allocator
-	//  For simplicity, put the new allocator as root.
-	allocator->next = s_root;
-	s_root = allocator;
+	return &this_cpu()->page_cache;
+#else
+	return nullptr;
+#endif
+}
+
+/*	Refill the page cache with a batch of pages from the global allocators.
+ * 	Freshly refilled pages are cold, and are put at the bottom of the cache.
+ * 	The reserve below the min watermark is never moved into the cache, where
+ * 	ordinary requests would use it up. Requests that may use the reserve take
+ * 	a single page from the zones instead. Must be called with interrupts disabled.
+ */
+static void page_cache_refill(core::mem::PageCache& cache, uint32 node) {
+	constexpr const size_t capacity = CONFIG_CORE_MEM_GFP_PCP_HIGH;
+	const auto room = capacity - cache.count;
+	const auto wanted = room < CONFIG_CORE_MEM_GFP_PCP_BATCH ? room : CONFIG_CORE_MEM_GFP_PCP_BATCH;
 
-	return allocator;
+	void* batch[CONFIG_CORE_MEM_GFP_PCP_BATCH];
+	size_t got = 0;
+	{
+		gen::LockGuard lg { s_lock };
+		while(got < wanted) {
+			auto* ptr = allocate_block_locked(0, core::mem::PageAllocFlags::None, node);
+			if(!ptr) {
+				break;
+			}
+			mark_cached(ptr);
+			batch[got++] = ptr;
+		}
+	}
+	if(!got) {
+		return;
+	}
+
+	for(size_t i = cache.count; i > 0; --i) {
+		cache.pages[i - 1 + got] = cache.pages[i - 1];
+	}
+	for(size_t i = 0; i < got; ++i) {
+		cache.pages[i] = batch[i];
+	}
+	cache.count += got;
+	++cache.refills;
+}
+
+/*	Drain a batch of the coldest pages from the cache back to the global allocators.
+ * 	Must be called with interrupts disabled.
+ */
+static void page_cache_drain(core::mem::PageCache& cache) {
+	const auto count = cache.count < CONFIG_CORE_MEM_GFP_PCP_BATCH ? cache.count : CONFIG_CORE_MEM_GFP_PCP_BATCH;
+	{
+		gen::LockGuard lg { s_lock };
+		for(size_t i = 0; i < count; ++i) {
+			clear_cached(cache.pages[i]);
+			free_block_locked(core::mem::PageAllocation { .base = cache.pages[i], .order = 0, .flags = {} });
+		}
+	}
+	for(size_t i = count; i < cache.count; ++i) {
+		cache.pages[i - count] = cache.pages[i];
+	}
+	cache.count -= count;
+	++cache.drains;
+}
+
+/*	Drain the whole cache if another node ran out of memory and asked for it.
+ * 	Must be called with interrupts disabled.
+ */
+static void page_cache_drain_if_requested(core::mem::PageCache& cache) {
+	if(!__atomic_load_n(&cache.drain_requested, __ATOMIC_ACQUIRE)) {
+		return;
+	}
+	while(cache.count > 0) {
+		page_cache_drain(cache);
+	}
+	__atomic_store_n(&cache.drain_requested, false, __ATOMIC_RELEASE);
+}
+
+/*	Ask the other nodes to drain their page caches, and wait until they did, for
+ * 	at most CONFIG_CORE_MEM_GFP_PCP_DRAIN_WAIT iterations. Nodes drain their cache
+ * 	the next time they use it, or when they are idle. Returns an estimate of the
+ * 	number of pages released, zero if no node responded in time.
+ */
+static size_t page_cache_drain_remote() {
+#ifdef ARCH_IS_x86_64
+	if(!core::mp::is_environment_available()) {
+		return 0;
+	}
+	size_t requested = 0;
+	for(size_t node = 0; node < core::mp::environment_count(); ++node) {
+		auto* env = core::mp::environment_for_node(node);
+		if(!env || env == this_cpu()) {
+			continue;
+		}
+		auto& cache = env->page_cache;
+		if(__atomic_load_n(&cache.count, __ATOMIC_RELAXED) > 0) {
+			requested += __atomic_load_n(&cache.count, __ATOMIC_RELAXED);
+			__atomic_store_n(&cache.drain_requested, true, __ATOMIC_RELEASE);
+		}
+	}
+	if(!requested) {
+		return 0;
+	}
+
+	for(size_t spin = 0; spin < CONFIG_CORE_MEM_GFP_PCP_DRAIN_WAIT; ++spin) {
+		bool pending = false;
+		for(size_t node = 0; node < core::mp::environment_count() && !pending; ++node) {
+			auto* env = core::mp::environment_for_node(node);
+			pending = env && __atomic_load_n(&env->page_cache.drain_requested, __ATOMIC_ACQUIRE);
+		}
+		if(!pending) {
+			return requested;
+		}
+		//  Another node may be waiting for us in the same way
+		{
+			core::irq::InterruptDisabler id {};
+			page_cache_drain_if_requested(this_cpu()->page_cache);
+		}
+		asm volatile("pause");
+	}
+	return 0;
+#else
+	return 0;
+#endif
+}
+
+//  Get the node of the zone a page belongs to
+static uint32 page_node(void* page) {
+	auto* frame = core::mem::page_frame(page);
+	if(!frame || (frame->flags & core::mem::PageFrameFlags::Reserved)) {
+		return 0;
+	}
+	return __atomic_load_n(&s_zones[frame->zone].node, __ATOMIC_RELAXED);
 }
 
 [[nodiscard]] core::Result<core::mem::PageAllocation> core::mem::allocate_pages(size_t order,
                                                                                 core::mem::PageAllocFlags flags) {
+	return allocate_pages_node(order, flags, NUMA_NODE_LOCAL);
+}
+
+//  Check whether the request restricts the memory to lower zones
+static bool is_zone_restricted(core::mem::PageAllocFlags flags) {
+	return flags & (core::mem::PageAllocFlags::DMA | core::mem::PageAllocFlags::DMA32);
+}
+
+/*	Take a block from the per-CPU cache or the zones. Single pages for the local
+ * 	node are served from the per-CPU cache when possible, from the hot end.
+ * 	Cached pages may come from any zone, and are not used for zone-restricted
+ * 	requests. Returns nullptr on failure.
+ */
+static void* try_allocate(size_t order, core::mem::PageAllocFlags flags, uint32 node) {
+	if(order == 0 && !is_zone_restricted(flags)) {
+		core::irq::InterruptDisabler id {};
+		const auto local = core::mem::numa_current_node();
+		auto* cache = this_cpu_page_cache();
+		if(cache && core::mem::numa_resolve_node(node) == local) {
+			page_cache_drain_if_requested(*cache);
+			if(cache->count <= CONFIG_CORE_MEM_GFP_PCP_LOW) {
+				page_cache_refill(*cache, local);
+			}
+			if(cache->count > 0) {
+				cache->count -= 1;
+				clear_cached(cache->pages[cache->count]);
+				mark_allocated(cache->pages[cache->count], 0);
+				return cache->pages[cache->count];
+			}
+		}
+	}
+
+	core::irq::InterruptDisabler id {};
 	gen::LockGuard lg { s_lock };
+	auto* ptr = allocate_block_locked(order, flags, node);
+	if(ptr) {
+		mark_allocated(ptr, order);
+	}
+	return ptr;
+}
 
-	auto* alloc = s_root;
-	while(alloc) {
-		alloc = find_next_allocator_satisfying_order(alloc, order);
-		if(!alloc) {
-			break;
+/*	Give memory held by caches back to the zones, so that a failed allocation of
+ * 	the given order can be retried. Returns the number of pages released.
+ */
+static size_t reclaim(size_t order) {
+	size_t released = 0;
+	//  Cached pages can't be coalesced into larger blocks, drain the caches of all nodes
+	{
+		core::irq::InterruptDisabler id {};
+		if(auto* cache = this_cpu_page_cache(); cache) {
+			released += cache->count;
+			while(cache->count > 0) {
+				page_cache_drain(*cache);
+			}
 		}
+	}
+	released += page_cache_drain_remote();
+	const size_t target = gen::max(1ul << order, static_cast<size_t>(CONFIG_CORE_MEM_GFP_RECLAIM_BATCH));
+	released += core::mem::shrink_memory(target);
+	return released;
+}
 
-		auto* ptr = alloc->allocate(order, flags);
-		if(!ptr) {
-			//  This allocator couldn't allocate our request, try a different one
-			alloc = alloc->next;
-			continue;
+/*	Take a page from the pre-zeroed pool of the node. Returns nullptr
+ * 	when the pool is empty.
+ */
+static void* zero_pool_take(uint32 node) {
+	auto& pool = s_zero_pools[node];
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { pool.lock };
+	if(pool.count == 0) {
+		++pool.misses;
+		return nullptr;
+	}
+	++pool.hits;
+	auto* page = pool.pages[--pool.count];
+	clear_cached(page);
+	return page;
+}
+
+[[nodiscard]] core::Result<core::mem::PageAllocation>
+core::mem::allocate_pages_node(size_t order, core::mem::PageAllocFlags flags, uint32 node) {
+	if(order > CONFIG_CORE_MEM_GFP_MAX_ORDER) {
+		return core::Result<core::mem::PageAllocation> { core::Error::InvalidArgument };
+	}
+
+	const bool zeroed = flags & PageAllocFlags::Zeroed;
+	if(zeroed && order == 0 && !is_zone_restricted(flags)) {
+		if(auto* page = zero_pool_take(numa_resolve_node(node)); page) {
+			mark_allocated(page, 0);
+			return core::Result<core::mem::PageAllocation> {
+				core::mem::PageAllocation { .base = page, .order = 0, .flags = flags }
+			};
 		}
-		return core::Result<core::mem::PageAllocation> {
-			core::mem::PageAllocation {
-			                           .base = ptr,
-			                           .order = order,
-			                           .flags = flags,
-			                           }
-		};
 	}
 
-	//  None of the allocators managed to fulfill our request, either
-	//  because:
-	//    1) they're all full,
-	//    2) alignment requirements and fragmentation prevent allocation
-	//    3) we're trying to allocate a block of size that is greater
-	//		 than all the existing allocators can handle
-	//  We can try and create a new allocator, while using the allocation order
-	//  as a hint for how much the allocator should be able to handle.
-	auto* allocator = create_allocator_for_request(order, flags);
-	if(!allocator) {
-		return core::Result<core::mem::PageAllocation> { core::Error::NoMem };
+	auto* ptr = try_allocate(order, flags, node);
+	//  Larger blocks are opportunistic unless the caller has no fallback to smaller ones
+	const bool may_reclaim = !(flags & PageAllocFlags::Atomic) && (order == 0 || (flags & PageAllocFlags::Contiguous));
+	for(size_t attempt = 0; may_reclaim && !ptr && attempt < CONFIG_CORE_MEM_GFP_RECLAIM_RETRIES; ++attempt) {
+		if(reclaim(order) == 0) {
+			break;
+		}
+		ptr = try_allocate(order, flags, node);
 	}
-	auto* ptr = allocator->allocate(order, flags);
 	if(!ptr) {
 		return core::Result<core::mem::PageAllocation> { core::Error::NoMem };
 	}
+	if(core::mem::free_page_count() < CONFIG_CORE_MEM_GFP_WATERMARK_LOW) {
+		core::mem::request_reclaim();
+	}
+	//  The pool is empty or the block is too large for it, clear it synchronously
+	if(zeroed) {
+		memset(idmap(ptr), 0x0, order_to_size(order));
+	}
 	return core::Result<core::mem::PageAllocation> {
 		core::mem::PageAllocation {
 		                           .base = ptr,
@@ -209,16 +754,220 @@ static AllocatorBase* create_allocator_for_request(size_t order, core::mem::Page
 }
 
 void core::mem::free_pages(core::mem::PageAllocation alloc) {
+	//  Freed single pages are put on the hot end of the per-CPU cache, unless they
+	//  are remote, in which case caching them would hand them out as local pages
+	if(alloc.order == 0 && is_cacheable(alloc.base)) {
+		core::irq::InterruptDisabler id {};
+		auto* cache = this_cpu_page_cache();
+		if(cache && page_node(alloc.base) == core::mem::numa_current_node()) {
+			page_cache_drain_if_requested(*cache);
+			if(cache->count >= CONFIG_CORE_MEM_GFP_PCP_HIGH) {
+				page_cache_drain(*cache);
+			}
+			mark_freed(alloc.base, 0);
+			mark_cached(alloc.base);
+			cache->pages[cache->count] = alloc.base;
+			cache->count += 1;
+			return;
+		}
+	}
+
+	core::irq::InterruptDisabler id {};
 	gen::LockGuard lg { s_lock };
+	free_block_locked(alloc);
+}
 
-	auto* allocator = find_allocator_for_allocation(alloc);
-	if(!allocator) {
-		return;
+size_t core::mem::free_page_count() {
+	return __atomic_load_n(&s_free_pages, __ATOMIC_RELAXED);
+}
+
+void core::mem::update_zone_nodes() {
+	//  Pages cached before the topology was known may be remote, return them to their zones first
+	{
+		core::irq::InterruptDisabler id {};
+		if(auto* cache = this_cpu_page_cache(); cache) {
+			while(cache->count > 0) {
+				page_cache_drain(*cache);
+			}
+		}
+	}
+
+	//  Collect the regions first, as the layout lock can't be held while zones are split
+	struct {
+		core::mem::Region regions[CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS];
+		size_t count = 0;
+	} tagged;
+	core::mem::for_each_region([&tagged](core::mem::Region region) {
+		if(region.node != 0 && tagged.count < CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS) {
+			tagged.regions[tagged.count++] = region;
+		}
+	});
+
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	for(size_t i = 0; i < tagged.count; ++i) {
+		auto const& region = tagged.regions[i];
+		auto* region_start = reinterpret_cast<uint8*>(reinterpret_cast<uintptr_t>(region.start) & ~0xFFFul);
+		auto* region_end = reinterpret_cast<uint8*>((reinterpret_cast<uintptr_t>(region.end()) + 0xFFF) & ~0xFFFul);
+		//  Zones created by splitting are appended, and are visited by this loop as well
+		for(size_t index = 0; index < s_zone_count; ++index) {
+			auto& zone = s_zones[index];
+			auto* lo = gen::max(zone.start, region_start);
+			auto* hi = gen::min(zone.end, region_end);
+			if(lo >= hi || zone.node == region.node) {
+				continue;
+			}
+
+			auto target = index;
+			if(lo > zone.start) {
+				auto maybe_upper = zone_split_locked(index, lo);
+				if(!maybe_upper.has_value()) {
+					::log.warning("Out of zones, memory {x} - {x} stays on node {}", Format::ptr(lo), Format::ptr(hi),
+					              zone.node);
+					continue;
+				}
+				target = maybe_upper.unwrap();
+			}
+			if(hi < s_zones[target].end && !zone_split_locked(target, hi).has_value()) {
+				::log.warning("Out of zones, memory {x} - {x} stays on node {}", Format::ptr(hi),
+				              Format::ptr(s_zones[target].end), region.node);
+			}
+			__atomic_store_n(&s_zones[target].node, region.node, __ATOMIC_RELAXED);
+		}
+	}
+
+	for(size_t i = 0; i < s_zone_count; ++i) {
+		auto const& zone = s_zones[i];
+		::log.debug("Zone {}: {x} - {x}, node {}, {} pages", i, Format::ptr(zone.start), Format::ptr(zone.end),
+		            zone.node, zone.managed_pages);
+	}
+}
+
+size_t core::mem::zone_stats(core::mem::ZoneStats* out, size_t count) {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	size_t written = 0;
+	for(size_t i = 0; i < s_zone_count && written < count; ++i) {
+		auto const& zone = s_zones[i];
+		out[written++] = core::mem::ZoneStats {
+			.start = zone.start,
+			.end = zone.end,
+			.node = zone.node,
+			.type = zone_type(zone),
+			.free_pages = zone.free_pages,
+			.managed_pages = zone.managed_pages,
+		};
+	}
+	return written;
+}
+
+size_t core::mem::zero_pool_refill(size_t max) {
+	//  Idle CPUs don't use their page cache, drain it here when another CPU ran out of memory
+	{
+		core::irq::InterruptDisabler id {};
+		if(auto* cache = this_cpu_page_cache(); cache) {
+			page_cache_drain_if_requested(*cache);
+		}
 	}
 
-	const auto err = allocator->free(alloc);
-	if(err != core::Error::Ok) {
-		::log.warning("BUG: Freeing allocation failed ({}), base={x} order={}", err, Format::ptr(alloc.base),
-		              alloc.order);
+	const auto node = numa_current_node();
+	auto& pool = s_zero_pools[node];
+	size_t added = 0;
+	while(added < max) {
+		if(free_page_count() <= CONFIG_CORE_MEM_GFP_WATERMARK_HIGH) {
+			break;
+		}
+		{
+			core::irq::InterruptDisabler id {};
+			gen::LockGuard lg { pool.lock };
+			if(pool.count >= CONFIG_CORE_MEM_GFP_ZERO_POOL_SIZE) {
+				break;
+			}
+		}
+
+		//  Remote pages would be handed out as local ones, only take pages of this node
+		void* page;
+		{
+			core::irq::InterruptDisabler id {};
+			gen::LockGuard lg { s_lock };
+			page = allocate_block_on_node_locked(0, core::mem::ZoneType::Normal, node);
+		}
+		if(!page) {
+			break;
+		}
+		//  Zeroed pages are not accessed again until they are allocated, keep them out of the caches
+		arch::zero_page_nontemporal(idmap(page));
+
+		bool pooled = false;
+		{
+			core::irq::InterruptDisabler id {};
+			gen::LockGuard lg { pool.lock };
+			if(pool.count < CONFIG_CORE_MEM_GFP_ZERO_POOL_SIZE) {
+				mark_cached(page);
+				pool.pages[pool.count++] = page;
+				++pool.refilled;
+				pooled = true;
+			}
+		}
+		if(!pooled) {
+			//  Another CPU of the node filled the pool in the meantime
+			core::irq::InterruptDisabler id {};
+			gen::LockGuard lg { s_lock };
+			free_block_locked(core::mem::PageAllocation { .base = page, .order = 0, .flags = {} });
+			break;
+		}
+		++added;
+	}
+
+	//  Not done under any lock, the registry lock is taken before the pool locks during reclaim
+	if(added > 0 && !__atomic_exchange_n(&s_zero_pool_shrinker_registered, true, __ATOMIC_ACQ_REL)) {
+		core::mem::register_shrinker(s_zero_pool_shrinker);
+	}
+	return added;
+}
+
+core::mem::ZeroPoolStats core::mem::zero_pool_stats(uint32 node) {
+	auto const& pool = s_zero_pools[numa_resolve_node(node)];
+	return core::mem::ZeroPoolStats {
+		.pages = __atomic_load_n(&pool.count, __ATOMIC_RELAXED),
+		.hits = __atomic_load_n(&pool.hits, __ATOMIC_RELAXED),
+		.misses = __atomic_load_n(&pool.misses, __ATOMIC_RELAXED),
+		.refilled = __atomic_load_n(&pool.refilled, __ATOMIC_RELAXED),
+	};
+}
+
+//  Get the number of pages held by the pre-zeroed pools, as an estimate
+static size_t zero_pool_reclaimable() {
+	size_t pages = 0;
+	for(auto const& pool : s_zero_pools) {
+		pages += __atomic_load_n(&pool.count, __ATOMIC_RELAXED);
+	}
+	return pages;
+}
+
+//  Give pre-zeroed pages back to the zones, zeroing them again is cheaper than failing an allocation
+static size_t zero_pool_shrink(size_t target) {
+	size_t freed = 0;
+	for(auto& pool : s_zero_pools) {
+		if(freed >= target) {
+			break;
+		}
+		//  Both locks may be held by the code that triggered the reclaim
+		if(!pool.lock.try_lock()) {
+			continue;
+		}
+		if(!s_lock.try_lock()) {
+			pool.lock.unlock();
+			break;
+		}
+		while(pool.count > 0 && freed < target) {
+			auto* page = pool.pages[--pool.count];
+			clear_cached(page);
+			free_block_locked(core::mem::PageAllocation { .base = page, .order = 0, .flags = {} });
+			++freed;
+		}
+		s_lock.unlock();
+		pool.lock.unlock();
 	}
+	return freed;
 }
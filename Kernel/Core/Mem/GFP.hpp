@@ -1,9 +1,43 @@
 #pragma once
 #include <Core/Error/Error.hpp>
+#include <LibGeneric/BitFlags.hpp>
 #include <SystemTypes.hpp>
 
-/* Size of the allocalloc region used for storing allocator metadata */
-#define CONFIG_CORE_MEM_GFP_DEFAULT_ALLOCALLOC_SIZE (32768)
+/* Largest order that can be requested from GFP (2^order pages) */
+#define CONFIG_CORE_MEM_GFP_MAX_ORDER (10)
+/* Per-CPU page cache: refill when at or below LOW pages, drain when reaching HIGH pages */
+#define CONFIG_CORE_MEM_GFP_PCP_LOW (0)
+#define CONFIG_CORE_MEM_GFP_PCP_HIGH (64)
+/* Number of pages moved between a per-CPU page cache and the global allocators at once */
+#define CONFIG_CORE_MEM_GFP_PCP_BATCH (16)
+/* Number of spin iterations an allocation waits for other CPUs to drain their page caches before failing */
+#define CONFIG_CORE_MEM_GFP_PCP_DRAIN_WAIT (1000000)
+
+/* Free page watermarks: background reclaim starts below LOW pages, and goes on until HIGH pages are free.
+ * The last MIN pages are reserved for PageAllocFlags::Atomic and PageAllocFlags::HighPriority requests. */
+#define CONFIG_CORE_MEM_GFP_WATERMARK_MIN (256)
+#define CONFIG_CORE_MEM_GFP_WATERMARK_LOW (1024)
+#define CONFIG_CORE_MEM_GFP_WATERMARK_HIGH (2048)
+/* Minimum number of pages reclaimed before retrying a failed allocation */
+#define CONFIG_CORE_MEM_GFP_RECLAIM_BATCH (32)
+/* Number of times a failed allocation is retried after reclaiming memory */
+#define CONFIG_CORE_MEM_GFP_RECLAIM_RETRIES (3)
+
+/* Physical address limits of memory that can be allocated with PageAllocFlags::DMA and PageAllocFlags::DMA32 */
+#define CONFIG_CORE_MEM_GFP_DMA_LIMIT (16_MiB)
+#define CONFIG_CORE_MEM_GFP_DMA32_LIMIT (4_GiB)
+
+/* Number of pre-zeroed pages kept for every NUMA node */
+#define CONFIG_CORE_MEM_GFP_ZERO_POOL_SIZE (256)
+/* Number of pages an idle CPU zeroes before checking for other work */
+#define CONFIG_CORE_MEM_GFP_ZERO_POOL_BATCH (8)
+
+static_assert(CONFIG_CORE_MEM_GFP_PCP_LOW + CONFIG_CORE_MEM_GFP_PCP_BATCH <= CONFIG_CORE_MEM_GFP_PCP_HIGH,
+              "Per-CPU page cache batch must fit between the watermarks");
+static_assert(CONFIG_CORE_MEM_GFP_WATERMARK_MIN < CONFIG_CORE_MEM_GFP_WATERMARK_LOW,
+              "The reserve must be smaller than the background reclaim watermark");
+static_assert(CONFIG_CORE_MEM_GFP_WATERMARK_LOW < CONFIG_CORE_MEM_GFP_WATERMARK_HIGH,
+              "Reclaim must stop above the watermark it starts at");
 
 namespace core::mem {
 	/* Convert a GFP order to a size in bytes */
@@ -12,13 +46,45 @@ namespace core::mem {
 	}
 	/* Convert a size in bytes to the nearest viable GFP order */
 	constexpr size_t size_to_order_nearest(size_t size) {
-		size_t p = 1ul;
+		size_t p = 0ul;
 		while(order_to_size(p) < size)
 			++p;
 		return p;
 	}
 
-	enum PageAllocFlags {
+	/*	Flags of a GFP request.
+	 *
+	 * 	Without any flags, memory may come from any zone, and the allocation
+	 * 	may reclaim memory synchronously when no zone can satisfy it. Blocks
+	 * 	larger than a single page are treated as opportunistic unless they
+	 * 	are requested with Contiguous, and fail without reclaiming, as most
+	 * 	callers can fall back to smaller blocks.
+	 */
+	enum class PageAllocFlags : uint32 {
+		None = 0,
+		//  The memory must be filled with zeros
+		Zeroed = 1u << 0u,
+		//  The memory must lie below CONFIG_CORE_MEM_GFP_DMA_LIMIT, for legacy DMA engines
+		DMA = 1u << 1u,
+		//  The memory must lie below CONFIG_CORE_MEM_GFP_DMA32_LIMIT, for devices with 32-bit addressing
+		DMA32 = 1u << 2u,
+		//  The caller can't wait for reclaim (for example, in interrupt context). Atomic requests
+		//  never invoke shrinkers, and may use the reserved pages below the min watermark.
+		Atomic = 1u << 3u,
+		//  The request may use the reserved pages below the min watermark
+		HighPriority = 1u << 4u,
+		//  The caller has no fallback to smaller blocks, memory is reclaimed for larger blocks as well
+		Contiguous = 1u << 5u,
+	};
+	DEFINE_ENUM_BITFLAG_OPS(PageAllocFlags);
+
+	/*	Classes of physical memory, by the devices that are able to address it.
+	 * 	Zones never span more than one class.
+	 */
+	enum class ZoneType : uint8 {
+		DMA,
+		DMA32,
+		Normal,
 	};
 
 	struct PageAllocation {
@@ -33,7 +99,100 @@ namespace core::mem {
 		[[nodiscard]] constexpr size_t size() const { return order_to_size(order); }
 	};
 
+	/*	Per-CPU cache of single pages.
+	 *
+	 * 	Order-0 requests are served from this cache without taking the global
+	 * 	GFP lock. Pages are kept in LIFO order: the top of the cache holds
+	 * 	recently freed (hot) pages, while pages refilled from the global
+	 * 	allocators go to the bottom and are the first to be drained.
+	 *
+	 * 	Only the owning CPU touches the pages of its cache. CPUs that ran out
+	 * 	of memory set drain_requested instead, and the owner drains the whole
+	 * 	cache the next time it uses it, or when it is idle.
+	 */
+	struct PageCache {
+		void* pages[CONFIG_CORE_MEM_GFP_PCP_HIGH] {};
+		size_t count {};
+		bool drain_requested {};
+		//  Statistics
+		size_t refills {};
+		size_t drains {};
+	};
+
+	/*	Statistics of a single GFP zone.
+	 */
+	struct ZoneStats {
+		void* start;
+		void* end;
+		uint32 node;
+		ZoneType type;
+		size_t free_pages;
+		size_t managed_pages;
+	};
+
+	/*	Statistics of the pre-zeroed page pool of a NUMA node.
+	 */
+	struct ZeroPoolStats {
+		size_t pages;
+		size_t hits;
+		size_t misses;
+		size_t refilled;
+	};
+
+	/*	Allocate a block of 2^order pages.
+	 *
+	 * 	Memory is allocated from the NUMA node of the current CPU if possible,
+	 * 	falling back to other nodes in the order of their distance. When no
+	 * 	node can satisfy the request, memory is reclaimed from the per-CPU
+	 * 	page cache and registered shrinkers, and the allocation is retried
+	 * 	(unless disallowed by the request flags, see PageAllocFlags).
+	 *
+	 * 	Single pages requested with PageAllocFlags::Zeroed are taken from the
+	 * 	pre-zeroed pool of the node. Larger blocks, and requests made while the
+	 * 	pool is empty, are cleared before returning.
+	 *
+	 * 	Unrestricted requests prefer Normal memory, and only fall back to the
+	 * 	DMA32 and DMA zones when the higher ones are exhausted. DMA and DMA32
+	 * 	requests bypass the per-CPU page cache and the pre-zeroed pool.
+	 */
 	[[nodiscard]] core::Result<PageAllocation> allocate_pages(size_t order, PageAllocFlags);
+
+	/*	Allocate a block of 2^order pages, preferring memory of the given NUMA node.
+	 *
+	 * 	Falls back to other nodes in the order of their distance from `node`,
+	 * 	which may be NUMA_NODE_LOCAL to use the node of the current CPU.
+	 */
+	[[nodiscard]] core::Result<PageAllocation> allocate_pages_node(size_t order, PageAllocFlags, uint32 node);
 	void free_pages(PageAllocation);
 
+	/*	Get the number of free pages in all zones, not counting per-CPU page caches.
+	 */
+	[[nodiscard]] size_t free_page_count();
+
+	/*	Move zones onto the NUMA nodes of the physical memory layout.
+	 *
+	 * 	Zones that span more than one node are split at the node boundaries.
+	 * 	This is called by core::mem::numa_init once the topology is known.
+	 */
+	void update_zone_nodes();
+
+	/*	Get the statistics of GFP zones.
+	 *
+	 * 	Fills `out` with at most `count` zones, and returns the number of
+	 * 	entries written.
+	 */
+	size_t zone_stats(ZoneStats* out, size_t count);
+
+	/*	Zero up to `max` free pages of the current node, and put them in the
+	 * 	pre-zeroed pool. Returns the number of pages added to the pool.
+	 *
+	 * 	This is meant to be called by idle CPUs. Nothing is done when the pool
+	 * 	is full, or when free memory is below the high watermark.
+	 */
+	size_t zero_pool_refill(size_t max);
+
+	/*	Get the statistics of the pre-zeroed pool of the given node.
+	 */
+	[[nodiscard]] ZeroPoolStats zero_pool_stats(uint32 node);
+
 }
\ No newline at end of file
@@ -1,57 +1,652 @@
+#include <Core/Assert/Assert.hpp>
 #include <Core/IRQ/InterruptDisabler.hpp>
 #include <Core/Mem/Heap.hpp>
+#include <Core/Mem/ObjectCache.hpp>
 #include <Core/Mem/VM.hpp>
 #include <LibAllocator/Arena.hpp>
 #include <LibAllocator/ChunkAllocator.hpp>
 #include <LibGeneric/LockGuard.hpp>
 #include <LibGeneric/Spinlock.hpp>
 #include <Structs/KOptional.hpp>
+#ifdef ARCH_IS_x86_64
+#	include <Core/MP/MP.hpp>
+#endif
 
-//  Was the heap vmalloc region allocated and initialized already?
-static constinit bool s_allocator_initialized { false };
-//  The allocator itself, currently the heap uses only a single one
-//  but ideally this should keep track of multiple heap regions to
-//  be able to use more memory than HEAP_DEFAULT_SIZE.
-static constinit liballoc::ChunkAllocator s_allocator {};
+/*	A single heap arena, backed by a vmalloc'd region.
+ *
+ * 	Arena descriptors are kept in a static table instead of in-band, so
+ * 	that looking up the arena for a pointer never touches memory of an
+ * 	arena that may be concurrently released.
+ */
+struct HeapArena {
+	//  Base of the vmalloc region, nullptr if this slot is unused
+	void* base;
+	size_t size;
+	//  NUMA node the arena memory is local to
+	uint32 node;
+	//  The slot was taken by an arena whose vmalloc is still in progress
+	bool reserved;
+	liballoc::ChunkAllocator allocator;
+};
+
+//  All heap arenas
+static constinit HeapArena s_arenas[CONFIG_CORE_MEM_HEAP_MAX_ARENAS] {};
+//  Number of arenas currently in use
+static constinit size_t s_arena_count { 0 };
+//  Index of the arena that satisfied the last allocation, for every node
+static constinit size_t s_last_arena[CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+//  An arena became empty since the last trim, read without the lock to skip trims early
+static constinit bool s_arena_trim_pending { false };
 //  Protects all data above
 static constinit gen::Spinlock s_lock {};
 
-//  Ensure the heap allocator region is allocated, and the allocator
-//  was initialized with it. Returns a pointer to the heap allocator,
-//  or nullptr on failure.
-liballoc::ChunkAllocator* ensure_allocator() {
-	if(s_allocator_initialized) {
-		return &s_allocator;
+/*	A large allocation that bypasses the arenas.
+ *
+ * 	Large allocations are made directly using vmalloc, and are tracked in a
+ * 	side table so that hfree can tell them apart from arena allocations.
+ */
+struct HeapLargeAllocation {
+	//  Base of the vmalloc region, nullptr if this slot is unused
+	void* base;
+	size_t size;
+	//  The slot was taken by an allocation whose vmalloc is still in progress
+	bool reserved;
+	//  The allocation was freed with interrupts disabled, and is waiting to be released by heap_trim
+	bool deferred;
+};
+
+//  All live large allocations
+static constinit HeapLargeAllocation s_large[CONFIG_CORE_MEM_HEAP_LARGE_MAX] {};
+//  Number of live large allocations
+static constinit size_t s_large_count { 0 };
+//  Total size of all live large allocations
+static constinit size_t s_large_bytes { 0 };
+//  A large allocation was deferred since the last trim, read without the lock to skip trims early
+static constinit bool s_large_trim_pending { false };
+//  Protects the large allocation table
+static constinit gen::Spinlock s_large_lock {};
+
+//  vmalloc and vfree take the VM lock, map memory and wait for TLB shootdowns, so they
+//  must not be called with interrupts disabled, or from an interrupt handler.
+static bool can_call_vm() {
+#ifdef ARCH_IS_x86_64
+	return irq_local_enabled();
+#else
+	return true;
+#endif
+}
+
+//  Allocate a large region using vmalloc and record it in the side table.
+//  Returns nullptr if the table is full, in which case the arenas should be used.
+static void* large_allocate(size_t n, uint32 node) {
+	const auto size = (n + 0x1000 - 1) & ~(0x1000ul - 1);
+
+	//  vmalloc maps memory and may reclaim, reserve a slot so that it can be called without the table lock
+	HeapLargeAllocation* slot = nullptr;
+	{
+		core::irq::InterruptDisabler id {};
+		gen::LockGuard lg { s_large_lock };
+		for(auto& entry : s_large) {
+			if(!entry.base && !entry.reserved) {
+				entry.reserved = true;
+				slot = &entry;
+				break;
+			}
+		}
+	}
+	if(!slot) {
+		return nullptr;
+	}
+
+	auto* mem = core::mem::vmalloc_node(size, node);
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_large_lock };
+	slot->reserved = false;
+	if(mem) {
+		slot->base = mem;
+		slot->size = size;
+		++s_large_count;
+		s_large_bytes += size;
+	}
+	return mem;
+}
+
+//  Free a large allocation. Returns false if the pointer is not a large allocation.
+//  When called with interrupts disabled, the region is released later by heap_trim.
+static bool large_free(void* ptr) {
+	//  Large allocations are always page-aligned, which rules out most arena pointers early
+	if(reinterpret_cast<uintptr_t>(ptr) & (0x1000 - 1)) {
+		return false;
 	}
 
-	auto mem = core::mem::vmalloc(core::mem::HEAP_DEFAULT_SIZE);
+	const bool release = can_call_vm();
+	void* base = nullptr;
+	{
+		core::irq::InterruptDisabler id {};
+		gen::LockGuard lg { s_large_lock };
+		if(!s_large_count) {
+			return false;
+		}
+		for(auto& entry : s_large) {
+			if(entry.base != ptr || entry.deferred) {
+				continue;
+			}
+			if(!release) {
+				entry.deferred = true;
+				__atomic_store_n(&s_large_trim_pending, true, __ATOMIC_RELAXED);
+				return true;
+			}
+			base = entry.base;
+			--s_large_count;
+			s_large_bytes -= entry.size;
+			entry.base = nullptr;
+			entry.size = 0;
+			break;
+		}
+	}
+	if(!base) {
+		return false;
+	}
+	core::mem::vfree(base);
+	return true;
+}
+
+//  Find the arena that owns the given pointer.
+static HeapArena* arena_for(void* ptr) {
+	for(auto& arena : s_arenas) {
+		if(arena.base && arena.allocator.contains(ptr)) {
+			return &arena;
+		}
+	}
+	return nullptr;
+}
+
+//  Create a new arena on the node that can fit at least `n` bytes and put it in a free slot.
+//  Returns false when out of slots or memory. Must be called without the heap lock held:
+//  the lock is only taken to reserve and fill in the slot, not across vmalloc.
+static bool arena_create(size_t n, uint32 node) {
+	//  Leave some room for allocator metadata when sizing the arena for large requests
+	constexpr const size_t metadata_slack = 0x1000;
+	auto size = core::mem::HEAP_DEFAULT_SIZE;
+	if(n + metadata_slack > size) {
+		size = (n + metadata_slack + 0x1000 - 1) & ~(0x1000ul - 1);
+	}
+
+	HeapArena* slot = nullptr;
+	{
+		core::irq::InterruptDisabler id {};
+		gen::LockGuard lg { s_lock };
+		for(auto& arena : s_arenas) {
+			if(!arena.base && !arena.reserved) {
+				arena.reserved = true;
+				slot = &arena;
+				break;
+			}
+		}
+	}
+	if(!slot) {
+		return false;
+	}
+
+	auto* mem = core::mem::vmalloc_node(size, node);
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	slot->reserved = false;
 	if(!mem) {
+		return false;
+	}
+	slot->base = mem;
+	slot->size = size;
+	slot->node = node;
+	new(&slot->allocator) liballoc::ChunkAllocator {
+		liballoc::Arena { mem, size }
+	};
+	++s_arena_count;
+	s_last_arena[node] = slot - &s_arenas[0];
+	return true;
+}
+
+//  Allocate from the existing arenas of the given node. The heap is not grown, see
+//  arena_create. Must be called with the heap lock held.
+static void* heap_allocate_locked(size_t n, uint32 node) {
+	//  Try the arena that succeeded most recently first, it most likely still has space
+	auto& last_index = s_last_arena[node];
+	auto& last = s_arenas[last_index];
+	if(last.base && last.node == node) {
+		if(auto* ptr = last.allocator.allocate(n); ptr) {
+			return ptr;
+		}
+	}
+	for(size_t i = 0; i < CONFIG_CORE_MEM_HEAP_MAX_ARENAS; ++i) {
+		auto& arena = s_arenas[i];
+		if(!arena.base || arena.node != node || i == last_index) {
+			continue;
+		}
+		if(auto* ptr = arena.allocator.allocate(n); ptr) {
+			last_index = i;
+			return ptr;
+		}
+	}
+	return nullptr;
+}
+
+//  Allocate from the arenas of nodes other than the given one, used when no new
+//  arena can be created on the node. Must be called with the heap lock held.
+static void* heap_allocate_remote_locked(size_t n, uint32 node) {
+	for(auto& arena : s_arenas) {
+		if(!arena.base || arena.node == node) {
+			continue;
+		}
+		if(auto* ptr = arena.allocator.allocate(n); ptr) {
+			return ptr;
+		}
+	}
+	return nullptr;
+}
+
+//  Free an allocation from the shared heap. Arenas that became empty are left in
+//  place, and released by heap_trim later. Must be called with the heap lock held.
+static void heap_free_locked(void* ptr) {
+	auto* arena = arena_for(ptr);
+	if(!arena) {
+		return;
+	}
+	arena->allocator.free(ptr);
+	if(arena->allocator.allocation_count() == 0) {
+		__atomic_store_n(&s_arena_trim_pending, true, __ATOMIC_RELAXED);
+	}
+}
+
+//  Detach up to `max` empty arenas, keeping one empty arena on every node, so that
+//  allocations crossing an arena boundary back and forth don't keep creating and
+//  releasing arenas. Returns the number of arena bases written to `out`.
+//  Must be called with the heap lock held.
+static size_t arena_trim_locked(void** out, size_t max) {
+	__atomic_store_n(&s_arena_trim_pending, false, __ATOMIC_RELAXED);
+	bool kept[CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+	size_t count = 0;
+	for(auto& arena : s_arenas) {
+		if(!arena.base || arena.allocator.allocation_count() > 0) {
+			continue;
+		}
+		if(!kept[arena.node]) {
+			kept[arena.node] = true;
+			continue;
+		}
+		if(count == max) {
+			__atomic_store_n(&s_arena_trim_pending, true, __ATOMIC_RELAXED);
+			break;
+		}
+		out[count++] = arena.base;
+		arena.base = nullptr;
+		arena.size = 0;
+		arena.allocator = liballoc::ChunkAllocator {};
+		--s_arena_count;
+	}
+	return count;
+}
+
+//  Detach up to `max` large allocations that were freed with interrupts disabled.
+//  Returns the number of region bases written to `out`. Must be called with the
+//  large allocation table lock held.
+static size_t large_trim_locked(void** out, size_t max) {
+	__atomic_store_n(&s_large_trim_pending, false, __ATOMIC_RELAXED);
+	size_t count = 0;
+	for(auto& entry : s_large) {
+		if(!entry.base || !entry.deferred) {
+			continue;
+		}
+		if(count == max) {
+			__atomic_store_n(&s_large_trim_pending, true, __ATOMIC_RELAXED);
+			break;
+		}
+		out[count++] = entry.base;
+		--s_large_count;
+		s_large_bytes -= entry.size;
+		entry.base = nullptr;
+		entry.size = 0;
+		entry.deferred = false;
+	}
+	return count;
+}
+
+//  Release surplus empty arenas and deferred large allocations with vfree.
+//  Does nothing when called with interrupts disabled, the next free will do it instead.
+static void heap_trim() {
+	constexpr const size_t batch = 8;
+	while(can_call_vm()) {
+		void* released[batch] {};
+		size_t count = 0;
+		if(__atomic_load_n(&s_arena_trim_pending, __ATOMIC_RELAXED)) {
+			core::irq::InterruptDisabler id {};
+			gen::LockGuard lg { s_lock };
+			count = arena_trim_locked(released, batch);
+		}
+		if(count < batch && __atomic_load_n(&s_large_trim_pending, __ATOMIC_RELAXED)) {
+			core::irq::InterruptDisabler id {};
+			gen::LockGuard lg { s_large_lock };
+			count += large_trim_locked(released + count, batch - count);
+		}
+		if(!count) {
+			return;
+		}
+		for(size_t i = 0; i < count; ++i) {
+			core::mem::vfree(released[i]);
+		}
+	}
+}
+
+//  Get the heap cache of the current node. Returns nullptr when per-CPU
+//  caches can't be used yet, which is the case during early boot.
+//  Must be called with interrupts disabled.
+static core::mem::HeapCache* this_cpu_heap_cache() {
+#ifdef ARCH_IS_x86_64
+	if(!core::mp::is_environment_available()) {
 		return nullptr;
 	}
+	return &this_cpu()->heap_cache;
+#else
+	return nullptr;
+#endif
+}
 
-	new(&s_allocator) liballoc::ChunkAllocator {
-		liballoc::Arena { mem, core::mem::HEAP_DEFAULT_SIZE }
-	};
-	s_allocator_initialized = true;
-	return &s_allocator;
+//  Find the smallest magazine size class that can fit `n` bytes.
+static KOptional<size_t> class_for_request(size_t n) {
+	for(size_t i = 0; i < core::mem::HEAP_MAGAZINE_CLASS_COUNT; ++i) {
+		if(n <= core::mem::HEAP_MAGAZINE_CLASSES[i]) {
+			return i;
+		}
+	}
+	return {};
 }
 
-void* core::mem::hmalloc(size_t n) {
+//  Find the largest magazine size class that an existing allocation with
+//  `usable` bytes can be reused for. Allocations that are much larger than
+//  the largest class are not cached, as that would waste memory.
+static KOptional<size_t> class_for_usable_size(size_t usable) {
+	constexpr const auto last = core::mem::HEAP_MAGAZINE_CLASS_COUNT - 1;
+	if(usable < core::mem::HEAP_MAGAZINE_CLASSES[0] || usable >= 2 * core::mem::HEAP_MAGAZINE_CLASSES[last]) {
+		return {};
+	}
+	size_t index = 0;
+	while(index < last && usable >= core::mem::HEAP_MAGAZINE_CLASSES[index + 1]) {
+		++index;
+	}
+	return index;
+}
+
+//  Fill an empty magazine with a batch of objects from the existing arenas of the node.
+static void magazine_refill(core::mem::HeapCache::Magazine& magazine, size_t size, uint32 node) {
+	gen::LockGuard lg { s_lock };
+	while(magazine.count < CONFIG_CORE_MEM_HEAP_MAGAZINE_BATCH) {
+		auto* ptr = heap_allocate_locked(size, node);
+		if(!ptr) {
+			break;
+		}
+		magazine.objects[magazine.count++] = ptr;
+	}
+}
+
+//  Return a batch of objects from a full magazine to the shared heap.
+static void magazine_drain(core::mem::HeapCache::Magazine& magazine) {
+	gen::LockGuard lg { s_lock };
+	for(size_t i = 0; i < CONFIG_CORE_MEM_HEAP_MAGAZINE_BATCH; ++i) {
+		heap_free_locked(magazine.objects[--magazine.count]);
+	}
+}
+
+//  Allocate from the per-CPU magazines or the existing arenas of the node, with interrupts
+//  disabled. The magazines only hold objects local to the current node, and are bypassed
+//  for allocations on other nodes.
+static void* heap_allocate_existing(size_t n, uint32 node) {
+	core::irq::InterruptDisabler id {};
+
+	if(auto size_class = class_for_request(n); size_class.has_value()) {
+		auto* cache = this_cpu_heap_cache();
+		if(cache && node == core::mem::numa_current_node()) {
+			auto& magazine = cache->magazines[size_class.unwrap()];
+			if(magazine.count > 0) {
+				++cache->hits;
+				return magazine.objects[--magazine.count];
+			}
+			++cache->misses;
+			magazine_refill(magazine, core::mem::HEAP_MAGAZINE_CLASSES[size_class.unwrap()], node);
+			if(magazine.count > 0) {
+				return magazine.objects[--magazine.count];
+			}
+			return nullptr;
+		}
+	}
+
+	gen::LockGuard lg { s_lock };
+	return heap_allocate_locked(n, node);
+}
+
+//  Allocate from the large allocation table, the per-CPU magazines or the arenas.
+//  When the arenas of the node are exhausted, the heap grows by a new arena on the node.
+//  Arenas of other nodes are only used when no new arena can be created.
+static void* heap_allocate(size_t n, uint32 requested_node) {
+	const auto node = core::mem::numa_resolve_node(requested_node);
+
+	//  Done before disabling interrupts, large allocations take a while
+	if(n > CONFIG_CORE_MEM_HEAP_LARGE_THRESHOLD) {
+		if(auto* ptr = large_allocate(n, node); ptr) {
+			return ptr;
+		}
+	}
+
+	if(auto* ptr = heap_allocate_existing(n, node); ptr) {
+		return ptr;
+	}
+	//  vmalloc is called with the interrupt state of the caller and without the heap lock
+	if(arena_create(n, node)) {
+		core::irq::InterruptDisabler id {};
+		gen::LockGuard lg { s_lock };
+		if(auto* ptr = heap_allocate_locked(n, node); ptr) {
+			return ptr;
+		}
+	}
+
 	core::irq::InterruptDisabler id {};
 	gen::LockGuard lg { s_lock };
-	auto* alloc = ensure_allocator();
-	if(!alloc) [[unlikely]] {
+	return heap_allocate_remote_locked(n, node);
+}
+
+//  Free an allocation made by heap_allocate.
+static void heap_free(void* ptr) {
+	if(!large_free(ptr)) {
+		core::irq::InterruptDisabler id {};
+		auto* cache = this_cpu_heap_cache();
+		//  The size class is recovered from the chunk itself. Reading the
+		//  chunk header of a live allocation is safe without the lock, as
+		//  only the owner of the allocation can modify it.
+		//  Objects of remote arenas go back to the shared heap, so that the magazines stay local
+		auto* arena = cache ? arena_for(ptr) : nullptr;
+		const bool local = arena && arena->node == core::mem::numa_current_node();
+		auto size_class = local ? class_for_usable_size(arena->allocator.usable_size(ptr)) : KOptional<size_t> {};
+		if(size_class.has_value()) {
+			auto& magazine = cache->magazines[size_class.unwrap()];
+			if(magazine.count >= CONFIG_CORE_MEM_HEAP_MAGAZINE_SIZE) {
+				magazine_drain(magazine);
+			}
+			magazine.objects[magazine.count++] = ptr;
+		} else {
+			gen::LockGuard lg { s_lock };
+			heap_free_locked(ptr);
+		}
+	}
+	heap_trim();
+}
+
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+/*	Heap accounting
+ *
+ * 	When enabled, every heap allocation is prefixed with a header that
+ * 	records the callsite that made it. Statistics are kept per callsite
+ * 	in an open-addressed hash table keyed by the return address of hmalloc.
+ * 	Slot 0 of the table collects allocations from callsites that did not
+ * 	fit in the table.
+ */
+struct HeapAccountingHeader {
+	uint32 site;
+	uint32 magic;
+	size_t size;
+};
+static_assert(sizeof(HeapAccountingHeader) % 16 == 0, "Accounting header must preserve allocation alignment");
+
+static constexpr const uint32 accounting_magic = 0xACC0A110;
+
+//  Per-callsite statistics
+static constinit core::mem::HeapSiteStats s_sites[CONFIG_CORE_MEM_HEAP_ACCOUNTING_SITES] {};
+//  Protects the callsite table
+static constinit gen::Spinlock s_sites_lock {};
+
+//  Find the table slot of the given callsite, inserting it if it's not present yet.
+//  Must be called with the callsite table lock held.
+static uint32 site_index(void* site) {
+	constexpr const size_t slots = CONFIG_CORE_MEM_HEAP_ACCOUNTING_SITES - 1;
+	const auto hash = (reinterpret_cast<uintptr_t>(site) * 0x9E3779B97F4A7C15ull) >> 32;
+	for(size_t probe = 0; probe < slots; ++probe) {
+		const auto index = 1 + (hash + probe) % slots;
+		auto& entry = s_sites[index];
+		if(entry.site == site) {
+			return index;
+		}
+		if(!entry.site) {
+			entry.site = site;
+			return index;
+		}
+	}
+	return 0;
+}
+
+static void* accounted_allocate(size_t n, void* site, uint32 node) {
+	if(n > static_cast<size_t>(-1) - sizeof(HeapAccountingHeader)) {
+		return nullptr;
+	}
+	auto* header = static_cast<HeapAccountingHeader*>(heap_allocate(n + sizeof(HeapAccountingHeader), node));
+	if(!header) {
 		return nullptr;
 	}
-	return alloc->allocate(n);
+
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_sites_lock };
+	const auto index = site_index(site);
+	auto& entry = s_sites[index];
+	entry.live_bytes += n;
+	++entry.live_count;
+	++entry.allocations;
+	if(entry.live_bytes > entry.peak_bytes) {
+		entry.peak_bytes = entry.live_bytes;
+	}
+	header->site = index;
+	header->magic = accounting_magic;
+	header->size = n;
+	return header + 1;
+}
+
+static void accounted_free(void* ptr) {
+	auto* header = static_cast<HeapAccountingHeader*>(ptr) - 1;
+	//  Catches frees of pointers that were not returned by hmalloc
+	ENSURE(header->magic == accounting_magic);
+	header->magic = 0;
+	{
+		core::irq::InterruptDisabler id {};
+		gen::LockGuard lg { s_sites_lock };
+		auto& entry = s_sites[header->site];
+		entry.live_bytes -= header->size;
+		--entry.live_count;
+		++entry.frees;
+	}
+	heap_free(header);
+}
+#endif
+
+void* core::mem::hmalloc(size_t n) {
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+	return accounted_allocate(n, __builtin_return_address(0), NUMA_NODE_LOCAL);
+#else
+	return heap_allocate(n, NUMA_NODE_LOCAL);
+#endif
+}
+
+void* core::mem::hmalloc_node(size_t n, uint32 node) {
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+	return accounted_allocate(n, __builtin_return_address(0), node);
+#else
+	return heap_allocate(n, node);
+#endif
+}
+
+void* core::mem::hmalloc_at(size_t n, uint32 node, [[maybe_unused]] void* site) {
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+	return accounted_allocate(n, site, node);
+#else
+	return heap_allocate(n, node);
+#endif
 }
 
 void core::mem::hfree(void* ptr) {
-	core::irq::InterruptDisabler id {};
-	gen::LockGuard lg { s_lock };
-	auto* alloc = ensure_allocator();
-	if(!alloc) [[unlikely]] {
+	if(!ptr) {
 		return;
 	}
-	alloc->free(ptr);
+	//  Objects from object caches may end up here when they are owned by
+	//  containers that free using the heap (for example, SharedPtr).
+	if(core::mem::ObjectCache::is_object_pointer(ptr)) {
+		core::mem::ObjectCache::free_object(ptr);
+		return;
+	}
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+	accounted_free(ptr);
+#else
+	heap_free(ptr);
+#endif
+}
+
+size_t core::mem::heap_accounting_top([[maybe_unused]] HeapSiteStats* out, [[maybe_unused]] size_t count) {
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_sites_lock };
+	//  Insertion sort into the output buffer by live bytes, the buffer is expected to be small
+	size_t found = 0;
+	for(auto const& entry : s_sites) {
+		if(!entry.allocations) {
+			continue;
+		}
+		size_t position = found < count ? found : count;
+		while(position > 0 && out[position - 1].live_bytes < entry.live_bytes) {
+			if(position < count) {
+				out[position] = out[position - 1];
+			}
+			--position;
+		}
+		if(position < count) {
+			out[position] = entry;
+		}
+		if(found < count) {
+			++found;
+		}
+	}
+	return found;
+#else
+	return 0;
+#endif
+}
+
+core::mem::HeapStats core::mem::heap_stats() {
+	core::irq::InterruptDisabler id {};
+	HeapStats stats {};
+	{
+		gen::LockGuard lg { s_lock };
+		stats.arena_count = s_arena_count;
+		for(auto const& arena : s_arenas) {
+			stats.arena_bytes += arena.size;
+		}
+	}
+	{
+		gen::LockGuard lg { s_large_lock };
+		stats.large_allocations = s_large_count;
+		stats.large_bytes = s_large_bytes;
+	}
+	return stats;
 }
@@ -1,10 +1,78 @@
 #pragma once
+#include <Core/Mem/NUMA.hpp>
 #include <LibGeneric/Memory.hpp>
 #include <SystemTypes.hpp>
 
+/* Maximum number of arenas the kernel heap can grow to */
+#define CONFIG_CORE_MEM_HEAP_MAX_ARENAS (64)
+/* Requests larger than this many bytes bypass the heap arenas and are allocated using vmalloc */
+#define CONFIG_CORE_MEM_HEAP_LARGE_THRESHOLD (0x1000)
+/* Maximum number of live large allocations that can be tracked */
+#define CONFIG_CORE_MEM_HEAP_LARGE_MAX (256)
+/* Enable per-callsite accounting of heap allocations, set using the CMake option of the same name */
+#ifndef CONFIG_CORE_MEM_HEAP_ACCOUNTING
+#	define CONFIG_CORE_MEM_HEAP_ACCOUNTING (0)
+#endif
+/* Number of distinct callsites that heap accounting can track */
+#define CONFIG_CORE_MEM_HEAP_ACCOUNTING_SITES (512)
+/* Number of objects a single per-CPU heap magazine can hold */
+#define CONFIG_CORE_MEM_HEAP_MAGAZINE_SIZE (32)
+/* Number of objects moved between a magazine and the shared heap at once */
+#define CONFIG_CORE_MEM_HEAP_MAGAZINE_BATCH (16)
+
+static_assert(CONFIG_CORE_MEM_HEAP_MAGAZINE_BATCH <= CONFIG_CORE_MEM_HEAP_MAGAZINE_SIZE,
+              "Heap magazine batch must fit in a magazine");
+
 namespace core::mem {
 	static constexpr size_t HEAP_DEFAULT_SIZE = 32_MiB;
 
+	/*	Size classes served by the per-CPU magazines. Requests larger than
+	 * 	the last class always go to the shared heap.
+	 */
+	static constexpr size_t HEAP_MAGAZINE_CLASSES[] = { 16, 32, 64, 128, 256, 512 };
+	static constexpr size_t HEAP_MAGAZINE_CLASS_COUNT = sizeof(HEAP_MAGAZINE_CLASSES) / sizeof(size_t);
+
+	/*	Per-CPU cache of small heap objects.
+	 *
+	 * 	Every size class has a magazine of free objects that were previously
+	 * 	allocated from the shared heap. Small hmalloc/hfree calls are served
+	 * 	from the magazines with interrupts disabled and without taking the
+	 * 	heap lock. The shared heap is only touched on a magazine miss, or
+	 * 	when a magazine overflows, in batches.
+	 */
+	struct HeapCache {
+		struct Magazine {
+			void* objects[CONFIG_CORE_MEM_HEAP_MAGAZINE_SIZE] {};
+			size_t count {};
+		};
+
+		Magazine magazines[HEAP_MAGAZINE_CLASS_COUNT] {};
+		//  Statistics
+		size_t hits {};
+		size_t misses {};
+	};
+
+	/*	Statistics of the shared kernel heap.
+	 */
+	struct HeapStats {
+		size_t arena_count;
+		size_t arena_bytes;
+		size_t large_allocations;
+		size_t large_bytes;
+	};
+
+	/*	Heap accounting statistics of a single allocation callsite.
+	 */
+	struct HeapSiteStats {
+		//  Return address of the hmalloc call, nullptr for callsites that did not fit in the table
+		void* site;
+		size_t live_bytes;
+		size_t live_count;
+		size_t peak_bytes;
+		size_t allocations;
+		size_t frees;
+	};
+
 	/*	Allocate memory on the kernel heap.
 	 *
 	 * 	This is functionally equivalent to malloc. You can use this to
@@ -12,15 +80,50 @@ namespace core::mem {
 	 * 	allocated using hmalloc must be deallocated after use by calling
 	 * 	hfree.
 	 *
-	 * 	Note that the global kernel heap is currently limited to a size
-	 *  specified by HEAP_DEFAULT_SIZE.
+	 * 	The heap is made of arenas of HEAP_DEFAULT_SIZE bytes, which are
+	 * 	allocated on demand using vmalloc. One empty arena is kept on every
+	 * 	NUMA node, further empty arenas are released. Requests above
+	 * 	CONFIG_CORE_MEM_HEAP_LARGE_THRESHOLD are not placed in the arenas,
+	 * 	and instead get their own page-granular vmalloc region, which keeps
+	 * 	big buffers from fragmenting the small-object arenas.
 	 */
 	void* hmalloc(size_t n);
 
+	/*	Allocate memory on the kernel heap, local to the given NUMA node.
+	 *
+	 * 	Arenas are local to the node they were created for, and hmalloc
+	 * 	allocates from the arenas of the current CPU's node. Use this for
+	 * 	data that is mostly accessed by CPUs of another node. `node` may be
+	 * 	NUMA_NODE_LOCAL. The memory must be freed using hfree.
+	 */
+	void* hmalloc_node(size_t n, uint32 node);
+
+	/*	Allocate memory on the kernel heap, charging it to the given callsite.
+	 *
+	 * 	Heap accounting charges hmalloc calls to their return address. Allocation
+	 * 	wrappers shared by many users (like the LibGeneric container allocator)
+	 * 	use this to pass on the address of their own caller instead. `site` is
+	 * 	ignored when built without CONFIG_CORE_MEM_HEAP_ACCOUNTING.
+	 */
+	void* hmalloc_at(size_t n, uint32 node, void* site);
+
 	/*	Free memory previously allocated using hmalloc.
+	 *
+	 * 	Objects allocated from an ObjectCache can also be freed using hfree,
+	 * 	which allows placing them in containers that free using the heap.
 	 */
 	void hfree(void*);
 
+	[[nodiscard]] HeapStats heap_stats();
+
+	/*	Get the callsites with the most live heap bytes.
+	 *
+	 * 	Fills `out` with at most `count` callsites, sorted by live bytes in
+	 * 	descending order, and returns the number of entries written. Always
+	 * 	returns 0 when built without CONFIG_CORE_MEM_HEAP_ACCOUNTING.
+	 */
+	size_t heap_accounting_top(HeapSiteStats* out, size_t count);
+
 	/*  Allocate an object of type T using hmalloc and construct it.
 	 *  The object is constructed in-place by forwarding the arguments
 	 *  passed in the call to this function.
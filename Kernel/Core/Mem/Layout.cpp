@@ -32,8 +32,8 @@ static inline bool segments_intersect_end_exclusive(void* x1, void* x2, void* y1
 	return x2 > y1 && y2 > x1;
 }
 
-static bool create_new_region(void* start, size_t len, core::mem::RegionType type) {
-	if(s_region_count >= sizeof(s_regions)) {
+static bool create_new_region(void* start, size_t len, core::mem::RegionType type, uint32 node = 0) {
+	if(s_region_count >= CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS) {
 		return false;
 	}
 
@@ -41,6 +41,7 @@ static bool create_new_region(void* start, size_t len, core::mem::RegionType typ
 	data.region.start = start;
 	data.region.len = len;
 	data.region.type = type;
+	data.region.node = node;
 	data.old_type = type;
 	s_regions[s_region_count++] = data;
 
@@ -79,6 +80,10 @@ static void combine_adjacent_equivalent_regions() {
 		if(curr.region.type != next.region.type) {
 			continue;
 		}
+		//  Regions local to different nodes are kept apart
+		if(curr.region.node != next.region.node) {
+			continue;
+		}
 
 		//  The regions are equivalent - we can merge them together
 		curr.region.len += next.region.len;
@@ -148,7 +153,7 @@ static bool split_and_create_region(void* start, size_t len, core::mem::RegionTy
 		//  Has left hole
 		if(left_len > 0) {
 			//  Create a region for <existing.start,new.start) of existing.type
-			if(!create_new_region(existing.region.start, left_len, existing.region.type)) {
+			if(!create_new_region(existing.region.start, left_len, existing.region.type, existing.region.node)) {
 				return false;
 			}
 		}
@@ -156,7 +161,7 @@ static bool split_and_create_region(void* start, size_t len, core::mem::RegionTy
 		//  Has right hole
 		if(right_len > 0) {
 			//  Create a region for <new.end,existing.end) of existing.type
-			if(!create_new_region(end, right_len, existing.region.type)) {
+			if(!create_new_region(end, right_len, existing.region.type, existing.region.node)) {
 				//  Clean up after left_len creation if we fail here to provide "atomicity"
 				//  We haven't sorted the regions yet, so we simply need to decrement the count
 				//  to get rid of the one we've just created.
@@ -309,3 +314,42 @@ core::Error core::mem::create(void* start, size_t len, RegionType type) {
 
 	return Error::Ok;
 }
+
+core::Error core::mem::set_node(void* start, size_t len, uint32 node) {
+	gen::LockGuard lg { s_lock };
+
+	void* end = static_cast<char*>(start) + len;
+	auto error = Error::Ok;
+	//  Regions created while splitting are appended and never overlap the range, so they're skipped
+	for(size_t current = 0; current < s_region_count; ++current) {
+		auto& existing = s_regions[current];
+		void* lo = start > existing.region.start ? start : existing.region.start;
+		void* hi = end < existing.region.end() ? end : existing.region.end();
+		if(lo >= hi || existing.region.node == node) {
+			continue;
+		}
+
+		//  Keep the parts outside of the range local to the node they were on
+		const auto left_len = static_cast<char*>(lo) - static_cast<char*>(existing.region.start);
+		const auto right_len = static_cast<char*>(existing.region.end()) - static_cast<char*>(hi);
+		if(left_len > 0 && !create_new_region(existing.region.start, left_len, existing.region.type,
+		                                      existing.region.node)) {
+			error = Error::NoMem;
+			break;
+		}
+		if(right_len > 0 &&
+		   !create_new_region(hi, right_len, existing.region.type, existing.region.node)) {
+			if(left_len > 0) {
+				s_region_count--;
+			}
+			error = Error::NoMem;
+			break;
+		}
+		existing.region.start = lo;
+		existing.region.len = static_cast<char*>(hi) - static_cast<char*>(lo);
+		existing.region.node = node;
+	}
+
+	on_region_change();
+	return error;
+}
@@ -5,7 +5,7 @@
 
 //  How many unique physical memory regions can be handled,
 //  regardless of if they're used or not.
-#define CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS (32)
+#define CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS (64)
 
 /*  core::mem physical memory layout management.
  *
@@ -39,6 +39,8 @@ namespace core::mem {
 		void* start;
 		size_t len;
 		RegionType type;
+		//  NUMA node the memory is local to, 0 until the platform reports the topology
+		uint32 node;
 
 		[[nodiscard]] constexpr void* end() const { return static_cast<char*>(start) + len; }
 	};
@@ -100,4 +102,12 @@ namespace core::mem {
 	 *  existing regions, the process will fail.
 	 */
 	core::Error create(void* start, size_t len, RegionType);
+
+	/*  Tag a range of physical memory with the NUMA node it is local to.
+	 *
+	 *  Regions overlapping the range are split at its boundaries, keeping their type,
+	 *  so that every region is local to a single node. Holes within the range are
+	 *  ignored. This is used by platform code once the memory topology is known.
+	 */
+	core::Error set_node(void* start, size_t len, uint32 node);
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include <Core/Error/Error.hpp>
+#include <Core/Log/Logger.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <Core/Mem/NUMA.hpp>
+#ifdef ARCH_IS_x86_64
+#	include <Core/MP/MP.hpp>
+#endif
+#include <SystemTypes.hpp>
+
+CREATE_LOGGER("core::mem::numa", core::log::LogLevel::Debug);
+
+//  The topology is set once during boot. The node count is published last,
+//  so readers never see fallback orders that were not computed yet.
+static constinit size_t s_node_count { 1 };
+static constinit uint8 s_distances[CONFIG_CORE_MEM_NUMA_MAX_NODES][CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+static constinit uint32 s_fallback[CONFIG_CORE_MEM_NUMA_MAX_NODES][CONFIG_CORE_MEM_NUMA_MAX_NODES] {};
+
+core::Error core::mem::numa_init(size_t node_count, uint8 const* distances) {
+	if(node_count == 0 || node_count > CONFIG_CORE_MEM_NUMA_MAX_NODES) {
+		return core::Error::InvalidArgument;
+	}
+	if(__atomic_load_n(&s_node_count, __ATOMIC_ACQUIRE) > 1) {
+		return core::Error::EntityAlreadyExists;
+	}
+
+	for(size_t from = 0; from < node_count; ++from) {
+		for(size_t to = 0; to < node_count; ++to) {
+			uint8 distance = from == to ? NUMA_DISTANCE_LOCAL : NUMA_DISTANCE_REMOTE;
+			//  Firmware may report bogus distances, the local node must always come first
+			if(distances && (from == to || distances[from * node_count + to] > NUMA_DISTANCE_LOCAL)) {
+				distance = distances[from * node_count + to];
+			}
+			s_distances[from][to] = distance;
+		}
+	}
+
+	//  Sort the nodes by distance, ties are broken by the node ID
+	for(size_t node = 0; node < node_count; ++node) {
+		auto* order = s_fallback[node];
+		for(size_t i = 0; i < node_count; ++i) {
+			order[i] = i;
+		}
+		for(size_t i = 1; i < node_count; ++i) {
+			for(size_t j = i; j > 0 && s_distances[node][order[j - 1]] > s_distances[node][order[j]]; --j) {
+				const auto temp = order[j];
+				order[j] = order[j - 1];
+				order[j - 1] = temp;
+			}
+		}
+		//  The node itself always has the lowest distance, but may tie with another one
+		for(size_t i = 1; i < node_count && order[0] != node; ++i) {
+			if(order[i] == node) {
+				order[i] = order[0];
+				order[0] = node;
+			}
+		}
+	}
+
+	__atomic_store_n(&s_node_count, node_count, __ATOMIC_RELEASE);
+	::log.info("{} NUMA node(s) online", node_count);
+	core::mem::update_zone_nodes();
+	return core::Error::Ok;
+}
+
+size_t core::mem::numa_node_count() {
+	return __atomic_load_n(&s_node_count, __ATOMIC_ACQUIRE);
+}
+
+uint8 core::mem::numa_distance(uint32 from, uint32 to) {
+	const auto count = numa_node_count();
+	if(count == 1 || from >= count || to >= count) {
+		return from == to ? NUMA_DISTANCE_LOCAL : NUMA_DISTANCE_REMOTE;
+	}
+	return s_distances[from][to];
+}
+
+uint32 const* core::mem::numa_fallback_order(uint32 node) {
+	return s_fallback[numa_resolve_node(node)];
+}
+
+uint32 core::mem::numa_current_node() {
+#ifdef ARCH_IS_x86_64
+	if(!core::mp::is_environment_available()) {
+		return 0;
+	}
+	const auto node = this_cpu()->numa_node;
+	return node < numa_node_count() ? node : 0;
+#else
+	return 0;
+#endif
+}
+
+uint32 core::mem::numa_resolve_node(uint32 node) {
+	if(node == NUMA_NODE_LOCAL) {
+		return numa_current_node();
+	}
+	return node < numa_node_count() ? node : 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+#include <Core/Error/Error.hpp>
+#include <SystemTypes.hpp>
+
+/* Maximum number of NUMA nodes the physical memory can be split into */
+#define CONFIG_CORE_MEM_NUMA_MAX_NODES (8)
+
+/*	core::mem - NUMA topology
+ *
+ * 	CPUs and physical memory are grouped into nodes, and memory is faster to
+ * 	access from CPUs of the node it is local to. Until the platform reports
+ * 	the topology, the whole machine is treated as a single node 0.
+ *
+ * 	Distances between nodes follow the ACPI SLIT convention, where accessing
+ * 	memory of the local node has a distance of 10, and remote nodes are
+ * 	relative to that.
+ */
+namespace core::mem {
+	//  Requests placement on the node of the CPU making the allocation
+	static constexpr uint32 NUMA_NODE_LOCAL = 0xFFFFFFFF;
+	static constexpr uint8 NUMA_DISTANCE_LOCAL = 10;
+	static constexpr uint8 NUMA_DISTANCE_REMOTE = 20;
+
+	/*	Report the NUMA topology of the machine.
+	 *
+	 * 	This is called once by platform code, after physical memory was tagged
+	 * 	with nodes using core::mem::set_node. `distances` is a row-major matrix
+	 * 	of `node_count` x `node_count` entries, or nullptr if the platform does
+	 * 	not know them, in which case all remote nodes are equally far away.
+	 * 	The allocation fallback order of every node is computed from the
+	 * 	distances, and GFP zones are moved onto the nodes they are local to.
+	 */
+	core::Error numa_init(size_t node_count, uint8 const* distances);
+
+	/*	Get the number of NUMA nodes, which is 1 before the topology is known.
+	 */
+	[[nodiscard]] size_t numa_node_count();
+
+	/*	Get the distance between two nodes.
+	 */
+	[[nodiscard]] uint8 numa_distance(uint32 from, uint32 to);
+
+	/*	Get the order in which nodes should be tried when allocating memory
+	 * 	for the given node. The list has numa_node_count() entries, the first
+	 * 	one being the node itself, followed by the others by ascending distance.
+	 */
+	[[nodiscard]] uint32 const* numa_fallback_order(uint32 node);
+
+	/*	Get the node of the current CPU.
+	 */
+	[[nodiscard]] uint32 numa_current_node();
+
+	/*	Resolve NUMA_NODE_LOCAL to the node of the current CPU. Nodes that
+	 * 	don't exist are treated as node 0.
+	 */
+	[[nodiscard]] uint32 numa_resolve_node(uint32 node);
+}
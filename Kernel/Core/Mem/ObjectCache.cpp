@@ -0,0 +1,298 @@
+#include <Arch/VM.hpp>
+#include <Core/Assert/Assert.hpp>
+#include <Core/IRQ/InterruptDisabler.hpp>
+#include <Core/Log/Logger.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <Core/Mem/ObjectCache.hpp>
+#include <Core/Mem/Shrinker.hpp>
+#include <LibAllocator/Arena.hpp>
+#include <LibFormat/Formatters/Pointer.hpp>
+#include <LibGeneric/LockGuard.hpp>
+#include <LibGeneric/Spinlock.hpp>
+
+CREATE_LOGGER("core::mem::objcache", core::log::LogLevel::Debug);
+
+//  Size of a single slab, slabs are always aligned to this size
+static constexpr const size_t slab_size = core::mem::order_to_size(CONFIG_CORE_MEM_OBJCACHE_SLAB_ORDER);
+//  Magic value stored in every slab descriptor, used for validating frees
+static constexpr const uint64 slab_magic = 0x51AB51AB0B7EC7ED;
+
+//  List of all registered caches
+static constinit core::mem::ObjectCache* s_caches {};
+//  Protects the cache list
+static constinit gen::Spinlock s_caches_lock {};
+//  Releases empty slabs of all caches under memory pressure
+static constinit core::mem::Shrinker s_shrinker {
+	.name = "ObjectCache",
+	.count = &core::mem::ObjectCache::reclaimable_pages,
+	.scan = &core::mem::ObjectCache::try_shrink_all,
+};
+static constinit bool s_shrinker_registered {};
+
+void* core::mem::ObjectCache::allocate() {
+	if(!__atomic_load_n(&m_registered, __ATOMIC_ACQUIRE)) {
+		register_cache();
+	}
+
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { m_lock };
+
+	//  Prefer partially used slabs to keep empty ones reclaimable
+	auto* slab = m_partial;
+	if(!slab) {
+		slab = m_empty;
+		if(slab) {
+			list_remove(m_empty, slab);
+			--m_empty_count;
+			list_push(m_partial, slab);
+		}
+	}
+	if(!slab) {
+		slab = grow();
+		if(!slab) {
+			return nullptr;
+		}
+		list_push(m_partial, slab);
+	}
+
+	auto* ptr = slab->allocator.allocate();
+	ENSURE(ptr != nullptr);
+	++slab->in_use;
+	++m_objects_in_use;
+	++m_allocations;
+
+	if(slab->in_use == slab->allocator.pool_capacity()) {
+		list_remove(m_partial, slab);
+		list_push(m_full, slab);
+	}
+	return ptr;
+}
+
+void core::mem::ObjectCache::free(void* ptr) {
+	if(!ptr) {
+		return;
+	}
+
+	auto* slab = slab_for(ptr);
+	if(slab->magic != slab_magic || slab->cache != this) {
+		::log.fatal("Free of pointer {x} that does not belong to cache '{}'!", Format::ptr(ptr), m_name);
+		ENSURE_NOT_REACHED();
+	}
+
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { m_lock };
+
+	const bool was_full = slab->in_use == slab->allocator.pool_capacity();
+	slab->allocator.free(ptr);
+	--slab->in_use;
+	--m_objects_in_use;
+	++m_frees;
+
+	if(was_full) {
+		list_remove(m_full, slab);
+		list_push(m_partial, slab);
+	}
+	if(slab->in_use == 0) {
+		list_remove(m_partial, slab);
+		if(m_empty_count >= CONFIG_CORE_MEM_OBJCACHE_MAX_EMPTY_SLABS) {
+			release(slab);
+		} else {
+			list_push(m_empty, slab);
+			++m_empty_count;
+		}
+	}
+}
+
+size_t core::mem::ObjectCache::shrink() {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { m_lock };
+	return release_empty(static_cast<size_t>(-1));
+}
+
+core::mem::ObjectCache::Stats core::mem::ObjectCache::stats() {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { m_lock };
+	return Stats {
+		.name = m_name,
+		.object_size = m_object_size,
+		.slab_count = m_slab_count,
+		.objects_total = m_objects_total,
+		.objects_in_use = m_objects_in_use,
+		.allocations = m_allocations,
+		.frees = m_frees,
+	};
+}
+
+void core::mem::ObjectCache::free_object(void* ptr) {
+	if(!ptr) {
+		return;
+	}
+	auto* slab = slab_for(ptr);
+	if(slab->magic != slab_magic) {
+		::log.fatal("Free of pointer {x} that does not belong to any object cache!", Format::ptr(ptr));
+		ENSURE_NOT_REACHED();
+	}
+	slab->cache->free(ptr);
+}
+
+bool core::mem::ObjectCache::is_object_pointer(void* ptr) {
+	auto* const identity_start = reinterpret_cast<uint8*>(KERNEL_VM_IDENTITY_BASE);
+	return ptr >= identity_start && ptr < identity_start + KERNEL_VM_IDENTITY_LEN;
+}
+
+size_t core::mem::ObjectCache::shrink_all() {
+	size_t pages = 0;
+	for_each_cache([&pages](ObjectCache& cache) { pages += cache.shrink(); });
+	return pages;
+}
+
+size_t core::mem::ObjectCache::try_shrink_all(size_t target) {
+	core::irq::InterruptDisabler id {};
+	if(!s_caches_lock.try_lock()) {
+		return 0;
+	}
+	size_t pages = 0;
+	for(auto* cache = s_caches; cache && pages < target; cache = cache->m_next_cache) {
+		if(!cache->m_lock.try_lock()) {
+			continue;
+		}
+		pages += cache->release_empty(target - pages);
+		cache->m_lock.unlock();
+	}
+	s_caches_lock.unlock();
+	return pages;
+}
+
+size_t core::mem::ObjectCache::reclaimable_pages() {
+	core::irq::InterruptDisabler id {};
+	if(!s_caches_lock.try_lock()) {
+		return 0;
+	}
+	//  Only an estimate, the counts are read without taking the cache locks
+	size_t pages = 0;
+	for(auto* cache = s_caches; cache; cache = cache->m_next_cache) {
+		pages += __atomic_load_n(&cache->m_empty_count, __ATOMIC_RELAXED) << CONFIG_CORE_MEM_OBJCACHE_SLAB_ORDER;
+	}
+	s_caches_lock.unlock();
+	return pages;
+}
+
+void core::mem::ObjectCache::for_each_cache(KFunction<void(ObjectCache&)> callback) {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_caches_lock };
+	for(auto* cache = s_caches; cache; cache = cache->m_next_cache) {
+		callback(*cache);
+	}
+}
+
+/*	Create a new slab for this cache. Must be called with the cache lock held.
+ */
+core::mem::ObjectCache::Slab* core::mem::ObjectCache::grow() {
+	//  Slabs can't be assembled from smaller blocks
+	auto maybe_block =
+	        core::mem::allocate_pages(CONFIG_CORE_MEM_OBJCACHE_SLAB_ORDER, core::mem::PageAllocFlags::Contiguous);
+	if(!maybe_block) {
+		return nullptr;
+	}
+	auto block = maybe_block.destructively_move_data();
+
+	auto* base = reinterpret_cast<uint8*>(idmap(block.base));
+	auto* slab = new(base) Slab {
+		.magic = slab_magic,
+		.cache = this,
+		.next = nullptr,
+		.prev = nullptr,
+		.in_use = 0,
+		.allocation = block,
+		.allocator = liballoc::SlabAllocator {
+                                                     liballoc::Arena { base + sizeof(Slab), slab_size - sizeof(Slab) },
+                                                     m_object_size },
+	};
+	const auto capacity = slab->allocator.pool_capacity();
+	if(capacity == 0) {
+		::log.error("Object size {} of cache '{}' is too large for a slab", m_object_size, m_name);
+		core::mem::free_pages(block);
+		return nullptr;
+	}
+
+	if(m_constructor) {
+		auto* pool = reinterpret_cast<uint8*>(slab->allocator.pool_start());
+		for(size_t i = 0; i < capacity; ++i) {
+			m_constructor(pool + i * m_object_size);
+		}
+	}
+
+	++m_slab_count;
+	m_objects_total += capacity;
+	return slab;
+}
+
+/*	Add this cache to the global cache list. Must be called without the cache lock held,
+ * 	as the cache list lock is always taken before the locks of the caches on it.
+ */
+void core::mem::ObjectCache::register_cache() {
+	{
+		core::irq::InterruptDisabler id {};
+		gen::LockGuard lg { s_caches_lock };
+		if(m_registered) {
+			return;
+		}
+		m_next_cache = s_caches;
+		s_caches = this;
+		__atomic_store_n(&m_registered, true, __ATOMIC_RELEASE);
+	}
+	//  Not done under the cache list lock, which reclaim takes after the shrinker registry lock
+	if(!__atomic_exchange_n(&s_shrinker_registered, true, __ATOMIC_ACQ_REL)) {
+		core::mem::register_shrinker(s_shrinker);
+	}
+}
+
+/*	Return a slab that is not on any list to GFP. Must be called with the cache lock held.
+ */
+void core::mem::ObjectCache::release(Slab* slab) {
+	--m_slab_count;
+	m_objects_total -= slab->allocator.pool_capacity();
+	slab->magic = 0;
+	core::mem::free_pages(slab->allocation);
+}
+
+/*	Return empty slabs to GFP until at least `target` pages are released.
+ * 	Must be called with the cache lock held. Returns the number of pages released.
+ */
+size_t core::mem::ObjectCache::release_empty(size_t target) {
+	size_t pages = 0;
+	while(m_empty && pages < target) {
+		auto* slab = m_empty;
+		list_remove(m_empty, slab);
+		--m_empty_count;
+		pages += 1ul << slab->allocation.order;
+		release(slab);
+	}
+	return pages;
+}
+
+core::mem::ObjectCache::Slab* core::mem::ObjectCache::slab_for(void* ptr) {
+	return reinterpret_cast<Slab*>(reinterpret_cast<uintptr_t>(ptr) & ~(slab_size - 1));
+}
+
+void core::mem::ObjectCache::list_push(Slab*& head, Slab* slab) {
+	slab->prev = nullptr;
+	slab->next = head;
+	if(head) {
+		head->prev = slab;
+	}
+	head = slab;
+}
+
+void core::mem::ObjectCache::list_remove(Slab*& head, Slab* slab) {
+	if(slab->prev) {
+		slab->prev->next = slab->next;
+	} else {
+		head = slab->next;
+	}
+	if(slab->next) {
+		slab->next->prev = slab->prev;
+	}
+	slab->next = nullptr;
+	slab->prev = nullptr;
+}
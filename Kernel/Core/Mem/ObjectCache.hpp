@@ -0,0 +1,148 @@
+#pragma once
+#include <Core/Mem/GFP.hpp>
+#include <LibAllocator/SlabAllocator.hpp>
+#include <LibGeneric/Memory.hpp>
+#include <LibGeneric/Spinlock.hpp>
+#include <Structs/KFunction.hpp>
+#include <SystemTypes.hpp>
+
+/* Order of the GFP blocks used as slabs for all object caches */
+#define CONFIG_CORE_MEM_OBJCACHE_SLAB_ORDER (2)
+/* Number of empty slabs a cache keeps around before returning them to GFP */
+#define CONFIG_CORE_MEM_OBJCACHE_MAX_EMPTY_SLABS (1)
+
+namespace core::mem {
+	/*	Cache of fixed-size objects of a single type.
+	 *
+	 * 	Objects are allocated from slabs, which are blocks of physical memory
+	 * 	taken from GFP and accessed via the identity map. Each slab starts with
+	 * 	a descriptor, and all slabs are aligned to their size, which allows
+	 * 	finding the slab (and the cache) that owns an object from the object
+	 * 	pointer alone. Slabs are kept on partial, full and empty lists, and
+	 * 	empty slabs are returned to GFP when there are too many of them, or
+	 * 	when the cache is explicitly shrunk.
+	 *
+	 * 	If a constructor is given, it is called once for every object when
+	 * 	the slab containing it is created. Objects must be returned to the
+	 * 	cache in their constructed state.
+	 *
+	 * 	Caches are meant to be statically allocated, and are registered in the
+	 * 	global cache list the first time an object is allocated from them.
+	 */
+	class ObjectCache {
+	public:
+		using Constructor = void (*)(void*);
+
+		static constexpr const size_t cache_line_alignment = 64;
+
+		struct Stats {
+			const char* name;
+			size_t object_size;
+			size_t slab_count;
+			size_t objects_total;
+			size_t objects_in_use;
+			size_t allocations;
+			size_t frees;
+		};
+
+		constexpr ObjectCache(const char* name, size_t size, size_t alignment = 16,
+		                      Constructor constructor = nullptr)
+		    : m_name(name)
+		    , m_object_size(round_up(size < sizeof(void*) ? sizeof(void*) : size, alignment))
+		    , m_constructor(constructor) {}
+
+		ObjectCache(ObjectCache const&) = delete;
+		ObjectCache(ObjectCache&&) = delete;
+
+		void* allocate();
+		void free(void*);
+
+		/*	Return all empty slabs to GFP. Returns the number of pages released.
+		 */
+		size_t shrink();
+
+		[[nodiscard]] Stats stats();
+
+		[[nodiscard]] constexpr const char* name() const { return m_name; }
+
+		[[nodiscard]] constexpr size_t object_size() const { return m_object_size; }
+
+		/*	Free an object allocated from any object cache.
+		 * 	The owning cache is found using the slab descriptor.
+		 */
+		static void free_object(void*);
+
+		/*	Check whether the pointer could have been allocated from an object cache.
+		 */
+		static bool is_object_pointer(void*);
+
+		/*	Shrink all registered caches. Returns the number of pages released.
+		 */
+		static size_t shrink_all();
+
+		/*	Shrink registered caches until at least `target` pages are released.
+		 * 	Caches that are currently locked are skipped, which makes this safe
+		 * 	to use for reclaiming memory on behalf of a cache that is growing.
+		 * 	Returns the number of pages released.
+		 */
+		static size_t try_shrink_all(size_t target);
+
+		/*	Get the number of pages held in empty slabs of all registered caches.
+		 */
+		static size_t reclaimable_pages();
+
+		static void for_each_cache(KFunction<void(ObjectCache&)>);
+	private:
+		struct Slab {
+			uint64 magic;
+			ObjectCache* cache;
+			Slab* next;
+			Slab* prev;
+			size_t in_use;
+			PageAllocation allocation;
+			liballoc::SlabAllocator allocator;
+		};
+
+		static constexpr size_t round_up(size_t v, size_t alignment) { return (v + alignment - 1) & ~(alignment - 1); }
+
+		const char* m_name;
+		size_t m_object_size;
+		Constructor m_constructor;
+
+		Slab* m_partial {};
+		Slab* m_full {};
+		Slab* m_empty {};
+		size_t m_empty_count {};
+		size_t m_slab_count {};
+		size_t m_objects_total {};
+		size_t m_objects_in_use {};
+		size_t m_allocations {};
+		size_t m_frees {};
+
+		ObjectCache* m_next_cache {};
+		bool m_registered {};
+		gen::Spinlock m_lock {};
+
+		Slab* grow();
+		void register_cache();
+		void release(Slab*);
+		size_t release_empty(size_t target);
+		static Slab* slab_for(void*);
+		static void list_push(Slab*& head, Slab*);
+		static void list_remove(Slab*& head, Slab*);
+	};
+
+	/*  Allocate an object of type T from the given cache and construct it.
+	 *  The object is constructed in-place by forwarding the arguments
+	 *  passed in the call to this function.
+	 */
+	template<class T, class... Args>
+	static inline T* make_in(ObjectCache& cache, Args&&... args) {
+		auto* storage = cache.allocate();
+		if(!storage) {
+			return nullptr;
+		}
+		auto* obj = reinterpret_cast<T*>(storage);
+		return gen::construct_at(obj, gen::forward<Args>(args)...);
+	}
+}
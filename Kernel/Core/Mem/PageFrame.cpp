@@ -0,0 +1,127 @@
+#include <Arch/VM.hpp>
+#include <Core/Error/Error.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <Core/Mem/Layout.hpp>
+#include <Core/Mem/PageFrame.hpp>
+#include <SystemTypes.hpp>
+
+//  The database is created once at boot and never changes afterwards
+static constinit core::mem::PageFrame* s_frames {};
+static constinit uint64 s_base_pfn {};
+static constinit size_t s_frame_count {};
+
+core::Error core::mem::page_frames_create(uint64 base_pfn, size_t count) {
+	if(s_frames) {
+		return core::Error::EntityAlreadyExists;
+	}
+
+	void* pstart;
+	const auto length = (count * sizeof(PageFrame) + 0xFFF) & ~0xFFFul;
+	const auto maybe_handle = core::mem::request(length, 0x1000, core::mem::RegionType::Allocator, pstart);
+	if(maybe_handle.has_error()) {
+		return core::Error::NoMem;
+	}
+
+	//  LEAK: The database lives for as long as the kernel does
+	auto* frames = static_cast<PageFrame*>(idmap(pstart));
+	for(size_t i = 0; i < count; ++i) {
+		frames[i] = PageFrame {
+			.refcount = 0,
+			.order = 0,
+			.zone = 0,
+			.flags = PageFrameFlags::Reserved,
+			._unused = 0,
+			.next = PAGE_FRAME_NONE,
+			.prev = PAGE_FRAME_NONE,
+		};
+	}
+	s_base_pfn = base_pfn;
+	s_frame_count = count;
+	s_frames = frames;
+	return core::Error::Ok;
+}
+
+core::mem::PageFrame* core::mem::page_frame(void* page) {
+	const auto pfn = reinterpret_cast<uintptr_t>(page) >> 12u;
+	if(pfn < s_base_pfn || pfn - s_base_pfn >= s_frame_count) {
+		return nullptr;
+	}
+	return &s_frames[pfn - s_base_pfn];
+}
+
+core::mem::PageFrame* core::mem::page_frame_at(uint32 index) {
+	return &s_frames[index];
+}
+
+uint32 core::mem::page_frame_index(PageFrame const* frame) {
+	return static_cast<uint32>(frame - s_frames);
+}
+
+void* core::mem::page_frame_address(uint32 index) {
+	return reinterpret_cast<void*>((s_base_pfn + index) << 12u);
+}
+
+//  Get the entry of a page given out by GFP, or nullptr if GFP does not manage the page
+static core::mem::PageFrame* managed_frame(void* page) {
+	auto* frame = core::mem::page_frame(page);
+	if(!frame || (frame->flags & core::mem::PageFrameFlags::Reserved)) {
+		return nullptr;
+	}
+	return frame;
+}
+
+core::Error core::mem::page_ref(void* page) {
+	auto* frame = managed_frame(page);
+	if(!frame) {
+		return core::Error::NoMem;
+	}
+	__atomic_add_fetch(&frame->refcount, 1, __ATOMIC_RELAXED);
+	return core::Error::Ok;
+}
+
+bool core::mem::page_unref(void* page) {
+	auto* frame = managed_frame(page);
+	//  GFP does not own the page, it must never be freed to it
+	if(!frame) {
+		return false;
+	}
+	return __atomic_sub_fetch(&frame->refcount, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+size_t core::mem::page_refcount(void* page) {
+	auto* frame = managed_frame(page);
+	if(!frame) {
+		return 1;
+	}
+	return __atomic_load_n(&frame->refcount, __ATOMIC_ACQUIRE);
+}
+
+//  Free a run of pages, as the largest naturally aligned blocks that cover it
+static void free_run(uint8* start, size_t count, core::mem::PageAllocFlags flags) {
+	while(count > 0) {
+		const auto pfn = reinterpret_cast<uintptr_t>(start) >> 12u;
+		size_t order = 0;
+		while(order < CONFIG_CORE_MEM_GFP_MAX_ORDER && !(pfn & (1ul << order)) && (2ul << order) <= count) {
+			++order;
+		}
+		core::mem::free_pages(core::mem::PageAllocation { .base = start, .order = order, .flags = flags });
+		start += core::mem::order_to_size(order);
+		count -= 1ul << order;
+	}
+}
+
+void core::mem::put_pages(core::mem::PageAllocation allocation) {
+	//  Pages that lost their last reference are freed in runs, so that a block
+	//  that is not shared at all goes back to GFP as a whole
+	auto* base = static_cast<uint8*>(allocation.base);
+	size_t run = 0;
+	for(size_t i = 0; i < (1ul << allocation.order); ++i) {
+		if(page_unref(base + i * 0x1000)) {
+			++run;
+			continue;
+		}
+		free_run(base + (i - run) * 0x1000, run, allocation.flags);
+		run = 0;
+	}
+	free_run(base + ((1ul << allocation.order) - run) * 0x1000, run, allocation.flags);
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <Core/Error/Error.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <LibGeneric/BitFlags.hpp>
+#include <SystemTypes.hpp>
+
+/*	core::mem - page frame database
+ *
+ * 	Every physical page between the lowest and highest Usable address has an
+ * 	entry in a flat array, indexed by its page frame number. The array is
+ * 	created by GFP at boot, when all Usable memory is claimed.
+ *
+ * 	Every page given out by GFP starts with a single reference held by its
+ * 	owner, which is responsible for freeing it. Pages that are mapped in more
+ * 	than one place (for example, after copy-on-write cloning of an address
+ * 	space) get extra references, and must only be freed once the last one
+ * 	is dropped.
+ */
+namespace core::mem {
+	enum class PageFrameFlags : uint8 {
+		None = 0,
+		//  Not managed by GFP (holes, reservations, the kernel image)
+		Reserved = 1u << 0u,
+		//  First page of a block on the GFP free lists
+		Free = 1u << 1u,
+		//  Single free page held by a per-CPU page cache or a pre-zeroed pool
+		Cached = 1u << 2u,
+	};
+	DEFINE_ENUM_BITFLAG_OPS(PageFrameFlags);
+
+	//  Frame index used as the end of GFP free lists
+	static constexpr uint32 PAGE_FRAME_NONE = 0xFFFFFFFF;
+
+	struct PageFrame {
+		//  References to the page, zero for free and reserved pages
+		uint32 refcount;
+		//  Order of the block, valid for the first page of free and allocated blocks
+		uint8 order;
+		//  GFP zone the page belongs to
+		uint8 zone;
+		PageFrameFlags flags;
+		uint8 _unused;
+		//  GFP free list links, valid for the first page of free blocks
+		uint32 next;
+		uint32 prev;
+	};
+	static_assert(sizeof(PageFrame) == 16, "PageFrame should stay small, one exists for every physical page");
+
+	/*	Create the page frame database for `count` pages starting at `base_pfn`.
+	 *
+	 * 	Storage for the database is requested from the physical memory layout,
+	 * 	and all pages start out as Reserved. This is done once by GFP at boot.
+	 */
+	core::Error page_frames_create(uint64 base_pfn, size_t count);
+
+	/*	Get the database entry of the given physical page.
+	 *
+	 * 	Returns nullptr for pages outside of the database.
+	 */
+	[[nodiscard]] PageFrame* page_frame(void* page);
+
+	/*	Get the database entry at the given index, and the reverse.
+	 * 	Indices are only meaningful to GFP, for linking its free lists.
+	 */
+	[[nodiscard]] PageFrame* page_frame_at(uint32 index);
+	[[nodiscard]] uint32 page_frame_index(PageFrame const*);
+	[[nodiscard]] void* page_frame_address(uint32 index);
+
+	/*	Add a reference to the given physical page.
+	 *
+	 * 	Fails with NoMem when the page is not managed by GFP, in which case the
+	 * 	page can't be shared and the caller should make a copy instead.
+	 */
+	[[nodiscard]] core::Error page_ref(void* page);
+
+	/*	Drop a reference to the given physical page.
+	 *
+	 * 	Returns true if the caller held the last reference, in which case
+	 * 	it must free the page. Always returns false for pages that are not
+	 * 	managed by GFP.
+	 */
+	[[nodiscard]] bool page_unref(void* page);
+
+	/*	Get the number of references to the given physical page.
+	 */
+	[[nodiscard]] size_t page_refcount(void* page);
+
+	/*	Drop a reference to every page of the allocation and free the pages
+	 * 	that are no longer referenced anywhere.
+	 */
+	void put_pages(PageAllocation);
+}
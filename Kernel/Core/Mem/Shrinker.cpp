@@ -0,0 +1,98 @@
+#include <Core/IRQ/InterruptDisabler.hpp>
+#include <Core/Mem/Shrinker.hpp>
+#ifdef ARCH_IS_x86_64
+#	include <Core/MP/MP.hpp>
+#endif
+#include <LibGeneric/LockGuard.hpp>
+#include <LibGeneric/Spinlock.hpp>
+#include <SystemTypes.hpp>
+
+//  All registered shrinkers
+static constinit core::mem::Shrinker* s_shrinkers {};
+//  Protects the registry, held with interrupts disabled for the whole duration of a reclaim
+static constinit gen::Spinlock s_lock {};
+//  Node currently reclaiming, used for detecting reclaim recursion
+static constinit void* s_reclaim_owner {};
+//  Background reclaim was requested
+static constinit bool s_reclaim_requested {};
+
+//  Identifies the node running the current code
+static void* reclaim_owner_id() {
+#ifdef ARCH_IS_x86_64
+	if(core::mp::is_environment_available()) {
+		return this_cpu();
+	}
+#endif
+	return &s_reclaim_owner;
+}
+
+void core::mem::register_shrinker(Shrinker& shrinker) {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	auto** link = &s_shrinkers;
+	while(*link) {
+		link = &(*link)->next;
+	}
+	shrinker.next = nullptr;
+	*link = &shrinker;
+}
+
+void core::mem::unregister_shrinker(Shrinker& shrinker) {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	for(auto** link = &s_shrinkers; *link; link = &(*link)->next) {
+		if(*link == &shrinker) {
+			*link = shrinker.next;
+			shrinker.next = nullptr;
+			return;
+		}
+	}
+}
+
+size_t core::mem::shrink_memory(size_t target) {
+	core::irq::InterruptDisabler id {};
+	auto* self = reclaim_owner_id();
+	//  A shrinker on this node tried to allocate memory while reclaiming,
+	//  waiting for the lock would deadlock
+	if(__atomic_load_n(&s_reclaim_owner, __ATOMIC_ACQUIRE) == self) {
+		return 0;
+	}
+
+	gen::LockGuard lg { s_lock };
+	__atomic_store_n(&s_reclaim_owner, self, __ATOMIC_RELEASE);
+	size_t freed = 0;
+	for(auto* shrinker = s_shrinkers; shrinker && freed < target; shrinker = shrinker->next) {
+		const auto pages = shrinker->scan(target - freed);
+		++shrinker->calls;
+		shrinker->freed += pages;
+		freed += pages;
+	}
+	__atomic_store_n(&s_reclaim_owner, nullptr, __ATOMIC_RELEASE);
+	return freed;
+}
+
+size_t core::mem::reclaimable_pages() {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	size_t pages = 0;
+	for(auto* shrinker = s_shrinkers; shrinker; shrinker = shrinker->next) {
+		pages += shrinker->count();
+	}
+	return pages;
+}
+
+void core::mem::request_reclaim() {
+	__atomic_store_n(&s_reclaim_requested, true, __ATOMIC_RELEASE);
+}
+
+bool core::mem::consume_reclaim_request() {
+	return __atomic_exchange_n(&s_reclaim_requested, false, __ATOMIC_ACQ_REL);
+}
+
+void core::mem::for_each_shrinker(KFunction<void(Shrinker const&)> callback) {
+	core::irq::InterruptDisabler id {};
+	gen::LockGuard lg { s_lock };
+	for(auto* shrinker = s_shrinkers; shrinker; shrinker = shrinker->next) {
+		callback(*shrinker);
+	}
+}
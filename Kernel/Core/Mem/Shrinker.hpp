@@ -0,0 +1,63 @@
+#pragma once
+#include <Structs/KFunction.hpp>
+#include <SystemTypes.hpp>
+
+/*	core::mem - memory reclaim
+ *
+ * 	Kernel caches that hold on to memory they don't strictly need register a
+ * 	shrinker, which gives pages back to GFP under memory pressure. Shrinkers
+ * 	are invoked synchronously when an allocation fails, and in the background
+ * 	by the reclaim daemon when GFP falls below its low watermark.
+ *
+ * 	Shrinkers are called with interrupts disabled, and with arbitrary locks
+ * 	of the allocating code held. They must not block or shoot down TLB
+ * 	entries, and must skip (rather than wait for) locks that may be held by
+ * 	the code that triggered the reclaim.
+ */
+namespace core::mem {
+	struct Shrinker {
+		const char* name;
+		//  Get the number of pages that could be freed right now
+		size_t (*count)();
+		//  Free up to `target` pages, returns the number of pages actually freed
+		size_t (*scan)(size_t target);
+
+		//  Statistics
+		size_t calls {};
+		size_t freed {};
+		//  Registry link, managed by register_shrinker
+		Shrinker* next {};
+	};
+
+	/*	Add a shrinker to the registry. Shrinkers are invoked in the order they
+	 * 	were registered in, and are expected to be statically allocated.
+	 * 	Must not be called from within a shrinker.
+	 */
+	void register_shrinker(Shrinker&);
+
+	/*	Remove a shrinker from the registry.
+	 */
+	void unregister_shrinker(Shrinker&);
+
+	/*	Invoke the shrinkers until at least `target` pages were freed, or all
+	 * 	of them were asked once. Returns the number of pages freed.
+	 *
+	 * 	Only one reclaim can run at a time. If the current node is already
+	 * 	reclaiming (an allocation made by a shrinker failed), nothing is done.
+	 */
+	size_t shrink_memory(size_t target);
+
+	/*	Get the number of pages that the shrinkers could free right now.
+	 */
+	[[nodiscard]] size_t reclaimable_pages();
+
+	/*	Ask the reclaim daemon to run as soon as possible.
+	 */
+	void request_reclaim();
+
+	/*	Check and clear a pending background reclaim request.
+	 */
+	[[nodiscard]] bool consume_reclaim_request();
+
+	void for_each_shrinker(KFunction<void(Shrinker const&)>);
+}
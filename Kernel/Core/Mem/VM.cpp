@@ -3,9 +3,9 @@
 #include <Core/Error/Error.hpp>
 #include <Core/Mem/GFP.hpp>
 #include <Core/Mem/Layout.hpp>
+#include <Core/Mem/ObjectCache.hpp>
 #include <Core/Mem/VM.hpp>
-#include <LibAllocator/Arena.hpp>
-#include <LibAllocator/BumpAllocator.hpp>
+#include <LibGeneric/AVLTree.hpp>
 #include <LibGeneric/LockGuard.hpp>
 #include <LibGeneric/Spinlock.hpp>
 #include <SystemTypes.hpp>
@@ -16,39 +16,93 @@ static constinit gen::Spinlock s_lock;
 //  Modifications to the *kernel* part of the paging tables of the below
 //  handle are assumed to be propagated to all children (all running tasks).
 static constinit arch::PagingHandle s_root;
-//  Bump allocator for vmalloc
-//  Currently, no deallocation is possible
-//  WARNING: Due to KERNEL_VM_VMALLOC_* being linker symbols, below cannot be constinit!
-static liballoc::BumpAllocator s_vmalloc {
-	liballoc::Arena { KERNEL_VM_VMALLOC_BASE, KERNEL_VM_VMALLOC_LEN }
+
+/*	Free range of the vmalloc window.
+ *
+ * 	Free ranges are kept in a tree ordered by address, where every node
+ * 	also tracks the largest free range in its subtree. This allows finding
+ * 	the lowest free range that can fit an allocation in logarithmic time,
+ * 	and finding the neighbours of a freed range for coalescing.
+ */
+struct VmFreeRange : gen::AVLNode<VmFreeRange> {
+	uintptr_t base;
+	size_t size;
+	//  Largest free range size in the subtree rooted at this node
+	size_t max_size;
+};
+
+struct VmFreeRangeCompare {
+	static bool less(VmFreeRange const& a, VmFreeRange const& b) { return a.base < b.base; }
+};
+
+struct VmFreeRangeAugment {
+	static void update(VmFreeRange& range) {
+		range.max_size = range.size;
+		if(range.avl_left && range.avl_left->max_size > range.max_size) {
+			range.max_size = range.avl_left->max_size;
+		}
+		if(range.avl_right && range.avl_right->max_size > range.max_size) {
+			range.max_size = range.avl_right->max_size;
+		}
+	}
+};
+
+//  Record of a single vmalloc allocation
+struct VmArea : gen::AVLNode<VmArea> {
+	void* base;
+	size_t size;
+	//  Record for returning the range to the free range tree, allocated up front so that freeing can't fail
+	VmFreeRange* spare;
 };
 
+struct VmAreaCompare {
+	static bool less(VmArea const& a, VmArea const& b) { return a.base < b.base; }
+};
+
+//  Free ranges of the vmalloc window
+static constinit gen::AVLTree<VmFreeRange, VmFreeRangeCompare, VmFreeRangeAugment> s_free_ranges {};
+//  Whether the free range tree was populated with the vmalloc window yet
+static constinit bool s_free_ranges_initialized { false };
+//  Live vmalloc allocations, ordered by address
+static constinit gen::AVLTree<VmArea, VmAreaCompare> s_areas {};
+//  Cache for VmArea records
+static constinit core::mem::ObjectCache s_area_cache { "VmArea", sizeof(VmArea), alignof(VmArea) };
+//  Cache for VmFreeRange records
+static constinit core::mem::ObjectCache s_free_range_cache { "VmFreeRange", sizeof(VmFreeRange),
+	                                                         alignof(VmFreeRange) };
+
 static void vm_map_kernel(arch::PagingHandle handle) {
 	auto* const kernel_elf_start = reinterpret_cast<uint8*>(KERNEL_VM_ELF_BASE);
 	auto* const kernel_elf_end = kernel_elf_start + KERNEL_VM_ELF_LEN;
 	auto* const kernel_text_start = reinterpret_cast<uint8*>(KERNEL_VM_TEXT_BASE);
 	auto* const kernel_text_end = kernel_text_start + KERNEL_VM_TEXT_LEN;
 
-	auto kernel_physical = PhysAddr { KERNEL_PM_LOAD_BASE };
-	for(auto addr = kernel_elf_start; addr < kernel_elf_end; addr += 0x1000) {
-		auto flags = arch::PageFlags::Read | arch::PageFlags::Write;
-		bool in_text_section = (addr >= kernel_text_start && addr < kernel_text_end);
-		if(in_text_section) {
-			flags = flags | arch::PageFlags::Execute;
+	//  Pages partially covered by the text section are executable
+	auto* const text_page_start = reinterpret_cast<uint8*>(reinterpret_cast<uintptr_t>(kernel_text_start) & ~0xFFFul);
+	auto* const text_page_end =
+	        reinterpret_cast<uint8*>((reinterpret_cast<uintptr_t>(kernel_text_end) + 0xFFF) & ~0xFFFul);
+	auto map_part = [handle, kernel_elf_start](uint8* start, uint8* end, arch::PageFlags flags) {
+		if(start >= end) {
+			return;
 		}
-		auto err = arch::addrmap(handle, kernel_physical.get(), addr, flags);
+		auto* physical = reinterpret_cast<uint8*>(KERNEL_PM_LOAD_BASE) + (start - kernel_elf_start);
+		const auto err = arch::addrmap_range(handle, physical, start, end - start, flags);
 		if(err != core::Error::Ok) {
-			core::panic("vm_map_kernel failed: addrmap failed!");
+			core::panic("vm_map_kernel failed: addrmap_range failed!");
 		}
-		kernel_physical += 0x1000;
-	}
+	};
+
+	const auto flags = arch::PageFlags::Read | arch::PageFlags::Write;
+	map_part(kernel_elf_start, text_page_start, flags);
+	map_part(text_page_start, text_page_end, flags | arch::PageFlags::Execute);
+	map_part(text_page_end, kernel_elf_end, flags);
 }
 
 static void* get_physical_end() {
 	void* max = nullptr;
 	core::mem::for_each_region([&max](core::mem::Region region) {
-		if(region.start > max) {
-			max = region.start;
+		if(region.end() > max) {
+			max = region.end();
 		}
 	});
 	return max;
@@ -62,14 +116,12 @@ static void vm_map_identity(arch::PagingHandle handle) {
 		        "vm_map_identity failed: insufficient identity map address space to fit all available physical memory in identity map!");
 	}
 
-	auto physical = PhysAddr { nullptr };
-	for(auto addr = identity_start; addr < identity_start + (uintptr_t)physical_end; addr += 2_MiB) {
-		const auto err = arch::addrmap(handle, physical.get(), addr,
-		                               arch::PageFlags::Read | arch::PageFlags::Write | arch::PageFlags::Large);
-		if(err != core::Error::Ok) {
-			core::panic("vm_map_identity failed: addrmap failed!");
-		}
-		physical += 2_MiB;
+	//  The whole range is aligned, so it is mapped with the largest pages available
+	const auto len = (reinterpret_cast<uintptr_t>(physical_end) + 2_MiB - 1) & ~(2_MiB - 1);
+	const auto err =
+	        arch::addrmap_range(handle, nullptr, identity_start, len, arch::PageFlags::Read | arch::PageFlags::Write);
+	if(err != core::Error::Ok) {
+		core::panic("vm_map_identity failed: addrmap_range failed!");
 	}
 }
 
@@ -89,46 +141,255 @@ static arch::PagingHandle vm_create_root() {
 	return handle;
 }
 
-void* core::mem::vmalloc(size_t size) {
-	gen::LockGuard lg { s_lock };
-	if(!s_root) {
-		s_root = vm_create_root();
-		if(!s_root) {
+//  Find the lowest free range that fits `size` bytes at the given alignment, and carve the allocation out of it.
+static void* vm_range_allocate(size_t size, size_t alignment) {
+	if(!s_free_ranges_initialized) {
+		auto* range = core::mem::make_in<VmFreeRange>(s_free_range_cache);
+		if(!range) {
 			return nullptr;
 		}
+		range->base = reinterpret_cast<uintptr_t>(KERNEL_VM_VMALLOC_BASE);
+		range->size = KERNEL_VM_VMALLOC_LEN;
+		s_free_ranges.insert(range);
+		s_free_ranges_initialized = true;
 	}
 
-	const auto actual_allocation_size = ((size + 0x1000 - 1) / 0x1000) * 0x1000;
-	auto* base = s_vmalloc.allocate(actual_allocation_size);
-	if(!base) {
+	//  Only look for ranges that fit the allocation regardless of where they start,
+	//  so that the subtree maximums can still guide the search
+	const auto needed = size + alignment - 0x1000;
+	auto* range = s_free_ranges.root();
+	if(!range || range->max_size < needed) {
 		return nullptr;
 	}
+	//  Prefer lower addresses, the subtree maximums guarantee that a fitting range exists below
+	while(true) {
+		if(range->avl_left && range->avl_left->max_size >= needed) {
+			range = range->avl_left;
+		} else if(range->size >= needed) {
+			break;
+		} else {
+			range = range->avl_right;
+		}
+	}
 
-	const auto pages = actual_allocation_size / 0x1000;
-	for(size_t i = 0; i < pages; ++i) {
-		auto maybe_page = core::mem::allocate_pages(0, {});
-		if(!maybe_page) {
-			vfree(base);
-			return nullptr;
+	const auto base = (range->base + alignment - 1) & ~(alignment - 1);
+	const auto head = base - range->base;
+	const auto tail = range->size - head - size;
+	if(head == 0) {
+		range->base += size;
+		range->size -= size;
+		if(range->size == 0) {
+			s_free_ranges.remove(range);
+			s_free_range_cache.free(range);
+		} else {
+			s_free_ranges.update(range);
 		}
-		auto page = maybe_page.destructively_move_data();
+		return reinterpret_cast<void*>(base);
+	}
 
-		auto* vptr = reinterpret_cast<uint8*>(base) + i * 0x1000;
-		const auto err = arch::addrmap(s_root, page.base, vptr, arch::PageFlags::Read | arch::PageFlags::Write);
-		if(err != Error::Ok) {
-			vfree(base);
+	//  The allocation is carved out of the middle, the part after it becomes a range of its own
+	VmFreeRange* rest = nullptr;
+	if(tail > 0) {
+		rest = core::mem::make_in<VmFreeRange>(s_free_range_cache);
+		if(!rest) {
 			return nullptr;
 		}
+		rest->base = base + size;
+		rest->size = tail;
+	}
+	range->size = head;
+	s_free_ranges.update(range);
+	if(rest) {
+		s_free_ranges.insert(rest);
+	}
+	return reinterpret_cast<void*>(base);
+}
+
+//  Return a range to the free range tree, merging it with adjacent free ranges.
+//  The spare record is used when the range can't be merged, and freed otherwise.
+static void vm_range_free(void* ptr, size_t size, VmFreeRange* spare) {
+	const auto base = reinterpret_cast<uintptr_t>(ptr);
+	auto* prev = s_free_ranges.find_last([base](VmFreeRange const& range) { return range.base < base; });
+	auto* next = prev ? decltype(s_free_ranges)::next(prev) : s_free_ranges.first();
+	const bool merge_prev = prev && prev->base + prev->size == base;
+	const bool merge_next = next && next->base == base + size;
+
+	if(merge_prev && merge_next) {
+		prev->size += size + next->size;
+		s_free_ranges.remove(next);
+		s_free_range_cache.free(next);
+		s_free_ranges.update(prev);
+	} else if(merge_prev) {
+		prev->size += size;
+		s_free_ranges.update(prev);
+	} else if(merge_next) {
+		next->base = base;
+		next->size += size;
+		s_free_ranges.update(next);
+	} else {
+		spare->base = base;
+		spare->size = size;
+		s_free_ranges.insert(spare);
+		return;
 	}
-	return base;
+	s_free_range_cache.free(spare);
 }
 
-void core::mem::vfree(void*) {
+/*	Unmap the area, free all physical pages backing it and return the
+ * 	virtual range for reuse. Pages that were not mapped yet are skipped.
+ *
+ * 	Must be called without the VM lock held. Other nodes are waited on
+ * 	until they drop the stale translations, and they may be spinning on
+ * 	the lock with interrupts disabled in the meantime. The pages and the
+ * 	range can only be reused after that, so they are released last.
+ * 	`shootdown` can be false for areas that were never handed out, as
+ * 	other nodes could not have accessed them.
+ */
+static void vm_release_area(VmArea* area, bool shootdown) {
+	arch::TlbGather gather { s_root };
+	//  Unmapped pages are chained through their first word in the identity map
+	void* pages = nullptr;
+	{
+		gen::LockGuard lg { s_lock };
+		//  Collect the pages before unmapping anything, as the range may be mapped with large pages
+		auto* vptr = reinterpret_cast<uint8*>(area->base);
+		for(size_t offset = 0; offset < area->size; offset += 0x1000) {
+			auto maybe_page = arch::addrtranslate(s_root, vptr + offset);
+			if(!maybe_page) {
+				continue;
+			}
+			auto* page = maybe_page.destructively_move_data();
+			*PhysPtr<void*> { static_cast<void**>(page) } = pages;
+			pages = page;
+		}
+		(void)arch::addrunmap_range(s_root, vptr, area->size, gather);
+	}
+
+	if(shootdown) {
+		gather.flush();
+	} else {
+		gather.flush_local();
+	}
+
+	while(pages) {
+		auto* next = *PhysPtr<void*> { static_cast<void**>(pages) };
+		//  Blocks given out by GFP may be freed piecewise
+		core::mem::free_pages(core::mem::PageAllocation { .base = pages, .order = 0, .flags = {} });
+		pages = next;
+	}
+
 	gen::LockGuard lg { s_lock };
-	if(!s_root) {
+	vm_range_free(area->base, area->size, area->spare);
+	s_area_cache.free(area);
+}
+
+/*	Back the area with physical memory. Must be called with the VM lock held.
+ * 	On failure, the pages that were mapped so far must be released with the
+ * 	rest of the area.
+ */
+static bool vm_populate_area(VmArea* area, uint32 node) {
+	//  Back the allocation with the largest blocks that fit in the remaining
+	//  size, falling back to smaller ones when GFP can't satisfy the order.
+	auto* vptr = reinterpret_cast<uint8*>(area->base);
+	size_t pages_left = area->size / 0x1000;
+	size_t order = CONFIG_CORE_MEM_GFP_MAX_ORDER;
+	while(pages_left > 0) {
+		while((1ul << order) > pages_left) {
+			--order;
+		}
+		auto maybe_block = core::mem::allocate_pages_node(order, {}, node);
+		if(!maybe_block) {
+			if(order > 0) {
+				--order;
+				continue;
+			}
+			return false;
+		}
+		auto block = maybe_block.destructively_move_data();
+
+		//  Large pages are used automatically where the block and the area are aligned
+		const auto err =
+		        arch::addrmap_range(s_root, block.base, vptr, block.size(), arch::PageFlags::Read | arch::PageFlags::Write);
+		if(err != core::Error::Ok) {
+			//  Part of the block may be mapped already, drop it so that the block can be freed as a whole.
+			//  Nothing could have accessed it yet, so no other node needs to be notified.
+			arch::TlbGather gather { s_root };
+			(void)arch::addrunmap_range(s_root, vptr, block.size(), gather);
+			gather.flush_local();
+			core::mem::free_pages(block);
+			return false;
+		}
+		vptr += block.size();
+		pages_left -= 1ul << order;
+	}
+	return true;
+}
+
+void* core::mem::vmalloc(size_t size) {
+	return vmalloc_node(size, NUMA_NODE_LOCAL);
+}
+
+void* core::mem::vmalloc_node(size_t size, uint32 node) {
+	VmArea* area;
+	{
+		gen::LockGuard lg { s_lock };
+		if(!s_root) {
+			s_root = vm_create_root();
+			if(!s_root) {
+				return nullptr;
+			}
+		}
+
+		const auto actual_allocation_size = ((size + 0x1000 - 1) / 0x1000) * 0x1000;
+		area = core::mem::make_in<VmArea>(s_area_cache);
+		if(!area) {
+			return nullptr;
+		}
+		area->spare = core::mem::make_in<VmFreeRange>(s_free_range_cache);
+		if(!area->spare) {
+			s_area_cache.free(area);
+			return nullptr;
+		}
+		const auto large_size = core::mem::order_to_size(CONFIG_CORE_MEM_VM_LARGE_PAGE_ORDER);
+		const auto alignment = actual_allocation_size >= large_size ? large_size : 0x1000;
+		auto* base = vm_range_allocate(actual_allocation_size, alignment);
+		if(!base) {
+			s_free_range_cache.free(area->spare);
+			s_area_cache.free(area);
+			return nullptr;
+		}
+		area->base = base;
+		area->size = actual_allocation_size;
+
+		if(vm_populate_area(area, node)) {
+			s_areas.insert(area);
+			return base;
+		}
+	}
+
+	vm_release_area(area, false);
+	return nullptr;
+}
+
+void core::mem::vfree(void* ptr) {
+	if(!ptr) {
 		return;
 	}
-	//  TODO: Implement deallocation
+
+	VmArea* area;
+	{
+		gen::LockGuard lg { s_lock };
+		if(!s_root) {
+			return;
+		}
+
+		area = s_areas.find_last([ptr](VmArea const& a) { return a.base <= ptr; });
+		if(!area || area->base != ptr) {
+			return;
+		}
+		s_areas.remove(area);
+	}
+	vm_release_area(area, true);
 }
 
 arch::PagingHandle core::mem::get_vmroot() {
@@ -1,8 +1,12 @@
 #pragma once
 #include <Arch/VM.hpp>
 #include <Core/Error/Error.hpp>
+#include <Core/Mem/NUMA.hpp>
 #include <SystemTypes.hpp>
 
+/* Order of large pages used for vmalloc (2 MiB on x86_64), allocations of at least that size are aligned to it */
+#define CONFIG_CORE_MEM_VM_LARGE_PAGE_ORDER (9)
+
 /*	core::mem - *kernel* VM management subsystem
  *
  *	All tasks running in the kernel share the same upper portion
@@ -20,16 +24,24 @@ namespace core::mem {
 	 * 	that will be forcibly aligned to the next multiple of the page size,
 	 * 	making `vmalloc` unsuitable for usage as a generic heap (but it can
 	 * 	itself be used for allocating the backing store for a heap).
+	 * 	Large allocations are backed by large pages where the physical
+	 * 	memory allows it.
 	 */
 	void* vmalloc(size_t);
 
+	/*	Allocate memory within the vmalloc area, backed by physical memory
+	 * 	of the given NUMA node where possible.
+	 *
+	 * 	Behaves the same as `vmalloc`, which allocates from the node of the
+	 * 	current CPU. `node` may be NUMA_NODE_LOCAL.
+	 */
+	void* vmalloc_node(size_t, uint32 node);
+
 	/*	Free memory previously allocated with vmalloc.
 	 *
 	 * 	Frees a chunk of virtual memory previously allocated using `vmalloc`.
-	 * 	The underlying physical pages used by the allocation are freed, and
-	 * 	the virtual address will be reusable by future allocations.
-	 *
-	 *	WARNING: This function is currently unimplemented!
+	 * 	The underlying physical pages used by the allocation are freed,
+	 * 	and the virtual address range can be reused by later allocations.
 	 */
 	void vfree(void*);
 
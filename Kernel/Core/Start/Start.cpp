@@ -14,8 +14,10 @@
 #	include "Daemons/DemoVESA/DemoVESA.hpp"
 #endif
 #include "Daemons/Kbd/Kbd.hpp"
+#include "Daemons/Reclaim/Reclaim.hpp"
 #include "Daemons/SysDbg/SysDbg.hpp"
 #include "Daemons/Testd/Testd.hpp"
+#include "Daemons/VMCollapse/VMCollapse.hpp"
 #include "LibFormat/Formatters/Pointer.hpp"
 #include "LibGeneric/String.hpp"
 #include "Process/Process.hpp"
@@ -52,7 +54,7 @@ static void dump_core_mem_layout() {
 	::log.info("Platform early init done");
 
 	auto* env = core::mp::create_environment();
-	arch::mp::environment_set(env);
+	core::mp::install_environment(env);
 	::log.info("Kernel starting on node={} with environment={x}", env->node_id, Format::ptr(env));
 
 	dump_core_mem_layout();
@@ -97,6 +99,17 @@ static void dump_core_mem_layout() {
 	this_cpu()->scheduler->run_here(vesa_demo.get());
 #endif
 
+	//  Spawn the daemon promoting populated user memory to large pages
+	auto vm_collapse = Process::create_with_main_thread(gen::String { "vm_collapse" }, Process::kerneld(),
+	                                                    VMCollapse::collapse_thread);
+	vm_collapse->sched_ctx().priority = 0;
+	this_cpu()->scheduler->run_here(vm_collapse.get());
+
+	//  Spawn the daemon giving cached memory back to GFP when it runs low
+	auto reclaim =
+	        Process::create_with_main_thread(gen::String { "reclaim" }, Process::kerneld(), Reclaim::reclaim_thread);
+	this_cpu()->scheduler->run_here(reclaim.get());
+
 	//  Spawn a demo thread that reads from the keyboard
 	auto kbd = Process::create_with_main_thread(gen::String { "debug_keyboard" }, Process::kerneld(), Kbd::kbd_thread);
 	kbd->sched_ctx().priority = 0;
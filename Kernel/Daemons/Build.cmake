@@ -1,4 +1,6 @@
 add_kernel_sources(Kbd/)
 add_kernel_sources(SysDbg/)
 add_kernel_sources(Testd/)
-add_kernel_sources(DemoVESA/)
\ No newline at end of file
+add_kernel_sources(DemoVESA/)
+add_kernel_sources(VMCollapse/)
+add_kernel_sources(Reclaim/)
\ No newline at end of file
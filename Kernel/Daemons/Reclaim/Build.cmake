@@ -0,0 +1,3 @@
+add_kernel_sources(
+    Reclaim.cpp
+)
\ No newline at end of file
@@ -0,0 +1,34 @@
+#include <Core/Log/Logger.hpp>
+#include <Core/Mem/GFP.hpp>
+#include <Core/Mem/Shrinker.hpp>
+#include <Daemons/Reclaim/Reclaim.hpp>
+#include <Process/Thread.hpp>
+#include <SystemTypes.hpp>
+
+CREATE_LOGGER("reclaim", core::log::LogLevel::Debug);
+
+/* Time between two checks of the GFP watermarks */
+#define CONFIG_DAEMONS_RECLAIM_INTERVAL_MS (100)
+
+/*
+ *  Background reclaim: whenever GFP drops below the low watermark, ask the shrinkers
+ *  for enough memory to get back above the high watermark. This keeps allocations
+ *  from having to reclaim memory synchronously.
+ */
+void Reclaim::reclaim_thread() {
+	while(true) {
+		Thread::current()->msleep(CONFIG_DAEMONS_RECLAIM_INTERVAL_MS);
+
+		const bool requested = core::mem::consume_reclaim_request();
+		const auto free = core::mem::free_page_count();
+		if(free >= CONFIG_CORE_MEM_GFP_WATERMARK_HIGH ||
+		   (!requested && free >= CONFIG_CORE_MEM_GFP_WATERMARK_LOW)) {
+			continue;
+		}
+
+		const auto freed = core::mem::shrink_memory(CONFIG_CORE_MEM_GFP_WATERMARK_HIGH - free);
+		if(freed > 0) {
+			log.debug("Reclaimed {} pages, {} pages free", freed, core::mem::free_page_count());
+		}
+	}
+}
@@ -0,0 +1,5 @@
+#pragma once
+
+namespace Reclaim {
+	[[noreturn]] void reclaim_thread();
+}
@@ -1,7 +1,12 @@
 #include <Arch/x86_64/PIT.hpp>
 #include <Arch/x86_64/Serial.hpp>
 #include <Core/Log/Logger.hpp>
+#include <Core/Mem/GFP.hpp>
 #include <Core/Mem/Heap.hpp>
+#include <Core/Mem/Layout.hpp>
+#include <Core/Mem/NUMA.hpp>
+#include <Core/Mem/Shrinker.hpp>
+#include <Core/Mem/ObjectCache.hpp>
 #include <Core/MP/MP.hpp>
 #include <Daemons/SysDbg/SysDbg.hpp>
 #include <LibGeneric/String.hpp>
@@ -74,12 +79,13 @@ void SysDbg::handle_command(gen::List<gen::String> const& args) {
 
 	if(command == "dvm") {
 		log.info("kdebugger({}): process vmapping dump", thread->tid());
-		for(auto& mapping : process->vmm().m_mappings) {
-			log.info("{} - {} [{}{}{}{}][{}]", Format::ptr(mapping->addr()), Format::ptr(mapping->end()),
+		process->vmm().m_mappings.for_each([](VMappingNode const& node) {
+			auto& mapping = node.mapping;
+			log.info("{} - {} [{}{}{}{}][{}] resident={} KiB", Format::ptr(mapping->addr()), Format::ptr(mapping->end()),
 			         (mapping->flags() & VM_READ) ? 'R' : '-', (mapping->flags() & VM_WRITE) ? 'W' : '-',
 			         (mapping->flags() & VM_EXEC) ? 'X' : '-', (mapping->flags() & VM_KERNEL) ? 'K' : 'U',
-			         (mapping->type() == MAP_SHARED) ? 'S' : 'P');
-		}
+			         (mapping->type() == MAP_SHARED) ? 'S' : 'P', mapping->resident_size() / 1024);
+		});
 	} else if(command == "dp") {
 		log.info("kdebugger({}): Kernel-mode process tree dump", thread->tid());
 		SysDbg::dump_process(Process::kerneld());
@@ -88,11 +94,88 @@ void SysDbg::handle_command(gen::List<gen::String> const& args) {
 	} else if(command == "ds") {
 		log.info("kdebugger({}): Scheduler statistics", thread->tid());
 		this_cpu()->scheduler->dump_statistics();
+	} else if(command == "dcs") {
+		log.info("kdebugger({}): context switch statistics", thread->tid());
+		for(size_t node = 0; node < core::mp::environment_count(); ++node) {
+			auto* env = core::mp::environment_for_node(node);
+			if(!env) {
+				continue;
+			}
+			auto const& stats = env->platform.switch_stats;
+			log.info("... node {}: switches={} avg={} cycles max={} cycles", node, stats.count,
+			         stats.count ? stats.cycles / stats.count : 0, stats.max_cycles);
+			log.info("...... cr3 skipped={} kept={} flushed={}", stats.cr3_skipped, stats.cr3_kept, stats.cr3_flushed);
+		}
+	} else if(command == "dz") {
+		log.info("kdebugger({}): physical memory zones, {} NUMA node(s)", thread->tid(), core::mem::numa_node_count());
+		core::mem::ZoneStats zones[CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS];
+		const auto count = core::mem::zone_stats(zones, CONFIG_CORE_MEM_LAYOUT_MAX_REGIONS);
+		for(size_t i = 0; i < count; ++i) {
+			auto const& zone = zones[i];
+			const char* type = zone.type == core::mem::ZoneType::DMA     ? "DMA"
+			                   : zone.type == core::mem::ZoneType::DMA32 ? "DMA32"
+			                                                             : "Normal";
+			log.info("... zone {}: {x} - {x} type={} node={} free={} managed={} pages", i, Format::ptr(zone.start),
+			         Format::ptr(zone.end), type, zone.node, zone.free_pages, zone.managed_pages);
+		}
+		for(size_t node = 0; node < core::mp::environment_count(); ++node) {
+			if(auto* env = core::mp::environment_for_node(node)) {
+				log.info("... cpu {}: node {}", node, env->numa_node);
+			}
+		}
+	} else if(command == "dr") {
+		log.info("kdebugger({}): free={} pages, watermarks low={} high={}, reclaimable={} pages", thread->tid(),
+		         core::mem::free_page_count(), CONFIG_CORE_MEM_GFP_WATERMARK_LOW, CONFIG_CORE_MEM_GFP_WATERMARK_HIGH,
+		         core::mem::reclaimable_pages());
+		core::mem::for_each_shrinker([](core::mem::Shrinker const& shrinker) {
+			log.info("... shrinker '{}': calls={} freed={} pages", shrinker.name, shrinker.calls, shrinker.freed);
+		});
+		for(uint32 node = 0; node < core::mem::numa_node_count(); ++node) {
+			const auto pool = core::mem::zero_pool_stats(node);
+			log.info("... zero pool of node {}: {} pages, hits={} misses={} refilled={}", node, pool.pages, pool.hits,
+			         pool.misses, pool.refilled);
+		}
 	} else if(command == "dc") {
 		log.info("kdebugger({}): attached CPUs", thread->tid());
 		//  for(auto const& cpu : SMP::attached_aps()) {
 		//  log.info("... CPU #{}, APIC ID={}", cpu->vid(), cpu->apic_id());
 		//  }
+	} else if(command == "dh") {
+		const auto stats = core::mem::heap_stats();
+		log.info("kdebugger({}): heap arenas={} ({} bytes), large allocations={} ({} bytes)", thread->tid(),
+		         stats.arena_count, stats.arena_bytes, stats.large_allocations, stats.large_bytes);
+		log.info("kdebugger({}): heap magazine statistics", thread->tid());
+		for(size_t node = 0; node < core::mp::environment_count(); ++node) {
+			auto* env = core::mp::environment_for_node(node);
+			if(!env) {
+				continue;
+			}
+			auto const& cache = env->heap_cache;
+			log.info("... node {}: hits={} misses={}", node, cache.hits, cache.misses);
+			for(size_t i = 0; i < core::mem::HEAP_MAGAZINE_CLASS_COUNT; ++i) {
+				log.info("...... class {}: {} cached", core::mem::HEAP_MAGAZINE_CLASSES[i], cache.magazines[i].count);
+			}
+		}
+	} else if(command == "dha") {
+#if CONFIG_CORE_MEM_HEAP_ACCOUNTING
+		log.info("kdebugger({}): top heap consumers", thread->tid());
+		core::mem::HeapSiteStats sites[16];
+		const auto count = core::mem::heap_accounting_top(sites, sizeof(sites) / sizeof(sites[0]));
+		for(size_t i = 0; i < count; ++i) {
+			auto const& site = sites[i];
+			log.info("... {}: live={} bytes in {} objects, peak={} bytes, allocs={} frees={}", site.site,
+			         site.live_bytes, site.live_count, site.peak_bytes, site.allocations, site.frees);
+		}
+#else
+		log.info("kdebugger({}): heap accounting is disabled (CONFIG_CORE_MEM_HEAP_ACCOUNTING)", thread->tid());
+#endif
+	} else if(command == "do") {
+		log.info("kdebugger({}): object cache statistics", thread->tid());
+		core::mem::ObjectCache::for_each_cache([](core::mem::ObjectCache& cache) {
+			const auto stats = cache.stats();
+			log.info("... {}: size={} slabs={} objects={}/{} allocs={} frees={}", stats.name, stats.object_size,
+			         stats.slab_count, stats.objects_in_use, stats.objects_total, stats.allocations, stats.frees);
+		});
 	} else if(command == "xp" || command == "xpd") {
 		//  No parameters passed
 		if(ptr == args.end()) {
@@ -0,0 +1,3 @@
+add_kernel_sources(
+    VMCollapse.cpp
+)
\ No newline at end of file
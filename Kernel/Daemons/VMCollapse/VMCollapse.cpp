@@ -0,0 +1,51 @@
+#include <Core/Log/Logger.hpp>
+#include <Daemons/VMCollapse/VMCollapse.hpp>
+#include <LibGeneric/List.hpp>
+#include <LibGeneric/LockGuard.hpp>
+#include <Process/Process.hpp>
+#include <Process/Thread.hpp>
+#include <SystemTypes.hpp>
+
+CREATE_LOGGER("vmcollapse", core::log::LogLevel::Debug);
+
+/* Time between two collapse passes over all processes */
+#define CONFIG_DAEMONS_VMCOLLAPSE_INTERVAL_MS (1000)
+/* Maximum number of large pages created in a single pass */
+#define CONFIG_DAEMONS_VMCOLLAPSE_PAGES_PER_PASS (16)
+
+/*
+ *  Collapses mappings of the given process and all of its children, creating at most
+ *  `limit` large pages. Returns the number of large pages created.
+ */
+size_t VMCollapse::collapse_process(gen::SharedPtr<Process> process, size_t limit) {
+	if(!process || limit == 0) {
+		return 0;
+	}
+
+	size_t collapsed = process->vmm().collapse_large_pages(limit);
+
+	//  Collapsing copies whole large pages, don't hold the process lock for that long
+	gen::List<gen::SharedPtr<Process>> children {};
+	{
+		gen::LockGuard lg { process->m_process_struct_lock };
+		for(auto& child : process->m_children) {
+			children.push_back(child);
+		}
+	}
+	for(auto& child : children) {
+		collapsed += collapse_process(child, limit - collapsed);
+	}
+	return collapsed;
+}
+
+void VMCollapse::collapse_thread() {
+	while(true) {
+		Thread::current()->msleep(CONFIG_DAEMONS_VMCOLLAPSE_INTERVAL_MS);
+
+		size_t collapsed = collapse_process(Process::kerneld(), CONFIG_DAEMONS_VMCOLLAPSE_PAGES_PER_PASS);
+		collapsed += collapse_process(Process::init(), CONFIG_DAEMONS_VMCOLLAPSE_PAGES_PER_PASS - collapsed);
+		if(collapsed > 0) {
+			log.debug("Collapsed {} runs of pages into large pages", collapsed);
+		}
+	}
+}
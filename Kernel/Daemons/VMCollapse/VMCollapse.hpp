@@ -0,0 +1,11 @@
+#pragma once
+#include <LibGeneric/SharedPtr.hpp>
+#include <SystemTypes.hpp>
+
+class Process;
+
+namespace VMCollapse {
+	size_t collapse_process(gen::SharedPtr<Process> process, size_t limit);
+
+	[[noreturn]] void collapse_thread();
+}
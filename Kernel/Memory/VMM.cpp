@@ -5,15 +5,37 @@
 #include <Core/Log/Logger.hpp>
 #include <Core/Mem/GFP.hpp>
 #include <Core/Mem/Layout.hpp>
+#include <Core/Mem/ObjectCache.hpp>
 #include <Core/Mem/VM.hpp>
 #include <LibAllocator/BumpAllocator.hpp>
 #include <Memory/VMM.hpp>
 #include <Process/Process.hpp>
-#include <string.h>
 #include <SystemTypes.hpp>
 
 CREATE_LOGGER("vmm", core::log::LogLevel::Debug);
 
+//  Cache for all VMapping tree nodes
+static constinit core::mem::ObjectCache s_vmapping_node_cache { "VMappingNode", sizeof(VMappingNode),
+	                                                            alignof(VMappingNode) };
+
+VMM::~VMM() {
+	//  Unmap everything first, so that the pages are freed by the mappings owning them
+	while(auto* node = m_mappings.root()) {
+		unmap(*node->mapping);
+		if(node == m_last_hit) {
+			m_last_hit = nullptr;
+		}
+		m_mappings.remove(node);
+		node->~VMappingNode();
+		s_vmapping_node_cache.free(node);
+	}
+	//  Pages left in the structure are shared copy-on-write with other address spaces
+	//  and only hold references. kerneld uses the root structure, which is never freed.
+	if(m_paging_handle && m_paging_handle != core::mem::get_vmroot()) {
+		(void)arch::addrfree(m_paging_handle);
+	}
+}
+
 /*
  *  Initializes the address space used by the kernel in the kerneld process
  */
@@ -28,85 +50,176 @@ void VMM::initialize_kernel_vm() {
 	             : "rax");
 }
 
+static arch::PageFlags arch_flags_for(VMappingFlags flags) {
+	arch::PageFlags arch_flags {};
+	if(flags & VM_READ) {
+		arch_flags = arch_flags | arch::PageFlags::Read;
+	}
+	if(flags & VM_WRITE) {
+		arch_flags = arch_flags | arch::PageFlags::Write;
+	}
+	if(flags & VM_EXEC) {
+		arch_flags = arch_flags | arch::PageFlags::Execute;
+	}
+	if(!(flags & VM_KERNEL)) {
+		arch_flags = arch_flags | arch::PageFlags::User;
+	}
+	return arch_flags;
+}
+
 /*
  *  Maps a given VMapping in the target process
  */
 bool VMM::map(VMapping const& mapping) {
-	auto virtual_addr = (uint8_t*)mapping.addr();
-	for(auto& page : mapping.pages()) {
-		auto phys = PhysAddr { page.base };
-		for(unsigned i = 0; i < (1u << page.order); ++i) {
-			addrmap(virtual_addr, phys, static_cast<VMappingFlags>(mapping.flags()));
-			virtual_addr += 0x1000;
-			phys += 0x1000;
-		}
+	for(auto& block : mapping.pages()) {
+		map_block((uint8_t*)mapping.addr() + block.offset, block.allocation,
+		          static_cast<VMappingFlags>(mapping.flags()));
 	}
 	return true;
 }
 
+/*
+ *  Maps a physical block at the given address, using large pages for the parts
+ *  of it that are suitably aligned
+ */
+bool VMM::map_block(void* vaddr, core::mem::PageAllocation block, VMappingFlags flags) {
+	const auto err = arch::addrmap_range(m_paging_handle, block.base, vaddr, block.size(), arch_flags_for(flags));
+	return err == core::Error::Ok;
+}
+
 /*
  *  Unmaps the given VMapping from the target process
  */
 bool VMM::unmap(VMapping const& mapping) {
-	auto virtual_addr = (uint8_t*)mapping.addr();
-	for(auto& page : mapping.pages()) {
-		auto phys = PhysAddr { page.base };
-		for(unsigned i = 0; i < (1u << page.order); ++i) {
-			addrunmap(virtual_addr);
-			virtual_addr += 0x1000;
-			phys += 0x1000;
-		}
+	//  Invalidate the whole mapping on other nodes at once, instead of page by page
+	arch::TlbGather gather { m_paging_handle };
+	for(auto& block : mapping.pages()) {
+		(void)arch::addrunmap_range(m_paging_handle, (uint8_t*)mapping.addr() + block.offset, block.allocation.size(),
+		                            gather);
 	}
+	gather.flush();
 	return true;
 }
 
 /*
  *  Looks for a VMapping for the given virtual address
+ *  Must be called with the VM lock held, as it updates the lookup cache.
  */
-KOptional<SharedPtr<VMapping>> VMM::find_vmapping(void* vaddr) const {
-	for(auto& vmapping : m_mappings) {
-		if(!vmapping) {
-			continue;
-		}
-		if(!vmapping->contains(vaddr)) {
-			continue;
-		}
+KOptional<SharedPtr<VMapping>> VMM::find_vmapping(void* vaddr) {
+	const auto address = (uintptr_t)vaddr;
+	if(m_last_hit && address >= m_last_hit->start && address < m_last_hit->end) {
+		return { m_last_hit->mapping };
+	}
 
-		return { vmapping };
+	auto* node = m_mappings.find_last([address](VMappingNode const& n) { return n.start <= address; });
+	if(!node || address >= node->end) {
+		return {};
 	}
+	m_last_hit = node;
+	return { node->mapping };
+}
 
-	return {};
+/*
+ *  Returns the number of bytes starting at the given address, up to `max`, that lie in
+ *  consecutive user mappings allowing the given access. User copies run in ring 0, where
+ *  page protections don't keep them out of kernel mappings, and must be bounded by this.
+ *  Takes the VM lock.
+ */
+size_t VMM::user_accessible_length(void const* vaddr, size_t max, VMappingFlags access) {
+	auto lock = acquire_vm_lock();
+	const auto start = (uintptr_t)vaddr;
+	auto address = start;
+	auto* node = m_mappings.find_last([address](VMappingNode const& n) { return n.start <= address; });
+	while(node && node->start <= address && address < node->end && address - start < max) {
+		const auto flags = node->mapping->flags();
+		if((flags & VM_KERNEL) || (flags & access) != access) {
+			break;
+		}
+		address = node->end;
+		node = VMappingTree::next(node);
+	}
+	return gen::min(address - start, max);
 }
 
 /*
  *  Validates whether the given VMapping does not overlap with any other mappings,
- *  and saves it into the list
+ *  and saves it into the tree
  */
 bool VMM::insert_vmapping(SharedPtr<VMapping>&& mapping) {
 	if(!mapping) {
 		return false;
 	}
 
-	auto find_vmapping_iterator = [this](void* address) {
-		auto it = m_mappings.begin();
-		while(it != m_mappings.end() && (*it)->addr() < address)
-			++it;
+	//  Mappings never overlap, so only the closest ones on both sides need to be checked
+	const auto start = (uintptr_t)mapping->addr();
+	auto* prev = m_mappings.find_last([start](VMappingNode const& n) { return n.start <= start; });
+	auto* next = prev ? VMappingTree::next(prev) : m_mappings.first();
+	if((prev && prev->mapping->overlaps(*mapping)) || (next && next->mapping->overlaps(*mapping))) {
+		return false;
+	}
 
-		return it;
-	};
+	auto* node = core::mem::make_in<VMappingNode>(s_vmapping_node_cache);
+	if(!node) {
+		return false;
+	}
+	node->mapping = gen::move(mapping);
+	node->start = start;
+	node->end = (uintptr_t)node->mapping->end();
+	m_mappings.insert(node);
+	return map(*node->mapping);
+}
 
-	auto it = find_vmapping_iterator(mapping->addr());
-	if(it == m_mappings.end()) {
-		m_mappings.push_back(mapping);
-		return map(*mapping);
+/*
+ *  Finds the lowest gap of at least `size` bytes between two consecutive mappings
+ *  in the subtree, starting at or above `lower`. Returns zero if there is none.
+ */
+static uintptr_t find_gap(VMappingNode const* node, uintptr_t lower, size_t size) {
+	//  Gaps that lie below `lower` are cut off, but can only get smaller
+	if(!node || node->subtree_gap < size || node->subtree_end <= lower) {
+		return 0;
+	}
+	if(auto gap = find_gap(node->avl_left, lower, size)) {
+		return gap;
 	}
+	if(auto* left = node->avl_left) {
+		const auto gap = gen::max(left->subtree_end, lower);
+		if(node->start >= gap && node->start - gap >= size) {
+			return gap;
+		}
+	}
+	if(auto* right = node->avl_right) {
+		const auto gap = gen::max(node->end, lower);
+		if(right->subtree_start >= gap && right->subtree_start - gap >= size) {
+			return gap;
+		}
+	}
+	return find_gap(node->avl_right, lower, size);
+}
 
-	if(mapping->overlaps(**it)) {
-		return false;
+/*
+ *  Finds the lowest free range of at least `size` bytes within [lower, upper)
+ */
+void* VMM::find_free_range(size_t size, void* lower, void* upper) const {
+	auto candidate = (uintptr_t)lower;
+	//  Skip the mapping containing the lower bound
+	auto* prev = m_mappings.find_last([candidate](VMappingNode const& n) { return n.start <= candidate; });
+	if(prev && prev->end > candidate) {
+		candidate = prev->end;
+	}
+	auto* next = m_mappings.find_first([candidate](VMappingNode const& n) { return n.start >= candidate; });
+	if(next && next->start - candidate < size) {
+		//  Look between mappings first, then after all of them
+		if(auto gap = find_gap(m_mappings.root(), candidate, size)) {
+			candidate = gap;
+		} else {
+			candidate = gen::max(m_mappings.last()->end, candidate);
+		}
 	}
 
-	m_mappings.insert(it, mapping);
-	return map(*mapping);
+	if(candidate + size < candidate || candidate + size > (uintptr_t)upper) {
+		return nullptr;
+	}
+	return (void*)candidate;
 }
 
 void* VMM::allocate_user_stack(uint64 stack_size) {
@@ -137,15 +250,16 @@ void* VMM::allocate_user_heap(size_t region_size) {
 		return (void*)(-1);
 	}
 
-	auto addr = m_next_anon_vm_at;
+	auto* addr = find_free_range(size_rounded, &_userspace_heap_start, &_userspace_heap_end);
+	if(!addr) {
+		return (void*)(-1);
+	}
 	auto vmapping = VMapping::create(addr, size_rounded, VM_READ | VM_WRITE, MAP_PRIVATE);
 
 	if(!insert_vmapping(gen::move(vmapping))) {
 		return (void*)(-1);
 	}
 
-	m_next_anon_vm_at = (void*)((uint64)m_next_anon_vm_at + size_rounded);
-
 	return addr;
 }
 
@@ -159,26 +273,228 @@ bool VMM::clone_address_space_from(arch::PagingHandle handle) {
 	return true;
 }
 
-gen::LockGuard<gen::Spinlock> VMM::acquire_vm_lock() {
-	return gen::LockGuard { m_vm_lock };
+/*
+ *  Picks the block to populate for a fault on the given page. With fault-around,
+ *  an aligned block around the page is used when all of it lies in the mapping
+ *  and none of it is populated yet.
+ */
+static size_t populate_order_for(VMapping const& mapping, arch::PagingHandle handle, uint8* page_addr) {
+	for(size_t order = CONFIG_MEMORY_VMM_FAULT_AROUND_ORDER; order > 0; --order) {
+		const auto size = core::mem::order_to_size(order);
+		auto* start = (uint8*)((uintptr_t)page_addr & ~(size - 1));
+		if(start < mapping.addr() || start + size > mapping.end()) {
+			continue;
+		}
+		bool populated = false;
+		for(auto* page = start; page < start + size && !populated; page += 0x1000) {
+			populated = arch::addrtranslate(handle, page).has_value();
+		}
+		if(!populated) {
+			return order;
+		}
+	}
+	return 0;
 }
 
-bool VMM::addrmap(void* vaddr, PhysAddr paddr, VMappingFlags flags) {
-	arch::PageFlags arch_flags {};
-	if(flags & VM_READ) {
-		arch_flags = arch_flags | arch::PageFlags::Read;
+/*
+ *  Populates the page containing the given address on first access
+ */
+bool VMM::populate_page(void* vaddr) {
+	auto lock = acquire_vm_lock();
+	auto maybe_mapping = find_vmapping(vaddr);
+	if(!maybe_mapping.has_value()) {
+		return false;
 	}
-	if(flags & VM_WRITE) {
-		arch_flags = arch_flags | arch::PageFlags::Write;
+	auto& mapping = maybe_mapping.unwrap();
+
+	auto* page_addr = (uint8*)((uintptr_t)vaddr & ~(uintptr_t)0xFFF);
+	//  Another thread of the process got here first
+	if(arch::addrtranslate(m_paging_handle, page_addr).has_value()) {
+		return true;
 	}
-	if(flags & VM_EXEC) {
-		arch_flags = arch_flags | arch::PageFlags::Execute;
+
+	if(populate_large(*mapping, page_addr)) {
+		return true;
 	}
-	if(!(flags & VM_KERNEL)) {
-		arch_flags = arch_flags | arch::PageFlags::User;
+
+	//  Fall back to a single page when a larger block can't be allocated
+	core::mem::PageAllocation block {};
+	const auto order = populate_order_for(*mapping, m_paging_handle, page_addr);
+	if(auto maybe_block = core::mem::allocate_pages(order, core::mem::PageAllocFlags::Zeroed);
+	   maybe_block.has_value()) {
+		block = maybe_block.destructively_move_data();
+	} else if(auto maybe_page = core::mem::allocate_pages(0, core::mem::PageAllocFlags::Zeroed);
+	          maybe_page.has_value()) {
+		block = maybe_page.destructively_move_data();
+	} else {
+		return false;
 	}
 
-	const auto err = arch::addrmap(m_paging_handle, paddr.get(), vaddr, arch_flags);
+	auto* start = (uint8*)((uintptr_t)page_addr & ~(block.size() - 1));
+	mapping->add_block(start, block);
+	return map_block(start, block, static_cast<VMappingFlags>(mapping->flags()));
+}
+
+/*
+ *  Backs the large page-aligned window around the page with a single large page,
+ *  when all of the window lies in the mapping and none of it is populated yet.
+ *  Must be called with the VM lock held.
+ */
+bool VMM::populate_large(VMapping& mapping, void* page_addr) {
+	if constexpr(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER == 0) {
+		return false;
+	}
+	const auto size = core::mem::order_to_size(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER);
+	auto* start = (uint8*)((uintptr_t)page_addr & ~(size - 1));
+	if(start < mapping.addr() || start + size > mapping.end() || mapping.resident_size(start, size) != 0) {
+		return false;
+	}
+
+	//  Physically contiguous memory may be scarce, this is only an optimization
+	auto maybe_block = core::mem::allocate_pages(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER, core::mem::PageAllocFlags::Zeroed);
+	if(maybe_block.has_error()) {
+		return false;
+	}
+	auto block = maybe_block.destructively_move_data();
+
+	//  Pages mapped without a VMapping (for example, inherited from a cloned
+	//  address space) prevent installing the large page
+	const auto err = arch::addrmap(m_paging_handle, block.base, start,
+	                               arch_flags_for(static_cast<VMappingFlags>(mapping.flags())) |
+	                                       arch::PageFlags::Large);
+	if(err != core::Error::Ok) {
+		core::mem::free_pages(block);
+		return false;
+	}
+	mapping.add_block(start, block);
+	return true;
+}
+
+/*
+ *  Resolves a write fault on a copy-on-write page shared with a cloned address space
+ */
+bool VMM::unshare_page(void* vaddr) {
+	auto lock = acquire_vm_lock();
+	auto* page_addr = (void*)((uintptr_t)vaddr & ~(uintptr_t)0xFFF);
+	auto maybe_result = arch::addrunshare(m_paging_handle, page_addr);
+	if(maybe_result.has_error()) {
+		return false;
+	}
+
+	//  Keep the mapping in sync with the page tables, so that the right page is freed later
+	auto result = maybe_result.destructively_move_data();
+	if(result.new_page == result.old_page) {
+		return true;
+	}
+	auto maybe_mapping = find_vmapping(page_addr);
+	if(!maybe_mapping.has_value()) {
+		return true;
+	}
+	auto& mapping = maybe_mapping.unwrap();
+	auto recorded_page = mapping->page_for(page_addr);
+	if(recorded_page.has_value() && recorded_page.unwrap().get() == result.old_page) {
+		mapping->replace_page(page_addr, result.new_page);
+	}
+	return true;
+}
+
+/*
+ *  Finds the first collapsible large page-aligned window at or above `from`, and prepares
+ *  it for collapsing (see arch::addrcollapse_prepare). Returns nullptr if there is none.
+ *  Must be called with the VM lock held.
+ */
+uint8* VMM::prepare_collapse(uint8* from, void** pages) {
+	const auto size = core::mem::order_to_size(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER);
+	const auto address = (uintptr_t)from;
+	auto* node = m_mappings.find_last([address](VMappingNode const& n) { return n.start <= address; });
+	if(!node || node->end <= address) {
+		node = m_mappings.find_first([address](VMappingNode const& n) { return n.start >= address; });
+	}
+	for(; node; node = VMappingTree::next(node)) {
+		auto& mapping = node->mapping;
+		auto* start = (uint8*)(((uintptr_t)gen::max(from, (uint8*)mapping->addr()) + size - 1) & ~(size - 1));
+		for(; start + size <= mapping->end(); start += size) {
+			//  Pages that are still shared or mapped with different permissions stay as they are
+			if(mapping->is_collapsible(start, size) &&
+			   arch::addrcollapse_prepare(m_paging_handle, start, pages) == core::Error::Ok) {
+				return start;
+			}
+		}
+	}
+	return nullptr;
+}
+
+/*
+ *  Promotes fully populated runs of regular pages to large pages. At most `limit`
+ *  large pages are created, and the number of created ones is returned.
+ *
+ *  The pages are copied to the large page without holding the VM lock, so that faults
+ *  in the address space don't wait for it. Runs that changed in the meantime are skipped.
+ */
+size_t VMM::collapse_large_pages(size_t limit) {
+	if constexpr(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER == 0) {
+		return 0;
+	}
+	const auto size = core::mem::order_to_size(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER);
+	static_assert((core::mem::order_to_size(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER) / 0x1000) * sizeof(void*) <= 0x1000,
+	              "Addresses of the pages of a large page must fit in a single page");
+
+	//  Physical addresses of the pages being collapsed
+	auto maybe_list = core::mem::allocate_pages(0, {});
+	if(maybe_list.has_error()) {
+		return 0;
+	}
+	auto list = maybe_list.destructively_move_data();
+	auto** pages = (void**)idmap(list.base);
+
+	size_t collapsed = 0;
+	uint8* cursor = nullptr;
+	while(collapsed < limit) {
+		auto maybe_block = core::mem::allocate_pages(CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER, {});
+		//  Other windows would fail the same way
+		if(maybe_block.has_error()) {
+			break;
+		}
+		auto block = maybe_block.destructively_move_data();
+
+		uint8* start;
+		{
+			auto lock = acquire_vm_lock();
+			start = prepare_collapse(cursor, pages);
+		}
+		if(!start) {
+			core::mem::free_pages(block);
+			break;
+		}
+		cursor = start + size;
+
+		for(size_t i = 0; i < size / 0x1000; ++i) {
+			memcpy(idmap((uint8*)block.base + i * 0x1000), idmap((uint8*)pages[i]), 0x1000);
+		}
+
+		{
+			auto lock = acquire_vm_lock();
+			if(arch::addrcollapse_commit(m_paging_handle, start, block.base, pages) == core::Error::Ok) {
+				//  The mapping owned the pages, which could not be unmapped without the commit failing
+				auto maybe_mapping = find_vmapping(start);
+				ENSURE(maybe_mapping.has_value());
+				maybe_mapping.unwrap()->replace_blocks(start, size, block);
+				++collapsed;
+				continue;
+			}
+		}
+		core::mem::free_pages(block);
+	}
+	core::mem::free_pages(list);
+	return collapsed;
+}
+
+gen::LockGuard<gen::Spinlock> VMM::acquire_vm_lock() {
+	return gen::LockGuard { m_vm_lock };
+}
+
+bool VMM::addrmap(void* vaddr, PhysAddr paddr, VMappingFlags flags) {
+	const auto err = arch::addrmap(m_paging_handle, paddr.get(), vaddr, arch_flags_for(flags));
 	return err == core::Error::Ok;
 }
 
@@ -2,6 +2,8 @@
 #include <Arch/VM.hpp>
 #include <Core/Mem/GFP.hpp>
 #include <Daemons/SysDbg/SysDbg.hpp>
+#include <LibGeneric/Algorithm.hpp>
+#include <LibGeneric/AVLTree.hpp>
 #include <LibGeneric/List.hpp>
 #include <LibGeneric/LockGuard.hpp>
 #include <LibGeneric/Spinlock.hpp>
@@ -11,6 +13,45 @@
 
 using gen::List;
 
+/* Order of the block populated on a fault in an anonymous mapping (fault-around), 0 populates single pages */
+#define CONFIG_MEMORY_VMM_FAULT_AROUND_ORDER (2)
+/* Order of the blocks populated and collapsed as a single large page (2 MiB on x86_64), 0 disables both */
+#define CONFIG_MEMORY_VMM_LARGE_PAGE_ORDER (9)
+
+/*
+ *  Node of the VMapping tree of an address space. Mappings never overlap, so the tree is
+ *  ordered by start address. Every node also tracks the span of its subtree and the largest
+ *  gap between two consecutive mappings in it, which allows finding free ranges quickly.
+ */
+struct VMappingNode : gen::AVLNode<VMappingNode> {
+	SharedPtr<VMapping> mapping;
+	uintptr_t start;
+	uintptr_t end;
+	uintptr_t subtree_start;
+	uintptr_t subtree_end;
+	size_t subtree_gap;
+};
+
+struct VMappingNodeCompare {
+	static bool less(VMappingNode const& a, VMappingNode const& b) { return a.start < b.start; }
+};
+
+struct VMappingNodeAugment {
+	static void update(VMappingNode& node) {
+		node.subtree_start = node.avl_left ? node.avl_left->subtree_start : node.start;
+		node.subtree_end = node.avl_right ? node.avl_right->subtree_end : node.end;
+		node.subtree_gap = 0;
+		if(auto* left = node.avl_left) {
+			node.subtree_gap = gen::max(left->subtree_gap, node.start - left->subtree_end);
+		}
+		if(auto* right = node.avl_right) {
+			node.subtree_gap = gen::max(node.subtree_gap, gen::max(right->subtree_gap, right->subtree_start - node.end));
+		}
+	}
+};
+
+using VMappingTree = gen::AVLTree<VMappingNode, VMappingNodeCompare, VMappingNodeAugment>;
+
 class VMM {
 	friend void SysDbg::handle_command(gen::List<gen::String> const& args);
 	friend class V86;
@@ -19,9 +60,11 @@ class VMM {
 
 	Process& m_process;
 	arch::PagingHandle m_paging_handle;
-	List<SharedPtr<VMapping>> m_mappings;
+	VMappingTree m_mappings;
+	//  Node returned by the last successful lookup, lookups tend to hit the same mapping repeatedly
+	//  Only accessed with the VM lock held, and cleared when the node is removed from the tree
+	VMappingNode* m_last_hit {};
 	List<core::mem::PageAllocation> m_kernel_pages;
-	void* m_next_anon_vm_at;
 	gen::Spinlock m_vm_lock;
 
 	enum class LeakAllocatedPage {
@@ -31,14 +74,20 @@ class VMM {
 
 	bool map(VMapping const&);
 	bool unmap(VMapping const&);
+	bool map_block(void* vaddr, core::mem::PageAllocation, VMappingFlags flags);
+	bool populate_large(VMapping&, void* page_addr);
+	uint8* prepare_collapse(uint8* from, void** pages);
+	void* find_free_range(size_t size, void* lower, void* upper) const;
 public:
 	explicit VMM(Process& proc) noexcept
-	    : m_process(proc)
-	    , m_next_anon_vm_at(&_userspace_heap_start) {}
+	    : m_process(proc) {}
+
+	~VMM();
 
 	arch::PagingHandle paging_handle() const { return m_paging_handle; }
 
-	KOptional<SharedPtr<VMapping>> find_vmapping(void* vaddr) const;
+	KOptional<SharedPtr<VMapping>> find_vmapping(void* vaddr);
+	size_t user_accessible_length(void const* vaddr, size_t max, VMappingFlags access);
 	[[nodiscard]] bool insert_vmapping(SharedPtr<VMapping>&&);
 
 	gen::LockGuard<gen::Spinlock> acquire_vm_lock();
@@ -47,6 +96,9 @@ public:
 	void* allocate_user_heap(size_t region_size);
 
 	bool clone_address_space_from(arch::PagingHandle);
+	bool populate_page(void* vaddr);
+	bool unshare_page(void* vaddr);
+	size_t collapse_large_pages(size_t limit);
 
 	static void initialize_kernel_vm();
 	static constexpr unsigned kernel_stack_size() { return 0x4000; }
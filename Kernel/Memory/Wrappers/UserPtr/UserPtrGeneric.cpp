@@ -1,3 +1,4 @@
+#include <Arch/UserCopy.hpp>
 #include <Core/Mem/Heap.hpp>
 #include <Memory/Wrappers/UserPtr.hpp>
 #include <Process/Process.hpp>
@@ -5,43 +6,30 @@
 
 template<class T>
 gen::SharedPtr<typename UserPtr<T>::type> UserPtr<T>::copy_to_kernel() {
-	auto* user_ptr = (uint8*)m_ptr;
 	auto& vmm = Thread::current()->parent()->vmm();
-	auto lock = vmm.acquire_vm_lock();
-	auto size = sizeof(T);
-
-	//  Verify whether the entire structure is mapped in the process
-	//  FIXME: Discarding find_vmregion results to later redo them again
-	for(unsigned i = 0; i < size; ++i) {
-		auto region = vmm.find_vmapping(user_ptr + i);
-		if(!region.has_value()) {
-			return gen::SharedPtr<type> { nullptr };
-		}
+	if(vmm.user_accessible_length(m_ptr, sizeof(T), VM_READ) != sizeof(T)) {
+		return gen::SharedPtr<type> { nullptr };
 	}
 
-	auto* buf = (uint8*)core::mem::hmalloc(size);
+	auto* buf = (uint8*)core::mem::hmalloc(sizeof(T));
 	if(!buf) {
 		return gen::SharedPtr<type> { nullptr };
 	}
 
-	//  Copy from user memory to kernel buffer, byte by byte
-	//  FIXME: Slowpath, most of the time the buffer will be within a single vmregion
-	for(unsigned i = 0; i < size; ++i) {
-		auto region = vmm.find_vmapping(user_ptr + i);
-		ENSURE(region.has_value());
-
-		auto page = region.unwrap()->page_for(user_ptr + i);
-		ENSURE(page.has_value());
-
-		auto phys_ptr = page.unwrap();
-		buf[i] = *phys_ptr;
+	//  Faults on unpopulated pages are resolved during the copy, unmapped memory fails it
+	if(arch::copy_from_user(buf, m_ptr, sizeof(T)) != 0) {
+		core::mem::hfree(buf);
+		return gen::SharedPtr<type> { nullptr };
 	}
 
 	return gen::SharedPtr<type> { reinterpret_cast<type*>(buf) };
 }
 
 template<class T>
-bool UserPtr<T>::copy_to_user(type*) {
-	//  FIXME: TODO
-	return false;
+bool UserPtr<T>::copy_to_user(type* value) {
+	auto& vmm = Thread::current()->parent()->vmm();
+	if(vmm.user_accessible_length(m_ptr, sizeof(T), VM_WRITE) != sizeof(T)) {
+		return false;
+	}
+	return arch::copy_to_user(m_ptr, value, sizeof(T)) == 0;
 }
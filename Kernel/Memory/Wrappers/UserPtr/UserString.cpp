@@ -1,55 +1,30 @@
+#include <Arch/UserCopy.hpp>
 #include <Core/Mem/Heap.hpp>
 #include <Memory/Wrappers/UserPtr.hpp>
 #include <Process/Process.hpp>
 #include <Process/Thread.hpp>
 
 KBox<const char> UserString::copy_to_kernel() {
-	auto* user_ptr = (uint8*)m_ptr;
-	auto& vmm = Thread::current()->parent()->vmm();
-	auto lock = vmm.acquire_vm_lock();
-
 	constexpr unsigned str_max_size { 128 };
-	unsigned size { 0 };
-	while(size < str_max_size) {
-		auto region = vmm.find_vmapping(user_ptr + size);
-		if(!region.has_value()) {
-			return KBox<const char> {};
-		}
-
-		auto page = region.unwrap()->page_for(user_ptr + size);
-		if(!page.has_value()) {
-			return KBox<const char> {};
-		}
-
-		auto byte = page.unwrap();
-
-		if(*byte == 0x0) {
-			break;
-		}
 
-		size++;
-		if(size == str_max_size) {
-			return KBox<const char> {};
-		}
+	//  The string may end before the end of its mapping, only the accessible part is read
+	auto& vmm = Thread::current()->parent()->vmm();
+	const auto accessible = vmm.user_accessible_length(m_ptr, str_max_size, VM_READ);
+	if(accessible == 0) {
+		return KBox<const char> {};
 	}
 
-	auto* buf = (uint8*)core::mem::hmalloc(size + 1);
+	auto* buf = (char*)core::mem::hmalloc(str_max_size);
 	if(!buf) {
 		return KBox<const char> {};
 	}
 
-	//  Copy from user memory to kernel buffer, byte by byte
-	//  FIXME: Slowpath, most of the time the buffer will be within a single vmregion
-	for(unsigned i = 0; i < size + 1; ++i) {
-		auto region = vmm.find_vmapping(user_ptr + i);
-		ENSURE(region.has_value());
-
-		auto page = region.unwrap()->page_for(user_ptr + i);
-		ENSURE(page.has_value());
-
-		auto phys_ptr = page.unwrap();
-		buf[i] = *phys_ptr;
+	//  Strings that are inaccessible, or don't fit in the buffer with the terminator, are rejected
+	const auto length = arch::strncpy_from_user(buf, static_cast<char const*>(m_ptr), accessible);
+	if(length < 0 || length >= static_cast<int64>(accessible)) {
+		core::mem::hfree(buf);
+		return KBox<const char> {};
 	}
 
-	return KBox<const char> { buf, size + 1 };
+	return KBox<const char> { buf, static_cast<size_t>(length) + 1 };
 }
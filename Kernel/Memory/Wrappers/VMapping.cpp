@@ -1,8 +1,13 @@
 #include <Core/Mem/GFP.hpp>
 #include <Core/Mem/Heap.hpp>
+#include <Core/Mem/ObjectCache.hpp>
+#include <Core/Mem/PageFrame.hpp>
 #include <Memory/VMM.hpp>
 #include <Memory/Wrappers/VMapping.hpp>
 
+//  Cache for all VMapping objects
+static constinit core::mem::ObjectCache s_vmapping_cache { "VMapping", sizeof(VMapping), alignof(VMapping) };
+
 VMapping::VMapping(void* addr, size_t size, int flags, int type)
     : m_pages()
     , m_addr(addr)
@@ -11,23 +16,35 @@ VMapping::VMapping(void* addr, size_t size, int flags, int type)
     , m_type(type) {}
 
 SharedPtr<VMapping> VMapping::create(void* address, size_t size, uint32 flags, uint32_t type) {
-	auto* vmapping = new(core::mem::hmalloc(sizeof(VMapping))) VMapping(address, size, flags, type);
+	auto* vmapping = new(s_vmapping_cache.allocate()) VMapping(address, size, flags, type);
+	return SharedPtr<VMapping> { vmapping };
+}
 
-	//  FIXME:  Fix unaligned sizes
-	auto page_count = size / 0x1000;
-	for(unsigned i = 0; i < page_count; ++i) {
-		auto alloc = core::mem::allocate_pages(0, core::mem::PageAllocFlags {});
-		ENSURE(alloc.has_value());
-		vmapping->m_pages.push_back(alloc.data());
+VMapping::~VMapping() {
+	//  Pages may still be shared with a cloned address space
+	for(auto& block : m_pages) {
+		core::mem::put_pages(block.allocation);
 	}
+}
 
-	return SharedPtr<VMapping> { vmapping };
+size_t VMapping::resident_size() const {
+	size_t size = 0;
+	for(auto& block : m_pages) {
+		size += block.allocation.size();
+	}
+	return size;
 }
 
-VMapping::~VMapping() {
-	for(auto& alloc : m_pages) {
-		core::mem::free_pages(alloc);
+size_t VMapping::resident_size(void* vaddr, size_t size) const {
+	const auto offset = (size_t)((uint8*)vaddr - (uint8*)m_addr);
+	size_t resident = 0;
+	for(auto& block : m_pages) {
+		if(block.offset + block.allocation.size() <= offset || block.offset >= offset + size) {
+			continue;
+		}
+		resident += block.allocation.size();
 	}
+	return resident;
 }
 
 KOptional<PhysPtr<uint8>> VMapping::page_for(void* vaddr) const {
@@ -35,22 +52,76 @@ KOptional<PhysPtr<uint8>> VMapping::page_for(void* vaddr) const {
 		return {};
 	}
 
-	auto* region_start = (uint8*)m_addr;
-	for(auto& alloc : m_pages) {
-		auto* region_end = region_start + alloc.size();
-		if(vaddr >= region_start && vaddr < region_end) {
-			auto offset = (uint8*)vaddr - (uint8*)region_start;
-			auto addr = PhysAddr { alloc.base }.as<uint8>() + offset;
+	const auto offset = (size_t)((uint8*)vaddr - (uint8*)m_addr);
+	for(auto& block : m_pages) {
+		if(offset >= block.offset && offset < block.offset + block.allocation.size()) {
+			auto addr = PhysAddr { block.allocation.base }.as<uint8>() + (offset - block.offset);
 			return addr;
 		}
-
-		region_start = region_end;
 	}
 
 	return {};
 }
 
-bool VMapping::overlaps(VMapping const&) {
-	//  TODO: Implement
-	return false;
+void VMapping::add_block(void* vaddr, core::mem::PageAllocation allocation) {
+	m_pages.push_back(VMappingBlock {
+	        .offset = (size_t)((uint8*)vaddr - (uint8*)m_addr),
+	        .allocation = allocation,
+	});
+}
+
+void VMapping::replace_page(void* vaddr, void* page) {
+	const auto offset = (size_t)((uint8*)vaddr - (uint8*)m_addr);
+	for(auto& block : m_pages) {
+		if(offset < block.offset || offset >= block.offset + block.allocation.size()) {
+			continue;
+		}
+
+		//  Split the block in halves until the page is in a block of its own
+		while(block.allocation.order > 0) {
+			--block.allocation.order;
+			const auto half = block.allocation.size();
+			auto other = block;
+			if(offset - block.offset < half) {
+				other.offset += half;
+				other.allocation.base = (uint8*)block.allocation.base + half;
+			} else {
+				block.offset += half;
+				block.allocation.base = (uint8*)block.allocation.base + half;
+			}
+			m_pages.push_back(other);
+		}
+		block.allocation.base = page;
+		return;
+	}
+}
+
+bool VMapping::is_collapsible(void* vaddr, size_t size) const {
+	const auto offset = (size_t)((uint8*)vaddr - (uint8*)m_addr);
+	for(auto& block : m_pages) {
+		const bool in_range = block.offset + block.allocation.size() > offset && block.offset < offset + size;
+		if(in_range && block.allocation.size() >= size) {
+			return false;
+		}
+	}
+	return resident_size(vaddr, size) == size;
+}
+
+void VMapping::replace_blocks(void* vaddr, size_t size, core::mem::PageAllocation allocation) {
+	const auto offset = (size_t)((uint8*)vaddr - (uint8*)m_addr);
+	auto it = m_pages.begin();
+	while(it != m_pages.end()) {
+		auto current = it;
+		++it;
+		if((*current).offset < offset || (*current).offset >= offset + size) {
+			continue;
+		}
+		core::mem::put_pages((*current).allocation);
+		m_pages.erase(current);
+	}
+	add_block(vaddr, allocation);
+}
+
+bool VMapping::overlaps(VMapping const& other) const {
+	return m_addr < other.end() && other.m_addr < end();
 }
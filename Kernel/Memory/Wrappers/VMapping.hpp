@@ -21,6 +21,14 @@ enum VMappingType : uint32 {
 
 class Process;
 
+/*
+ *  Physical block backing part of a VMapping, starting `offset` bytes into the mapping
+ */
+struct VMappingBlock {
+	size_t offset;
+	core::mem::PageAllocation allocation;
+};
+
 class VMapping {
 private:
 	friend class VMM;
@@ -30,7 +38,8 @@ private:
 	template<class T>
 	using SharedPtr = gen::SharedPtr<T>;
 
-	List<core::mem::PageAllocation> m_pages;
+	//  Blocks populated so far, in no particular order
+	List<VMappingBlock> m_pages;
 
 	void* m_addr;
 	size_t m_size;
@@ -39,6 +48,10 @@ private:
 
 	VMapping(void* addr, size_t size, int flags, int type);
 public:
+	/*
+	 *  Create an anonymous mapping. No memory is committed up front, pages
+	 *  are allocated and zeroed on first access (see VMM::populate_page).
+	 */
 	static SharedPtr<VMapping> create(void* address, size_t size, uint32 flags, uint32 type);
 
 	VMapping(const VMapping&) = delete;
@@ -53,9 +66,16 @@ public:
 
 	size_t size() const { return m_size; }
 
-	List<core::mem::PageAllocation>& pages() { return m_pages; }
+	List<VMappingBlock>& pages() { return m_pages; }
+
+	List<VMappingBlock> const& pages() const { return m_pages; }
 
-	List<core::mem::PageAllocation> const& pages() const { return m_pages; }
+	size_t resident_size() const;
+
+	/*
+	 *  Get the size of the blocks populated in the given range
+	 */
+	size_t resident_size(void* vaddr, size_t size) const;
 
 	void* addr() const { return m_addr; }
 
@@ -65,7 +85,33 @@ public:
 		return (uintptr_t)vaddr >= (uintptr_t)m_addr && (uintptr_t)vaddr < (uintptr_t)m_addr + m_size;
 	}
 
-	bool overlaps(VMapping const&);
+	bool overlaps(VMapping const&) const;
 
+	/*
+	 *  Get the physical address backing the given address, if the page
+	 *  containing it was populated already
+	 */
 	KOptional<PhysPtr<uint8>> page_for(void* vaddr) const;
+
+	/*
+	 *  Record that the block backs the mapping starting at the given page-aligned address
+	 */
+	void add_block(void* vaddr, core::mem::PageAllocation);
+
+	/*
+	 *  Replace the physical page backing the given page-aligned address, after
+	 *  the page was unshared. The containing block is split as necessary.
+	 */
+	void replace_page(void* vaddr, void* page);
+
+	/*
+	 *  Check whether the given range is fully populated, using blocks smaller than the range
+	 */
+	bool is_collapsible(void* vaddr, size_t size) const;
+
+	/*
+	 *  Replace all blocks backing the given range with a single block, after their
+	 *  contents were copied over. The old blocks are freed.
+	 */
+	void replace_blocks(void* vaddr, size_t size, core::mem::PageAllocation);
 };
\ No newline at end of file
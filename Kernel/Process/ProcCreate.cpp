@@ -1,13 +1,18 @@
 #include <Core/Mem/Heap.hpp>
+#include <Core/Mem/ObjectCache.hpp>
 #include <Process/PidAllocator.hpp>
 #include <Process/Process.hpp>
 
+//  Cache for all Process objects
+static constinit core::mem::ObjectCache s_process_cache { "Process", sizeof(Process),
+                                                          core::mem::ObjectCache::cache_line_alignment };
+
 SharedPtr<Process> Process::create(gen::String name, ProcFlags flags) {
-	return SharedPtr { new(core::mem::hmalloc(sizeof(Process))) Process(PidAllocator::next(), name, flags) };
+	return SharedPtr { new(s_process_cache.allocate()) Process(PidAllocator::next(), name, flags) };
 }
 
 SharedPtr<Thread> Process::create_with_main_thread(gen::String name, SharedPtr<Process> parent, void (*kernel_exec)(),
-                                                   ProcFlags flags) {
+                                                   ProcFlags flags, uint32 numa_node) {
 	if(!parent) {
 		return SharedPtr<Thread> { nullptr };
 	}
@@ -21,7 +26,7 @@ SharedPtr<Thread> Process::create_with_main_thread(gen::String name, SharedPtr<P
 		return SharedPtr<Thread> { nullptr };
 	}
 
-	auto thread = Thread::create_in_process(process, kernel_exec);
+	auto thread = Thread::create_in_process(process, kernel_exec, numa_node);
 	if(!thread) {
 		return SharedPtr<Thread> { nullptr };
 	}
@@ -1,5 +1,6 @@
 #pragma once
 #include <Daemons/SysDbg/SysDbg.hpp>
+#include <Daemons/VMCollapse/VMCollapse.hpp>
 #include <LibGeneric/List.hpp>
 #include <LibGeneric/LockGuard.hpp>
 #include <LibGeneric/SharedPtr.hpp>
@@ -35,6 +36,7 @@ class Process {
 	friend class Scheduler;
 	friend class Thread;
 	friend void SysDbg::dump_process(gen::SharedPtr<Process> process, size_t depth);
+	friend size_t VMCollapse::collapse_process(gen::SharedPtr<Process> process, size_t limit);
 
 	pid_t m_pid;
 	ProcFlags m_flags;
@@ -52,7 +54,8 @@ class Process {
 public:
 	static SharedPtr<Process> create(gen::String name, ProcFlags flags);
 	static SharedPtr<Thread> create_with_main_thread(gen::String name, SharedPtr<Process> parent, void (*kernel_exec)(),
-	                                                 ProcFlags flags = ProcFlags::flags_for_kernel_proc());
+	                                                 ProcFlags flags = ProcFlags::flags_for_kernel_proc(),
+	                                                 uint32 numa_node = core::mem::NUMA_NODE_LOCAL);
 	static Process& _kerneld_ref();
 	static SharedPtr<Process> kerneld();
 	static SharedPtr<Process> init();
@@ -1,6 +1,7 @@
 #pragma once
 #include <Arch/VM.hpp>
 #include <Arch/x86_64/PtraceRegs.hpp>
+#include <Core/Mem/NUMA.hpp>
 #include <Daemons/SysDbg/SysDbg.hpp>
 #include <LibGeneric/SharedPtr.hpp>
 #include <SystemTypes.hpp>
@@ -56,7 +57,10 @@ class Thread {
 
 	[[maybe_unused]] static void finalize_switch(Thread* prev, Thread* next);
 public:
-	static SharedPtr<Thread> create_in_process(SharedPtr<Process>, void (*kernel_exec)());
+	///  Create a thread in the given process. The kernel stack of the thread is
+	///  allocated from memory local to `numa_node`.
+	static SharedPtr<Thread> create_in_process(SharedPtr<Process>, void (*kernel_exec)(),
+	                                           uint32 numa_node = core::mem::NUMA_NODE_LOCAL);
 	static Thread* current();
 
 	tid_t tid() const { return m_tid; }
@@ -3,6 +3,7 @@
 #include <Arch/x86_64/InactiveTaskFrame.hpp>
 #include <Arch/x86_64/MP/ExecutionEnvironment.hpp>
 #include <Core/Mem/Heap.hpp>
+#include <Core/Mem/ObjectCache.hpp>
 #include <Core/Mem/VM.hpp>
 #include <Core/MP/MP.hpp>
 #include <Process/PidAllocator.hpp>
@@ -11,6 +12,10 @@
 #include <string.h>
 #include <SystemTypes.hpp>
 
+//  Cache for all Thread objects
+static constinit core::mem::ObjectCache s_thread_cache { "Thread", sizeof(Thread),
+                                                         core::mem::ObjectCache::cache_line_alignment };
+
 static void* _bootstrap_task_stack(uint8* kernel_stack_bottom, PtraceRegs state) {
 	auto struct_begin = kernel_stack_bottom - sizeof(PtraceRegs);
 
@@ -40,9 +45,9 @@ static void* _bootstrap_task_stack(uint8* kernel_stack_bottom, PtraceRegs state)
 	return offset;
 }
 
-SharedPtr<Thread> Thread::create_in_process(SharedPtr<Process> parent, void (*kernel_exec)()) {
+SharedPtr<Thread> Thread::create_in_process(SharedPtr<Process> parent, void (*kernel_exec)(), uint32 numa_node) {
 	auto thread = SharedPtr {
-		new(core::mem::hmalloc(sizeof(Thread))) Thread { parent, PidAllocator::next() }
+		new(s_thread_cache.allocate()) Thread { parent, PidAllocator::next() }
 	};
 
 	if(!thread) {
@@ -50,7 +55,7 @@ SharedPtr<Thread> Thread::create_in_process(SharedPtr<Process> parent, void (*ke
 	}
 
 	parent->add_thread(thread);
-	auto* stack_top = core::mem::vmalloc(VMM::kernel_stack_size());
+	auto* stack_top = core::mem::vmalloc_node(VMM::kernel_stack_size(), numa_node);
 	if(!stack_top) {
 		return {};
 	}
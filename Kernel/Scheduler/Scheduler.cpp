@@ -48,10 +48,11 @@ void Scheduler::interrupt_return_common() {
 /*
  *  Creates an idle task for the AP with the specified custom platform identifier
  */
-Thread* Scheduler::create_idle_task(size_t identifier) {
+Thread* Scheduler::create_idle_task(size_t identifier, uint32 numa_node) {
 	char s_buffer[64] {};
 	Format::format("idle[{}]", s_buffer, sizeof(s_buffer), identifier);
-	auto thread = Process::create_with_main_thread(gen::String { s_buffer }, Process::kerneld(), platform_idle);
+	auto thread = Process::create_with_main_thread(gen::String { s_buffer }, Process::kerneld(), platform_idle,
+	                                               ProcFlags::flags_for_kernel_proc(), numa_node);
 	thread->m_sched.priority = 19;
 	return thread.get();
 }
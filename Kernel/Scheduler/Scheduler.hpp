@@ -1,4 +1,5 @@
 #pragma once
+#include <Core/Mem/NUMA.hpp>
 #include <LibGeneric/Spinlock.hpp>
 #include <Scheduler/RunQueue.hpp>
 #include <SystemTypes.hpp>
@@ -26,5 +27,5 @@ public:
 	void dump_statistics();
 	void run_here(Thread*);
 
-	static Thread* create_idle_task(size_t);
+	static Thread* create_idle_task(size_t, uint32 numa_node = core::mem::NUMA_NODE_LOCAL);
 };
\ No newline at end of file
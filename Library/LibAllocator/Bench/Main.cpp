@@ -0,0 +1,497 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <LibAllocator/Arena.hpp>
+#include <LibAllocator/BumpAllocator.hpp>
+#include <LibAllocator/ChunkAllocator.hpp>
+#include <LibAllocator/SlabAllocator.hpp>
+
+/*  BenchLibAllocator - allocation trace benchmarks for LibAllocator
+ *
+ *  Every allocator is wrapped in an adapter exposing a malloc-like interface,
+ *  and then replayed against a set of pre-generated allocation traces. For
+ *  each (allocator, trace) pair, the following is reported:
+ *
+ *  - ns_per_op: average wall time of a single allocate/free
+ *  - peak_live: largest amount of requested bytes live at the same time
+ *  - peak_footprint: bytes of arena pages that were ever handed out. This is
+ *    the amount of memory that would be resident (RSS) if the arena was
+ *    demand-paged.
+ *  - overhead: peak_footprint / peak_live - 1
+ *  - fragmentation: worst observed 1 - largest_free / free_bytes, for
+ *    allocators that can report it
+ *
+ *  Results are printed as JSON (default) or CSV. Run with `--help` for options.
+ */
+
+static constexpr size_t page_size = 0x1000;
+static constexpr size_t arena_size = 256 * 1024 * 1024;
+//  Fragmentation is sampled once every this many operations in the measurement pass
+static constexpr size_t fragmentation_sample_interval = 256;
+
+struct Op {
+	enum class Kind : uint8_t {
+		Allocate,
+		Free
+	};
+
+	Kind kind;
+	//  Slot in the live object table the operation refers to
+	uint32_t slot;
+	//  Requested size, only valid for allocations
+	uint32_t size;
+};
+
+struct Trace {
+	std::string name;
+	std::vector<Op> ops;
+	size_t slot_count;
+};
+
+/*  Interface of a benchmarked allocator. Adapters own their arena.
+ */
+class Adapter {
+public:
+	virtual ~Adapter() = default;
+
+	virtual void* allocate(size_t size) = 0;
+	virtual void free(void* ptr, size_t size) = 0;
+
+	//  Largest request size the allocator can serve
+	[[nodiscard]] virtual size_t max_size() const = 0;
+
+	//  Current external fragmentation in the range [0, 1], or a negative value if not supported
+	[[nodiscard]] virtual double fragmentation() const { return -1.0; }
+
+	[[nodiscard]] uint8_t* arena_base() const { return m_arena.get(); }
+protected:
+	std::unique_ptr<uint8_t[]> m_arena { new uint8_t[arena_size] };
+};
+
+class ChunkAdapter final : public Adapter {
+public:
+	ChunkAdapter()
+	    : m_allocator(liballoc::Arena { m_arena.get(), arena_size }) {}
+
+	void* allocate(size_t size) override { return m_allocator.allocate(size); }
+
+	void free(void* ptr, size_t) override { m_allocator.free(ptr); }
+
+	[[nodiscard]] size_t max_size() const override { return arena_size / 2; }
+
+	[[nodiscard]] double fragmentation() const override {
+		const auto free_bytes = m_allocator.free_bytes();
+		if(!free_bytes) {
+			return 0.0;
+		}
+		return 1.0 - static_cast<double>(m_allocator.largest_free_allocation()) / static_cast<double>(free_bytes);
+	}
+private:
+	liballoc::ChunkAllocator m_allocator;
+};
+
+/*  Segregated slabs, one for every power-of-two size class.
+ *  This mirrors how slabs are used in the kernel (object caches).
+ */
+class SlabAdapter final : public Adapter {
+public:
+	static constexpr size_t min_class = 16;
+	static constexpr size_t class_count = 9;
+
+	SlabAdapter() {
+		const auto slab_size = arena_size / class_count;
+		for(size_t i = 0; i < class_count; ++i) {
+			new(&m_slabs[i]) liballoc::SlabAllocator { liballoc::Arena { m_arena.get() + i * slab_size, slab_size },
+				                                       min_class << i };
+		}
+	}
+
+	void* allocate(size_t size) override { return m_slabs[class_for(size)].allocate(); }
+
+	void free(void* ptr, size_t size) override { m_slabs[class_for(size)].free(ptr); }
+
+	[[nodiscard]] size_t max_size() const override { return min_class << (class_count - 1); }
+private:
+	liballoc::SlabAllocator m_slabs[class_count];
+
+	static size_t class_for(size_t size) {
+		size_t index = 0;
+		while((min_class << index) < size) {
+			++index;
+		}
+		return index;
+	}
+};
+
+class BumpAdapter final : public Adapter {
+public:
+	BumpAdapter()
+	    : m_allocator(liballoc::Arena { m_arena.get(), arena_size }) {}
+
+	void* allocate(size_t size) override { return m_allocator.allocate((size + 15) & ~size_t { 15 }); }
+
+	void free(void*, size_t) override {}
+
+	[[nodiscard]] size_t max_size() const override { return arena_size; }
+private:
+	liballoc::BumpAllocator m_allocator;
+};
+
+struct AllocatorEntry {
+	const char* name;
+	std::function<std::unique_ptr<Adapter>()> create;
+};
+
+//  All benchmarked allocators. New allocators only need an adapter and an entry here.
+static const AllocatorEntry s_allocators[] = {
+	{ "ChunkAllocator", [] { return std::make_unique<ChunkAdapter>(); } },
+	{ "SlabAllocator", [] { return std::make_unique<SlabAdapter>(); } },
+	{ "BumpAllocator", [] { return std::make_unique<BumpAdapter>(); } },
+};
+
+/*  Trace generation
+ *
+ *  All traces are generated from a fixed seed, so results are comparable
+ *  between runs. Every trace frees all of its objects by the end.
+ */
+class TraceBuilder {
+public:
+	TraceBuilder(std::string name, size_t seed)
+	    : m_rng(seed) {
+		m_trace.name = std::move(name);
+	}
+
+	uint32_t allocate(size_t size) {
+		uint32_t slot;
+		if(!m_free_slots.empty()) {
+			slot = m_free_slots.back();
+			m_free_slots.pop_back();
+		} else {
+			slot = m_trace.slot_count++;
+		}
+		m_trace.ops.push_back(Op { Op::Kind::Allocate, slot, static_cast<uint32_t>(size) });
+		return slot;
+	}
+
+	void free(uint32_t slot) {
+		m_trace.ops.push_back(Op { Op::Kind::Free, slot, 0 });
+		m_free_slots.push_back(slot);
+	}
+
+	size_t uniform(size_t lo, size_t hi) { return std::uniform_int_distribution<size_t> { lo, hi }(m_rng); }
+
+	Trace finish() { return std::move(m_trace); }
+private:
+	Trace m_trace {};
+	std::vector<uint32_t> m_free_slots {};
+	std::mt19937_64 m_rng;
+};
+
+//  Allocate a batch of objects and free them in reverse order
+static Trace trace_lifo(size_t ops) {
+	TraceBuilder b { "lifo", 1 };
+	std::vector<uint32_t> stack;
+	for(size_t i = 0; i < ops / 2;) {
+		const auto batch = b.uniform(1, 256);
+		for(size_t j = 0; j < batch; ++j, ++i) {
+			stack.push_back(b.allocate(b.uniform(16, 512)));
+		}
+		while(!stack.empty()) {
+			b.free(stack.back());
+			stack.pop_back();
+		}
+	}
+	return b.finish();
+}
+
+//  Allocate a batch of objects and free them in allocation order
+static Trace trace_fifo(size_t ops) {
+	TraceBuilder b { "fifo", 2 };
+	std::vector<uint32_t> queue;
+	for(size_t i = 0; i < ops / 2;) {
+		const auto batch = b.uniform(1, 256);
+		for(size_t j = 0; j < batch; ++j, ++i) {
+			queue.push_back(b.allocate(b.uniform(16, 512)));
+		}
+		for(auto slot : queue) {
+			b.free(slot);
+		}
+		queue.clear();
+	}
+	return b.finish();
+}
+
+//  Random sizes with random lifetimes around a steady-state live set
+static Trace trace_random(size_t ops) {
+	TraceBuilder b { "random", 3 };
+	std::vector<uint32_t> live;
+	constexpr size_t target_live = 4096;
+	for(size_t i = 0; i < ops / 2; ++i) {
+		if(live.size() < target_live || b.uniform(0, 1)) {
+			live.push_back(b.allocate(b.uniform(16, 4096)));
+		} else {
+			const auto index = b.uniform(0, live.size() - 1);
+			b.free(live[index]);
+			live[index] = live.back();
+			live.pop_back();
+		}
+	}
+	for(auto slot : live) {
+		b.free(slot);
+	}
+	return b.finish();
+}
+
+//  A producer allocating into a bounded queue, with a consumer freeing in
+//  bursts from the other end. Models buffers passed between subsystems.
+static Trace trace_producer_consumer(size_t ops) {
+	TraceBuilder b { "producer_consumer", 4 };
+	std::vector<uint32_t> queue;
+	size_t head = 0;
+	constexpr size_t queue_limit = 1024;
+	for(size_t i = 0; i < ops / 2; ++i) {
+		queue.push_back(b.allocate(b.uniform(64, 256)));
+		if(queue.size() - head >= queue_limit) {
+			const auto burst = b.uniform(queue_limit / 4, queue_limit / 2);
+			for(size_t j = 0; j < burst; ++j) {
+				b.free(queue[head++]);
+			}
+		}
+	}
+	while(head < queue.size()) {
+		b.free(queue[head++]);
+	}
+	return b.finish();
+}
+
+//  A mix resembling kernel heap usage: many small, short-lived objects
+//  (list nodes, strings), medium objects with longer lifetimes (process and
+//  thread state), and the occasional page-sized buffer (I/O, SysDbg).
+static Trace trace_kernel_like(size_t ops) {
+	TraceBuilder b { "kernel_like", 5 };
+	std::vector<uint32_t> short_lived;
+	std::vector<uint32_t> long_lived;
+	for(size_t i = 0; i < ops / 2; ++i) {
+		const auto dice = b.uniform(0, 99);
+		if(dice < 70) {
+			short_lived.push_back(b.allocate(b.uniform(16, 128)));
+		} else if(dice < 95) {
+			long_lived.push_back(b.allocate(b.uniform(128, 1024)));
+		} else {
+			//  Buffers are freed right away
+			b.free(b.allocate(b.uniform(1, 4) * page_size));
+		}
+
+		if(short_lived.size() > 64) {
+			const auto count = b.uniform(1, short_lived.size());
+			for(size_t j = 0; j < count; ++j) {
+				b.free(short_lived.back());
+				short_lived.pop_back();
+			}
+		}
+		if(long_lived.size() > 2048) {
+			const auto index = b.uniform(0, long_lived.size() - 1);
+			b.free(long_lived[index]);
+			long_lived[index] = long_lived.back();
+			long_lived.pop_back();
+		}
+	}
+	for(auto slot : short_lived) {
+		b.free(slot);
+	}
+	for(auto slot : long_lived) {
+		b.free(slot);
+	}
+	return b.finish();
+}
+
+struct Result {
+	std::string allocator;
+	std::string trace;
+	size_t ops;
+	size_t failed;
+	double ns_per_op;
+	size_t peak_live;
+	size_t peak_footprint;
+	double overhead;
+	double fragmentation;
+};
+
+struct Slot {
+	void* ptr;
+	size_t size;
+};
+
+//  Replay the trace once, measuring time only
+static double replay_timed(Adapter& adapter, Trace const& trace, std::vector<Slot>& slots) {
+	const auto start = std::chrono::steady_clock::now();
+	for(auto const& op : trace.ops) {
+		auto& slot = slots[op.slot];
+		if(op.kind == Op::Kind::Allocate) {
+			slot = Slot { adapter.allocate(op.size), op.size };
+		} else if(slot.ptr) {
+			adapter.free(slot.ptr, slot.size);
+		}
+	}
+	const auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+//  Replay the trace again on a fresh allocator, collecting memory statistics
+static void replay_measured(Adapter& adapter, Trace const& trace, std::vector<Slot>& slots, Result& result) {
+	const auto base = reinterpret_cast<uintptr_t>(adapter.arena_base());
+	std::vector<bool> touched(arena_size / page_size);
+	size_t touched_pages = 0;
+	size_t live = 0;
+	size_t n = 0;
+	for(auto const& op : trace.ops) {
+		auto& slot = slots[op.slot];
+		if(op.kind == Op::Kind::Allocate) {
+			slot = Slot { adapter.allocate(op.size), op.size };
+			if(!slot.ptr) {
+				++result.failed;
+				continue;
+			}
+			//  Touch the allocation, so that broken allocators are caught by the sanitizers
+			std::memset(slot.ptr, 0xDA, slot.size);
+			live += slot.size;
+			const auto start = reinterpret_cast<uintptr_t>(slot.ptr);
+			for(auto page = (start - base) / page_size; page <= (start + slot.size - 1 - base) / page_size; ++page) {
+				if(!touched[page]) {
+					touched[page] = true;
+					++touched_pages;
+				}
+			}
+			result.peak_live = std::max(result.peak_live, live);
+		} else if(slot.ptr) {
+			adapter.free(slot.ptr, slot.size);
+			live -= slot.size;
+		}
+
+		if(++n % fragmentation_sample_interval == 0) {
+			result.fragmentation = std::max(result.fragmentation, adapter.fragmentation());
+		}
+	}
+
+	result.peak_footprint = touched_pages * page_size;
+	result.overhead = result.peak_live ? static_cast<double>(result.peak_footprint) / result.peak_live - 1.0 : 0.0;
+}
+
+static Result run(AllocatorEntry const& entry, Trace const& trace) {
+	Result result { .allocator = entry.name,
+		            .trace = trace.name,
+		            .ops = trace.ops.size(),
+		            .failed = 0,
+		            .ns_per_op = 0.0,
+		            .peak_live = 0,
+		            .peak_footprint = 0,
+		            .overhead = 0.0,
+		            .fragmentation = -1.0 };
+	std::vector<Slot> slots(trace.slot_count);
+
+	auto timed = entry.create();
+	result.ns_per_op = replay_timed(*timed, trace, slots) / static_cast<double>(trace.ops.size());
+	timed.reset();
+
+	auto measured = entry.create();
+	replay_measured(*measured, trace, slots, result);
+	return result;
+}
+
+static bool trace_fits(Adapter const& adapter, Trace const& trace) {
+	return std::all_of(trace.ops.begin(), trace.ops.end(),
+	                   [&](Op const& op) { return op.kind == Op::Kind::Free || op.size <= adapter.max_size(); });
+}
+
+static void print_json(std::vector<Result> const& results) {
+	std::printf("[\n");
+	for(size_t i = 0; i < results.size(); ++i) {
+		auto const& r = results[i];
+		std::printf("  {\"allocator\": \"%s\", \"trace\": \"%s\", \"ops\": %zu, \"failed\": %zu, \"ns_per_op\": %.2f, "
+		            "\"peak_live\": %zu, \"peak_footprint\": %zu, \"overhead\": %.4f, \"fragmentation\": %.4f}%s\n",
+		            r.allocator.c_str(), r.trace.c_str(), r.ops, r.failed, r.ns_per_op, r.peak_live, r.peak_footprint,
+		            r.overhead, r.fragmentation, i + 1 < results.size() ? "," : "");
+	}
+	std::printf("]\n");
+}
+
+static void print_csv(std::vector<Result> const& results) {
+	std::printf("allocator,trace,ops,failed,ns_per_op,peak_live,peak_footprint,overhead,fragmentation\n");
+	for(auto const& r : results) {
+		std::printf("%s,%s,%zu,%zu,%.2f,%zu,%zu,%.4f,%.4f\n", r.allocator.c_str(), r.trace.c_str(), r.ops, r.failed,
+		            r.ns_per_op, r.peak_live, r.peak_footprint, r.overhead, r.fragmentation);
+	}
+}
+
+static void usage(const char* argv0) {
+	std::fprintf(stderr,
+	             "usage: %s [--csv] [--quick] [--ops N] [--allocator NAME] [--trace NAME]\n"
+	             "  --csv             print results as CSV instead of JSON\n"
+	             "  --quick           run short traces, for smoke testing\n"
+	             "  --ops N           number of operations per trace (default 1000000)\n"
+	             "  --allocator NAME  only run the given allocator\n"
+	             "  --trace NAME      only run the given trace\n",
+	             argv0);
+}
+
+int main(int argc, char** argv) {
+	bool csv = false;
+	size_t ops = 1000000;
+	std::string_view allocator_filter {};
+	std::string_view trace_filter {};
+	for(int i = 1; i < argc; ++i) {
+		const std::string_view arg { argv[i] };
+		if(arg == "--csv") {
+			csv = true;
+		} else if(arg == "--quick") {
+			ops = 10000;
+		} else if(arg == "--ops" && i + 1 < argc) {
+			ops = std::strtoull(argv[++i], nullptr, 10);
+		} else if(arg == "--allocator" && i + 1 < argc) {
+			allocator_filter = argv[++i];
+		} else if(arg == "--trace" && i + 1 < argc) {
+			trace_filter = argv[++i];
+		} else {
+			usage(argv[0]);
+			return arg == "--help" ? 0 : 1;
+		}
+	}
+
+	const std::vector<Trace> traces = {
+		trace_lifo(ops),       trace_fifo(ops),        trace_random(ops), trace_producer_consumer(ops),
+		trace_kernel_like(ops)
+	};
+
+	std::vector<Result> results;
+	for(auto const& entry : s_allocators) {
+		if(!allocator_filter.empty() && allocator_filter != entry.name) {
+			continue;
+		}
+		const auto probe = entry.create();
+		for(auto const& trace : traces) {
+			if(!trace_filter.empty() && trace_filter != trace.name) {
+				continue;
+			}
+			if(!trace_fits(*probe, trace)) {
+				continue;
+			}
+			results.push_back(run(entry, trace));
+		}
+	}
+
+	if(csv) {
+		print_csv(results);
+	} else {
+		print_json(results);
+	}
+	return 0;
+}
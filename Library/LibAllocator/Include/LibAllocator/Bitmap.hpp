@@ -52,4 +52,258 @@ namespace liballoc {
 			*ptr = *ptr & ~(0x80ul >> (idx % 8));
 		}
 	}
-}
\ No newline at end of file
+
+	/*  Bitmap with summary levels for fast searching of clear bits.
+	 *
+	 *  The bitmap operates on 64-bit words stored in externally provided
+	 *  storage (see `storage_size`). Bits are counted LSB-first within a
+	 *  word. On top of the leaf level, up to two summary levels are kept,
+	 *  where every bit marks whether the corresponding word of the level
+	 *  below is completely set. Finding a clear bit then only takes a
+	 *  single word scan on every level. A hint pointing at the word that
+	 *  was last modified is kept, so that allocations tend to be served
+	 *  from the same word without touching the summaries.
+	 *
+	 *  Padding bits past the end of every level are permanently set, so
+	 *  they are never returned as free.
+	 */
+	class HierarchicalBitmap {
+	public:
+		static constexpr const size_t bits_per_word = 64;
+		static constexpr const size_t max_levels = 3;
+
+		/*  Get the number of bytes of storage required for a bitmap of `bits` bits.
+		 */
+		static constexpr size_t storage_size(size_t bits) {
+			size_t words = 0;
+			size_t level_bits = bits;
+			for(size_t level = 0; level < max_levels; ++level) {
+				const auto level_words = words_for(level_bits);
+				words += level_words;
+				if(level_words <= 1) {
+					break;
+				}
+				level_bits = level_words;
+			}
+			return words * sizeof(uint64_t);
+		}
+
+		constexpr HierarchicalBitmap() noexcept = default;
+
+		/*  Create a bitmap of `bits` bits in the given storage. The storage
+		 *  must be 8-byte aligned and at least `storage_size(bits)` bytes
+		 *  long. All bits start out clear.
+		 */
+		HierarchicalBitmap(void* storage, size_t bits)
+		    : m_bits(bits) {
+			auto* words = static_cast<uint64_t*>(storage);
+			size_t level_bits = bits;
+			for(size_t level = 0; level < max_levels; ++level) {
+				const auto level_words = words_for(level_bits);
+				m_levels[level] = words;
+				m_words[level] = level_words;
+				m_depth = level + 1;
+				for(size_t i = 0; i < level_words; ++i) {
+					words[i] = 0;
+				}
+				//  Mark padding bits as set
+				if(level_bits % bits_per_word) {
+					words[level_words - 1] = ~0ull << (level_bits % bits_per_word);
+				}
+				words += level_words;
+				if(level_words <= 1) {
+					break;
+				}
+				level_bits = level_words;
+			}
+		}
+
+		[[nodiscard]] constexpr size_t size() const { return m_bits; }
+
+		[[nodiscard]] bool get(size_t idx) const {
+			if(idx >= m_bits) {
+				return false;
+			}
+			return m_levels[0][idx / bits_per_word] & (1ull << (idx % bits_per_word));
+		}
+
+		void set(size_t idx, bool value) {
+			if(idx >= m_bits) {
+				return;
+			}
+			const auto word = idx / bits_per_word;
+			const auto mask = 1ull << (idx % bits_per_word);
+			auto& leaf = m_levels[0][word];
+			if(value) {
+				leaf |= mask;
+				if(leaf == ~0ull) {
+					set_summary(1, word);
+				}
+			} else {
+				const bool was_full = leaf == ~0ull;
+				leaf &= ~mask;
+				if(was_full) {
+					clear_summary(1, word);
+				}
+			}
+			m_hint = word;
+		}
+
+		/*  Set or clear `count` bits starting at `idx`.
+		 */
+		void set_run(size_t idx, size_t count, bool value) {
+			for(size_t i = 0; i < count; ++i) {
+				set(idx + i, value);
+			}
+		}
+
+		/*  Find the first clear bit and set it.
+		 */
+		bool find_and_set(size_t& idx) {
+			if(!m_bits) {
+				return false;
+			}
+			const size_t word = m_hint;
+			if(m_levels[0][word] != ~0ull) {
+				idx = word * bits_per_word + __builtin_ctzll(~m_levels[0][word]);
+			} else if(!find_clear_from(0, 0, idx)) {
+				return false;
+			}
+			set(idx, true);
+			return true;
+		}
+
+		/*  Find the first run of `count` clear bits and set them. Regions of
+		 *  full words are skipped using the summaries, so only words that
+		 *  have clear bits are scanned.
+		 */
+		bool find_and_set_run(size_t count, size_t& idx) {
+			if(count == 0 || count > m_bits) {
+				return false;
+			}
+			if(count == 1) {
+				return find_and_set(idx);
+			}
+
+			size_t run = 0;
+			size_t start = 0;
+			for(size_t word = 0; word < m_words[0]; ++word) {
+				if(m_levels[0][word] == ~0ull) {
+					//  Jump to the next word with clear bits, a run can't cross a full word
+					size_t next = 0;
+					if(!find_clear_from(0, word * bits_per_word, next)) {
+						break;
+					}
+					word = next / bits_per_word;
+					run = 0;
+				}
+				const auto value = m_levels[0][word];
+				if(value == 0) {
+					if(run == 0) {
+						start = word * bits_per_word;
+					}
+					run += bits_per_word;
+					if(run >= count) {
+						break;
+					}
+					continue;
+				}
+
+				size_t bit = 0;
+				while(bit < bits_per_word && run < count) {
+					const auto remaining = value >> bit;
+					if(remaining & 1) {
+						//  Skip over the set bits
+						const auto inverted = ~remaining;
+						bit += inverted ? __builtin_ctzll(inverted) : bits_per_word - bit;
+						run = 0;
+					} else {
+						//  Extend the run with the clear bits
+						const auto zeros = remaining ? __builtin_ctzll(remaining) : bits_per_word - bit;
+						if(run == 0) {
+							start = word * bits_per_word + bit;
+						}
+						run += zeros;
+						bit += zeros;
+					}
+				}
+				if(run >= count) {
+					break;
+				}
+			}
+			if(run < count) {
+				return false;
+			}
+
+			set_run(start, count, true);
+			idx = start;
+			return true;
+		}
+	private:
+		uint64_t* m_levels[max_levels] {};
+		size_t m_words[max_levels] {};
+		size_t m_depth {};
+		size_t m_bits {};
+		size_t m_hint {};
+
+		static constexpr size_t words_for(size_t bits) { return (bits + bits_per_word - 1) / bits_per_word; }
+
+		/*  Find the first clear bit of level `level` at or after bit `from`.
+		 *  When the rest of a word is set, the summary above is used to jump
+		 *  straight to the next word that is not full.
+		 */
+		bool find_clear_from(size_t level, size_t from, size_t& result) const {
+			while(true) {
+				const auto word = from / bits_per_word;
+				if(word >= m_words[level]) {
+					return false;
+				}
+				//  Bits below `from` are treated as set
+				const auto value = m_levels[level][word] | ((1ull << (from % bits_per_word)) - 1);
+				if(value != ~0ull) {
+					result = word * bits_per_word + __builtin_ctzll(~value);
+					return true;
+				}
+				if(level + 1 < m_depth) {
+					size_t next = 0;
+					if(!find_clear_from(level + 1, word + 1, next)) {
+						return false;
+					}
+					from = next * bits_per_word;
+				} else {
+					//  The top level is at most a handful of words
+					from = (word + 1) * bits_per_word;
+				}
+			}
+		}
+
+		/*  Mark word `index` of level `level - 1` as full in the summary `level`.
+		 */
+		void set_summary(size_t level, size_t index) {
+			while(level < m_depth) {
+				auto& word = m_levels[level][index / bits_per_word];
+				word |= 1ull << (index % bits_per_word);
+				if(word != ~0ull) {
+					return;
+				}
+				index /= bits_per_word;
+				++level;
+			}
+		}
+
+		/*  Mark word `index` of level `level - 1` as not full in the summary `level`.
+		 */
+		void clear_summary(size_t level, size_t index) {
+			while(level < m_depth) {
+				auto& word = m_levels[level][index / bits_per_word];
+				const bool was_full = word == ~0ull;
+				word &= ~(1ull << (index % bits_per_word));
+				if(!was_full) {
+					return;
+				}
+				index /= bits_per_word;
+				++level;
+			}
+		}
+	};
+}
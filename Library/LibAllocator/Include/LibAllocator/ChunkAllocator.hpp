@@ -4,43 +4,115 @@
 #include <stdint.h>
 
 namespace liballoc {
-	enum class ChunkState {
+	enum class ChunkState : uint32_t {
 		Free,
 		Allocated
 	};
 
+	/*  Boundary-tagged chunk header.
+	 *
+	 *  Every chunk in the arena starts with this header, and ends with a
+	 *  footer word that mirrors `size`. This allows finding both neighbours
+	 *  of a chunk in constant time, which is required for coalescing freed
+	 *  chunks immediately. `size` is the total size of the chunk, including
+	 *  the header and footer.
+	 */
 	struct Chunk {
-		Chunk() = default;
+		//  Links used for the size-class free lists. These overlay the start
+		//  of the allocation data, and are only valid when the chunk is free.
+		struct FreeLinks {
+			Chunk* next;
+			Chunk* prev;
+		};
+
+		static constexpr const uint32_t chunk_magic = 0xC4A11C0C;
 
 		Chunk(size_t size)
-		    : next(nullptr)
-		    , size(size)
-		    , state(ChunkState::Free) {}
+		    : size(size)
+		    , state(ChunkState::Free)
+		    , magic(chunk_magic) {
+			*footer() = size;
+		}
 
 		void* alloc_ptr() { return data; }
 
-		void* alloc_end_ptr() { return reinterpret_cast<uint8_t*>(alloc_ptr()) + size; }
+		void* alloc_end_ptr() { return reinterpret_cast<uint8_t*>(footer()); }
+
+		[[nodiscard]] size_t capacity() const { return size - sizeof(Chunk) - sizeof(size_t); }
+
+		size_t* footer() { return reinterpret_cast<size_t*>(reinterpret_cast<uint8_t*>(this) + size - sizeof(size_t)); }
+
+		Chunk* next_in_memory() { return reinterpret_cast<Chunk*>(reinterpret_cast<uint8_t*>(this) + size); }
+
+		FreeLinks& links() { return *reinterpret_cast<FreeLinks*>(data); }
 
-		Chunk* next;
 		size_t size;
 		ChunkState state;
+		uint32_t magic;
 		uint8_t data[];
 	};
 
+	/*  General-purpose allocator for variable-sized allocations.
+	 *
+	 *  Free chunks are kept in segregated free lists, one for each size class.
+	 *  Small size classes hold chunks of exactly one size, larger classes cover
+	 *  a power-of-two range of sizes. A bitmap of non-empty classes is used to
+	 *  find a class that can satisfy a request without walking empty lists.
+	 *  Freed chunks are immediately coalesced with their free neighbours, so
+	 *  the arena never contains two adjacent free chunks.
+	 */
 	class ChunkAllocator {
 	public:
-		ChunkAllocator() noexcept = default;
+		static constexpr const size_t alignment = 16;
+
+		constexpr ChunkAllocator() noexcept = default;
 		ChunkAllocator(liballoc::Arena arena);
 
 		void* allocate(size_t size);
 		void free(void*);
+
+		/*  Get the number of bytes that can be used in the given allocation.
+		 *  This may be larger than the size originally requested.
+		 *  Returns 0 for pointers that are not live allocations.
+		 */
+		[[nodiscard]] size_t usable_size(void* ptr);
+
+		/*  Check whether the given pointer lies within the managed arena.
+		 */
+		[[nodiscard]] bool contains(void* ptr) const { return ptr >= m_start && ptr < m_end; }
+
+		/*  Total amount of bytes held by free chunks, including their headers.
+		 */
+		[[nodiscard]] constexpr size_t free_bytes() const { return m_free_bytes; }
+
+		/*  Number of allocations that are currently live.
+		 */
+		[[nodiscard]] constexpr size_t allocation_count() const { return m_allocation_count; }
+
+		/*  Size of the largest request that can currently be satisfied.
+		 */
+		[[nodiscard]] size_t largest_free_allocation() const;
+
+		[[nodiscard]] constexpr void* start() const { return m_start; }
+
+		[[nodiscard]] constexpr void* end() const { return m_end; }
 	private:
-		Chunk* m_chunk_list;
-		size_t m_region_size;
-		void* m_start;
+		static constexpr const size_t bin_count = 64;
+		static constexpr const size_t small_bin_count = 32;
+
+		Chunk* m_bins[bin_count] {};
+		uint64_t m_bin_map {};
+		size_t m_free_bytes {};
+		size_t m_allocation_count {};
+		void* m_start {};
+		void* m_end {};
+
+		static size_t bin_index(size_t chunk_size);
 
-		Chunk* find_free_chunk(size_t size);
-		Chunk* find_chunk_with_address(void* addr);
-		bool mark_chunk_allocated(Chunk&, size_t);
+		Chunk* find_free_chunk(size_t chunk_size);
+		Chunk* chunk_for_pointer(void* ptr);
+		void bin_insert(Chunk*);
+		void bin_remove(Chunk*);
+		void mark_chunk_allocated(Chunk&, size_t chunk_size);
 	};
 }
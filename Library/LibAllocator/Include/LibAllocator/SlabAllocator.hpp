@@ -1,5 +1,6 @@
 #pragma once
 #include <LibAllocator/Arena.hpp>
+#include <LibAllocator/Bitmap.hpp>
 #include <stddef.h>
 #include <stdint.h>
 
@@ -43,5 +44,7 @@ namespace liballoc {
 		size_t m_pool_capacity;
 
 		size_t m_overhead;
+
+		HierarchicalBitmap m_bitmap {};
 	};
 }
@@ -12,34 +12,74 @@ CREATE_LOGGER("liballoc", core::log::LogLevel::Debug);
 
 #endif
 
-liballoc::ChunkAllocator::ChunkAllocator(liballoc::Arena arena)
-    : m_chunk_list(new(arena.base) Chunk(arena.length - sizeof(Chunk))) {}
+//  Smallest chunk that can hold the header, the free list links and the footer
+static constexpr const size_t minimum_chunk_size =
+        (sizeof(liballoc::Chunk) + sizeof(liballoc::Chunk::FreeLinks) + sizeof(size_t) +
+         liballoc::ChunkAllocator::alignment - 1) &
+        ~(liballoc::ChunkAllocator::alignment - 1);
+//  Chunks of size below this threshold are kept in exact-size bins
+static constexpr const size_t small_bin_limit = 32 * liballoc::ChunkAllocator::alignment;
+
+static_assert(sizeof(liballoc::Chunk) % liballoc::ChunkAllocator::alignment == 0,
+              "Chunk header must preserve allocation alignment");
+
+static constexpr uintptr_t align_up(uintptr_t v, size_t alignment) {
+	return (v + alignment - 1) & ~(alignment - 1);
+}
 
-void* liballoc::ChunkAllocator::allocate(size_t size) {
-	auto chunk = find_free_chunk(size);
-	if(chunk) {
-		mark_chunk_allocated(*chunk, size);
-		return chunk->alloc_ptr();
+static constexpr uintptr_t align_down(uintptr_t v, size_t alignment) {
+	return v & ~(alignment - 1);
+}
+
+/*  Convert an allocation request to the size of a chunk that can hold it.
+ *  Returns 0 if the request is too large to be represented.
+ */
+static constexpr size_t request_to_chunk_size(size_t size) {
+	constexpr const size_t overhead = sizeof(liballoc::Chunk) + sizeof(size_t);
+	if(size > static_cast<size_t>(-1) - overhead - liballoc::ChunkAllocator::alignment) {
+		return 0;
 	}
-	return nullptr;
+	const auto chunk_size = align_up(size + overhead, liballoc::ChunkAllocator::alignment);
+	return chunk_size < minimum_chunk_size ? minimum_chunk_size : chunk_size;
 }
 
-void liballoc::ChunkAllocator::free(void* ptr) {
-	if(!ptr) {
+liballoc::ChunkAllocator::ChunkAllocator(liballoc::Arena arena) {
+	const auto start = align_up(reinterpret_cast<uintptr_t>(arena.base), alignment);
+	const auto end = align_down(reinterpret_cast<uintptr_t>(arena.base) + arena.length, alignment);
+	m_start = reinterpret_cast<void*>(start);
+	m_end = reinterpret_cast<void*>(start);
+	//  Arena too small to hold even a single chunk
+	if(end <= start || end - start < minimum_chunk_size) {
 		return;
 	}
 
-	auto* chunk = find_chunk_with_address(ptr);
+	m_end = reinterpret_cast<void*>(end);
+	auto* chunk = new(m_start) Chunk(end - start);
+	m_free_bytes = chunk->size;
+	bin_insert(chunk);
+}
+
+void* liballoc::ChunkAllocator::allocate(size_t size) {
+	const auto chunk_size = request_to_chunk_size(size);
+	if(!chunk_size) {
+		return nullptr;
+	}
+
+	auto* chunk = find_free_chunk(chunk_size);
 	if(!chunk) {
+		return nullptr;
+	}
+	mark_chunk_allocated(*chunk, chunk_size);
+	return chunk->alloc_ptr();
+}
+
+void liballoc::ChunkAllocator::free(void* ptr) {
+	if(!ptr) {
 		return;
 	}
 
-	//  Tried freeing an object from an offset pointer
-	if(ptr != chunk->alloc_ptr()) {
-#ifdef __is_kernel_build__
-		log.fatal("Partial free of pointer {} detected!", ptr);
-		ENSURE_NOT_REACHED();
-#endif
+	auto* chunk = chunk_for_pointer(ptr);
+	if(!chunk) {
 		return;
 	}
 
@@ -53,62 +93,162 @@ void liballoc::ChunkAllocator::free(void* ptr) {
 	}
 
 	chunk->state = ChunkState::Free;
+	m_free_bytes += chunk->size;
+	--m_allocation_count;
+
+	//  Merge with the following chunk
+	auto* next = chunk->next_in_memory();
+	if(next < m_end && next->state == ChunkState::Free) {
+		bin_remove(next);
+		chunk->size += next->size;
+		next->magic = 0;
+	}
+
+	//  Merge with the preceding chunk, which is found using its footer
+	if(chunk != m_start) {
+		const auto previous_size = *(reinterpret_cast<size_t*>(chunk) - 1);
+		auto* previous = reinterpret_cast<Chunk*>(reinterpret_cast<uint8_t*>(chunk) - previous_size);
+		if(previous->state == ChunkState::Free) {
+			bin_remove(previous);
+			previous->size += chunk->size;
+			chunk->magic = 0;
+			chunk = previous;
+		}
+	}
+
+	*chunk->footer() = chunk->size;
+	bin_insert(chunk);
+}
+
+size_t liballoc::ChunkAllocator::usable_size(void* ptr) {
+	auto* chunk = chunk_for_pointer(ptr);
+	if(!chunk || chunk->state != ChunkState::Allocated) {
+		return 0;
+	}
+	return chunk->capacity();
 }
 
-liballoc::Chunk* liballoc::ChunkAllocator::find_free_chunk(size_t size) {
-	auto current = m_chunk_list;
-	while(current) {
-		if(current->state == ChunkState::Free && current->size >= size) {
-			return current;
+size_t liballoc::ChunkAllocator::largest_free_allocation() const {
+	if(!m_bin_map) {
+		return 0;
+	}
+
+	const auto index = 63 - __builtin_clzll(m_bin_map);
+	size_t largest = 0;
+	for(auto* chunk = m_bins[index]; chunk; chunk = chunk->links().next) {
+		if(chunk->size > largest) {
+			largest = chunk->size;
 		}
-		current = current->next;
 	}
+	return largest - sizeof(Chunk) - sizeof(size_t);
+}
 
-	return nullptr;
+/*  Get the bin that holds free chunks of the given size.
+ *  Small chunks are binned by their exact size, while the remaining
+ *  bins each cover a power-of-two range of chunk sizes.
+ */
+size_t liballoc::ChunkAllocator::bin_index(size_t chunk_size) {
+	if(chunk_size < small_bin_limit) {
+		return chunk_size / alignment;
+	}
+	const size_t log2 = 63 - __builtin_clzll(chunk_size);
+	const size_t index = small_bin_count + (log2 - __builtin_ctzll(small_bin_limit));
+	return index < bin_count ? index : bin_count - 1;
 }
 
-bool liballoc::ChunkAllocator::mark_chunk_allocated(Chunk& chunk, size_t size) {
-	constexpr const size_t minimum_chunk_data_size = 8;
-	constexpr const uint8_t sanitize_byte = 0xBA;
+liballoc::Chunk* liballoc::ChunkAllocator::find_free_chunk(size_t chunk_size) {
+	auto index = bin_index(chunk_size);
 
-	//  Region is too small
-	if(chunk.size < size) {
-		return false;
+	//  Small bins contain chunks of exactly one size, any chunk will do.
+	//  Large bins cover a range of sizes, so the list must be searched.
+	if(m_bins[index]) {
+		for(auto* chunk = m_bins[index]; chunk; chunk = chunk->links().next) {
+			if(chunk->size >= chunk_size) {
+				return chunk;
+			}
+		}
 	}
 
-	const auto size_after_alloc = chunk.size - size;
-	//  If the chunk is too small to split (doesn't have enough space to contain the chunk structure
-	//  and the amount of left free space would be meaningless), don't split into new chunks and live with the
-	//  overcommit
-	if(size_after_alloc < sizeof(Chunk) + minimum_chunk_data_size) {
-		//  Mark it as allocated - we're done
-		chunk.state = ChunkState::Allocated;
-		memset(chunk.alloc_ptr(), sanitize_byte, size);
-		return true;
+	//  Any chunk from a higher non-empty bin is guaranteed to fit the request
+	if(index + 1 >= bin_count) {
+		return nullptr;
+	}
+	const auto candidates = m_bin_map & (~0ull << (index + 1));
+	if(!candidates) {
+		return nullptr;
 	}
+	index = __builtin_ctzll(candidates);
+	return m_bins[index];
+}
 
-	//  We can split the chunk into a new chunk with a sensible size
-	chunk.size = size;
-	chunk.state = ChunkState::Allocated;
-	memset(chunk.alloc_ptr(), sanitize_byte, size);
-	auto* new_chunk_ptr = reinterpret_cast<uint8_t*>(chunk.alloc_ptr()) + size;
-	const auto new_chunk_size = size_after_alloc - sizeof(Chunk);
-	auto* new_chunk = new(new_chunk_ptr) Chunk(new_chunk_size);
+/*  Get the chunk that owns an allocation pointer. Returns nullptr for
+ *  pointers that are outside of the arena, and reports pointers that
+ *  point inside an allocation or outside of any chunk.
+ */
+liballoc::Chunk* liballoc::ChunkAllocator::chunk_for_pointer(void* ptr) {
+	if(!contains(ptr)) {
+		return nullptr;
+	}
 
-	auto* previous_next = chunk.next;
-	chunk.next = new_chunk;
-	new_chunk->next = previous_next;
+	const auto address = reinterpret_cast<uintptr_t>(ptr);
+	auto* chunk = reinterpret_cast<Chunk*>(address - sizeof(Chunk));
+	//  Tried freeing an object from an offset pointer
+	if(address % alignment != 0 || chunk < m_start || chunk->magic != Chunk::chunk_magic) {
+#ifdef __is_kernel_build__
+		log.fatal("Partial free of pointer {} detected!", ptr);
+		ENSURE_NOT_REACHED();
+#endif
+		return nullptr;
+	}
+	return chunk;
+}
 
-	return true;
+void liballoc::ChunkAllocator::bin_insert(Chunk* chunk) {
+	const auto index = bin_index(chunk->size);
+	auto& links = chunk->links();
+	links.prev = nullptr;
+	links.next = m_bins[index];
+	if(links.next) {
+		links.next->links().prev = chunk;
+	}
+	m_bins[index] = chunk;
+	m_bin_map |= 1ull << index;
 }
 
-liballoc::Chunk* liballoc::ChunkAllocator::find_chunk_with_address(void* addr) {
-	auto current = m_chunk_list;
-	while(current) {
-		if(addr >= current->alloc_ptr() && addr < current->alloc_end_ptr()) {
-			return current;
-		}
-		current = current->next;
+void liballoc::ChunkAllocator::bin_remove(Chunk* chunk) {
+	const auto index = bin_index(chunk->size);
+	auto& links = chunk->links();
+	if(links.prev) {
+		links.prev->links().next = links.next;
+	} else {
+		m_bins[index] = links.next;
+	}
+	if(links.next) {
+		links.next->links().prev = links.prev;
+	}
+	if(!m_bins[index]) {
+		m_bin_map &= ~(1ull << index);
 	}
-	return nullptr;
+}
+
+void liballoc::ChunkAllocator::mark_chunk_allocated(Chunk& chunk, size_t chunk_size) {
+	constexpr const uint8_t sanitize_byte = 0xBA;
+
+	bin_remove(&chunk);
+
+	//  If the remainder is too small to hold a chunk, don't split and live with the overcommit.
+	//  Otherwise, split off the remainder into a new free chunk. It does not need to be merged,
+	//  as the following chunk could not have been free.
+	const auto size_after_alloc = chunk.size - chunk_size;
+	if(size_after_alloc >= minimum_chunk_size) {
+		chunk.size = chunk_size;
+		*chunk.footer() = chunk_size;
+		auto* new_chunk = new(chunk.next_in_memory()) Chunk(size_after_alloc);
+		bin_insert(new_chunk);
+	}
+
+	chunk.state = ChunkState::Allocated;
+	m_free_bytes -= chunk.size;
+	++m_allocation_count;
+	memset(chunk.alloc_ptr(), sanitize_byte, chunk.capacity());
 }
@@ -5,30 +5,38 @@
 liballoc::SlabAllocator::SlabAllocator(liballoc::Arena arena, size_t object_size)
     : m_arena(arena)
     , m_object_size(object_size) {
-	//  The bitmap will always start at byte 0 of the arena
-	m_bitmap_start = m_arena.base;
+	//  The bitmap always starts at the beginning of the arena, aligned to its word size
+	m_bitmap_start = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(m_arena.base) + 7) & ~uintptr_t { 7 });
 
 	//  First, calculate the pool capacity as if the arena was used
 	//  eclusively by it. This is of course not the case, as we have
 	//  to fit in the bitmap as well, but it gives us an upper bound
 	//  to use as the initial size.
 	m_pool_capacity = m_arena.length / m_object_size;
-	const auto initial_bitmap_size = (m_pool_capacity + 7) / 8;
-	m_pool_start = static_cast<uint8_t*>(m_arena.base) + initial_bitmap_size;
+	const auto initial_bitmap_size = HierarchicalBitmap::storage_size(m_pool_capacity);
+	m_pool_start = static_cast<uint8_t*>(m_bitmap_start) + initial_bitmap_size;
 	m_bitmap_size = initial_bitmap_size;
 
-	//  Ensure the pool start address is always aligned to the object size
-	const size_t align_mask = m_object_size - 1;
+	//  Align the pool start address to the largest power of two dividing the object
+	//  size. Every object is then aligned to it as well, which for power-of-two sizes
+	//  means objects are naturally aligned.
+	const size_t align_mask = (m_object_size & -m_object_size) - 1;
 	const size_t pool_start_aligned = (reinterpret_cast<size_t>(m_pool_start) + align_mask) & ~align_mask;
 	m_pool_start = reinterpret_cast<void*>(pool_start_aligned);
 
 	//  Now, recalculate the actual amount of space we have for
 	//  pool objects. Pool start address is already aligned and should
 	//  not be changed.
-	const auto pool_space_left = reinterpret_cast<uint8_t*>(m_arena.end()) - reinterpret_cast<uint8_t*>(m_pool_start);
-	m_pool_capacity = pool_space_left / m_object_size;
+	if(m_pool_start > m_arena.end()) {
+		m_pool_capacity = 0;
+	} else {
+		const auto pool_space_left =
+		        reinterpret_cast<uint8_t*>(m_arena.end()) - reinterpret_cast<uint8_t*>(m_pool_start);
+		m_pool_capacity = pool_space_left / m_object_size;
+	}
 	//  Update the bitmap to accomodate for the new pool capacity
-	m_bitmap_size = (m_pool_capacity + 7) / 8;
+	m_bitmap_size = HierarchicalBitmap::storage_size(m_pool_capacity);
+	m_bitmap = HierarchicalBitmap { m_bitmap_start, m_pool_capacity };
 
 	//  Track how many bytes of the arena we're losing
 	m_overhead = m_arena.length - m_pool_capacity * m_object_size - m_bitmap_size;
@@ -36,22 +44,16 @@ liballoc::SlabAllocator::SlabAllocator(liballoc::Arena arena, size_t object_size
 
 void* liballoc::SlabAllocator::allocate() {
 	size_t idx = 0;
-	if(!liballoc::bitmap_find_one(m_bitmap_start, m_bitmap_size, idx)) {
-		return nullptr;
-	}
-	//  The bitmap will always be a multiple of 8, but the actual capacity of the pool may differ
-	if(idx >= m_pool_capacity) {
+	if(!m_bitmap.find_and_set(idx)) {
 		return nullptr;
 	}
-	liballoc::bitmap_set(m_bitmap_start, m_bitmap_size, idx, true);
 	return (void*)(reinterpret_cast<uintptr_t>(m_pool_start) + idx * m_object_size);
 }
 
 void liballoc::SlabAllocator::free(void* addr) {
 	auto idx = ((uintptr_t)addr - (uintptr_t)m_pool_start) / m_object_size;
-	//  The bitmap will always be a multiple of 8, but the actual capacity of the pool may differ
 	if(idx >= m_pool_capacity) {
 		return;
 	}
-	liballoc::bitmap_set(m_bitmap_start, m_bitmap_size, idx, false);
+	m_bitmap.set(idx, false);
 }
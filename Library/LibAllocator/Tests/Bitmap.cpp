@@ -1,5 +1,7 @@
 #include <catch2/catch.hpp>
 #include <cstring>
+#include <format>
+#include <vector>
 #include <LibAllocator/Bitmap.hpp>
 
 TEST_CASE("liballoc::Bitmap", "[liballoc]") {
@@ -39,4 +41,180 @@ TEST_CASE("liballoc::Bitmap", "[liballoc]") {
 		liballoc::bitmap_set(buffer, sizeof(buffer), 7, false);
 		REQUIRE(buffer[0] == 0x0);
 	}
-}
\ No newline at end of file
+}
+TEST_CASE("liballoc::HierarchicalBitmap", "[liballoc]") {
+	auto bits = GENERATE(as<size_t> {}, 1, 63, 64, 65, 4095, 4096, 4097, 300000);
+	std::vector<uint64_t> storage(liballoc::HierarchicalBitmap::storage_size(bits) / sizeof(uint64_t));
+	liballoc::HierarchicalBitmap bitmap { storage.data(), bits };
+
+	SECTION(std::format("bits: {}", bits)) {
+		SECTION("all bits start out clear") {
+			for(size_t i = 0; i < bits; ++i) {
+				REQUIRE(!bitmap.get(i));
+			}
+		}
+
+		SECTION("setting and clearing bits") {
+			bitmap.set(bits - 1, true);
+			REQUIRE(bitmap.get(bits - 1));
+			bitmap.set(bits - 1, false);
+			REQUIRE(!bitmap.get(bits - 1));
+		}
+
+		SECTION("finding fills the bitmap in order and never returns padding") {
+			for(size_t i = 0; i < bits; ++i) {
+				size_t idx = 0;
+				REQUIRE(bitmap.find_and_set(idx));
+				REQUIRE(idx == i);
+			}
+			size_t idx = 0;
+			REQUIRE(!bitmap.find_and_set(idx));
+		}
+
+		SECTION("cleared bits of a full bitmap are found again") {
+			size_t idx = 0;
+			while(bitmap.find_and_set(idx))
+				;
+
+			const auto victim = bits / 3;
+			bitmap.set(victim, false);
+			REQUIRE(bitmap.find_and_set(idx));
+			REQUIRE(idx == victim);
+			REQUIRE(!bitmap.find_and_set(idx));
+
+			//  Clearing the very last bit must propagate through all summary levels
+			bitmap.set(bits - 1, false);
+			REQUIRE(bitmap.find_and_set(idx));
+			REQUIRE(idx == bits - 1);
+		}
+	}
+}
+
+TEST_CASE("liballoc::HierarchicalBitmap runs", "[liballoc]") {
+	static constexpr size_t bits = 1024;
+	std::vector<uint64_t> storage(liballoc::HierarchicalBitmap::storage_size(bits) / sizeof(uint64_t));
+	liballoc::HierarchicalBitmap bitmap { storage.data(), bits };
+
+	SECTION("runs are allocated contiguously") {
+		size_t idx = 0;
+		REQUIRE(bitmap.find_and_set_run(10, idx));
+		REQUIRE(idx == 0);
+		REQUIRE(bitmap.find_and_set_run(100, idx));
+		REQUIRE(idx == 10);
+		for(size_t i = 0; i < 110; ++i) {
+			REQUIRE(bitmap.get(i));
+		}
+		REQUIRE(!bitmap.get(110));
+	}
+
+	SECTION("runs skip holes that are too small") {
+		bitmap.set_run(0, bits, true);
+		bitmap.set_run(5, 3, false);
+		bitmap.set_run(60, 10, false);
+		bitmap.set_run(500, 200, false);
+
+		size_t idx = 0;
+		REQUIRE(bitmap.find_and_set_run(8, idx));
+		REQUIRE(idx == 60);
+		REQUIRE(bitmap.find_and_set_run(150, idx));
+		REQUIRE(idx == 500);
+		REQUIRE(!bitmap.find_and_set_run(51, idx));
+		REQUIRE(bitmap.find_and_set_run(3, idx));
+		REQUIRE(idx == 5);
+	}
+
+	SECTION("runs cannot extend past the end") {
+		size_t idx = 0;
+		REQUIRE(!bitmap.find_and_set_run(bits + 1, idx));
+		REQUIRE(bitmap.find_and_set_run(bits, idx));
+		REQUIRE(idx == 0);
+		REQUIRE(!bitmap.find_and_set(idx));
+	}
+}
+
+TEST_CASE("liballoc::HierarchicalBitmap runs skip full regions", "[liballoc]") {
+	//  Large enough for two summary levels
+	static constexpr size_t bits = 300000;
+	std::vector<uint64_t> storage(liballoc::HierarchicalBitmap::storage_size(bits) / sizeof(uint64_t));
+	liballoc::HierarchicalBitmap bitmap { storage.data(), bits };
+	bitmap.set_run(0, bits, true);
+
+	SECTION("runs are found past full regions") {
+		bitmap.set_run(100, 20, false);
+		bitmap.set_run(200000, 130, false);
+		bitmap.set_run(bits - 70, 70, false);
+
+		size_t idx = 0;
+		REQUIRE(bitmap.find_and_set_run(100, idx));
+		REQUIRE(idx == 200000);
+		REQUIRE(bitmap.find_and_set_run(70, idx));
+		REQUIRE(idx == bits - 70);
+		REQUIRE(bitmap.find_and_set_run(20, idx));
+		REQUIRE(idx == 100);
+		REQUIRE(!bitmap.find_and_set_run(31, idx));
+		REQUIRE(bitmap.find_and_set_run(30, idx));
+		REQUIRE(idx == 200100);
+	}
+
+	SECTION("a full bitmap has no runs") {
+		size_t idx = 0;
+		REQUIRE(!bitmap.find_and_set_run(2, idx));
+	}
+}
+
+//  Benchmarks comparing against the linear byte-scanning bitmap. These
+//  are hidden by default, run them with `TestLibAllocator [benchmark]`.
+TEST_CASE("liballoc::HierarchicalBitmap benchmarks", "[.][benchmark]") {
+	//  Same amount of bits as there are pages in a 32MiB region
+	static constexpr size_t bits = 8192;
+
+	BENCHMARK_ADVANCED("bitmap_find_one, fill to capacity")(Catch::Benchmark::Chronometer meter) {
+		std::vector<uint8_t> buffer(bits / 8);
+		meter.measure([&] {
+			std::memset(buffer.data(), 0, buffer.size());
+			size_t idx = 0;
+			while(liballoc::bitmap_find_one(buffer.data(), buffer.size(), idx) && idx < bits) {
+				liballoc::bitmap_set(buffer.data(), buffer.size(), idx, true);
+			}
+			return idx;
+		});
+	};
+
+	BENCHMARK_ADVANCED("HierarchicalBitmap, fill to capacity")(Catch::Benchmark::Chronometer meter) {
+		std::vector<uint64_t> storage(liballoc::HierarchicalBitmap::storage_size(bits) / sizeof(uint64_t));
+		meter.measure([&] {
+			liballoc::HierarchicalBitmap bitmap { storage.data(), bits };
+			size_t idx = 0;
+			while(bitmap.find_and_set(idx))
+				;
+			return idx;
+		});
+	};
+
+	BENCHMARK_ADVANCED("bitmap_find_one, churn on a nearly full bitmap")(Catch::Benchmark::Chronometer meter) {
+		std::vector<uint8_t> buffer(bits / 8, 0xFF);
+		size_t victim = 0;
+		meter.measure([&] {
+			victim = (victim + 4099) % bits;
+			liballoc::bitmap_set(buffer.data(), buffer.size(), victim, false);
+			size_t idx = 0;
+			liballoc::bitmap_find_one(buffer.data(), buffer.size(), idx);
+			liballoc::bitmap_set(buffer.data(), buffer.size(), idx, true);
+			return idx;
+		});
+	};
+
+	BENCHMARK_ADVANCED("HierarchicalBitmap, churn on a nearly full bitmap")(Catch::Benchmark::Chronometer meter) {
+		std::vector<uint64_t> storage(liballoc::HierarchicalBitmap::storage_size(bits) / sizeof(uint64_t));
+		liballoc::HierarchicalBitmap bitmap { storage.data(), bits };
+		bitmap.set_run(0, bits, true);
+		size_t victim = 0;
+		meter.measure([&] {
+			victim = (victim + 4099) % bits;
+			bitmap.set(victim, false);
+			size_t idx = 0;
+			bitmap.find_and_set(idx);
+			return idx;
+		});
+	};
+}
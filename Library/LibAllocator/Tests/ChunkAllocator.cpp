@@ -1,14 +1,19 @@
 #include <catch2/catch.hpp>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <LibAllocator/ChunkAllocator.hpp>
+#include <random>
+#include <vector>
 
 static constexpr const size_t ARENA_LEN = 0x10000;
-static uint8_t s_arena[ARENA_LEN] = {};
+alignas(16) static uint8_t s_arena[ARENA_LEN] = {};
 
 TEST_CASE("liballoc::ChunkAllocator", "[liballoc]") {
 	liballoc::Arena arena { s_arena, ARENA_LEN };
 	liballoc::ChunkAllocator ca { arena };
+	const auto initial_free = ca.free_bytes();
+	const auto initial_largest = ca.largest_free_allocation();
 
 	SECTION("simple allocations work") {
 		auto* p = ca.allocate(0x1000);
@@ -28,6 +33,24 @@ TEST_CASE("liballoc::ChunkAllocator", "[liballoc]") {
 		}
 	}
 
+	SECTION("allocations are aligned") {
+		for(size_t size = 0; size < 256; ++size) {
+			auto* p = ca.allocate(size);
+			REQUIRE(p != nullptr);
+			REQUIRE(reinterpret_cast<uintptr_t>(p) % liballoc::ChunkAllocator::alignment == 0);
+		}
+	}
+
+	SECTION("usable size covers the request") {
+		for(size_t size = 1; size < 2048; size += 37) {
+			auto* p = ca.allocate(size);
+			REQUIRE(p != nullptr);
+			REQUIRE(ca.usable_size(p) >= size);
+			ca.free(p);
+			REQUIRE(ca.usable_size(p) == 0);
+		}
+	}
+
 	SECTION("allocation too big for arena") {
 		auto* p = ca.allocate(0x10001);
 		REQUIRE(p == nullptr);
@@ -37,4 +60,113 @@ TEST_CASE("liballoc::ChunkAllocator", "[liballoc]") {
 		auto* p = ca.allocate(0x10000);
 		REQUIRE(p == nullptr);
 	}
-}
\ No newline at end of file
+
+	SECTION("largest free allocation fits") {
+		auto* p = ca.allocate(initial_largest);
+		REQUIRE(p != nullptr);
+		REQUIRE(ca.allocate(1) == nullptr);
+		ca.free(p);
+		REQUIRE(ca.free_bytes() == initial_free);
+	}
+
+	SECTION("freed neighbours are coalesced") {
+		auto* a = ca.allocate(0x100);
+		auto* b = ca.allocate(0x100);
+		auto* c = ca.allocate(0x100);
+		auto* d = ca.allocate(0x100);
+		REQUIRE(d != nullptr);
+
+		//  Free in an order that exercises merging with both neighbours
+		ca.free(a);
+		ca.free(c);
+		ca.free(b);
+		auto* merged = ca.allocate(0x300);
+		REQUIRE(merged == a);
+
+		ca.free(merged);
+		ca.free(d);
+		REQUIRE(ca.allocation_count() == 0);
+		REQUIRE(ca.free_bytes() == initial_free);
+		REQUIRE(ca.largest_free_allocation() == initial_largest);
+	}
+
+	SECTION("fragmented arena recovers after freeing") {
+		std::vector<void*> allocations;
+		while(auto* p = ca.allocate(64)) {
+			allocations.push_back(p);
+		}
+		REQUIRE(allocations.size() > 100);
+
+		//  Free every other allocation, which leaves the arena maximally fragmented
+		for(size_t i = 0; i < allocations.size(); i += 2) {
+			ca.free(allocations[i]);
+		}
+		REQUIRE(ca.largest_free_allocation() < 128);
+		REQUIRE(ca.allocate(128) == nullptr);
+
+		for(size_t i = 1; i < allocations.size(); i += 2) {
+			ca.free(allocations[i]);
+		}
+		REQUIRE(ca.free_bytes() == initial_free);
+		REQUIRE(ca.largest_free_allocation() == initial_largest);
+	}
+
+	SECTION("double free is ignored") {
+		auto* p = ca.allocate(0x40);
+		ca.free(p);
+		ca.free(p);
+		REQUIRE(ca.free_bytes() == initial_free);
+		REQUIRE(ca.allocation_count() == 0);
+	}
+
+	SECTION("free of an interior pointer is ignored") {
+		auto* p = ca.allocate(0x40);
+		ca.free(static_cast<uint8_t*>(p) + 8);
+		REQUIRE(ca.allocation_count() == 1);
+		ca.free(p);
+		REQUIRE(ca.allocation_count() == 0);
+	}
+
+	SECTION("long random churn keeps the arena consistent") {
+		struct Live {
+			uint8_t* ptr;
+			size_t size;
+			uint8_t pattern;
+		};
+
+		std::mt19937 rng { 0x4D754F53 };
+		std::uniform_int_distribution<size_t> size_dist { 0, 1024 };
+		std::vector<Live> live;
+
+		for(size_t i = 0; i < 100000; ++i) {
+			const bool should_free = !live.empty() && (live.size() >= 48 || rng() % 2 == 0);
+			if(should_free) {
+				const auto index = rng() % live.size();
+				const auto entry = live[index];
+				for(size_t b = 0; b < entry.size; ++b) {
+					REQUIRE(entry.ptr[b] == entry.pattern);
+				}
+				ca.free(entry.ptr);
+				live[index] = live.back();
+				live.pop_back();
+				continue;
+			}
+
+			const auto size = size_dist(rng);
+			auto* p = static_cast<uint8_t*>(ca.allocate(size));
+			if(!p) {
+				continue;
+			}
+			const auto pattern = static_cast<uint8_t>(i);
+			memset(p, pattern, size);
+			live.push_back(Live { p, size, pattern });
+		}
+
+		for(auto& entry : live) {
+			ca.free(entry.ptr);
+		}
+		REQUIRE(ca.allocation_count() == 0);
+		REQUIRE(ca.free_bytes() == initial_free);
+		REQUIRE(ca.largest_free_allocation() == initial_largest);
+	}
+}
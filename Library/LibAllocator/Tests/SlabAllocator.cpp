@@ -129,6 +129,22 @@ TEST_CASE("liballoc::SlabAllocator", "[liballoc]") {
 		}
 	}
 
+	SECTION("objects of non power-of-two sizes are aligned") {
+		auto object_size = GENERATE(as<size_t> {}, 24, 40, 48, 96, 192, 320);
+		static constexpr size_t arena_size = 0x4000;
+		std::memset(s_arena.data(), 0x0, arena_size);
+		liballoc::Arena arena { s_arena.data(), arena_size };
+		liballoc::SlabAllocator sa { arena, object_size };
+		const auto alignment = object_size & -object_size;
+
+		REQUIRE(sa.pool_capacity() > 0);
+		REQUIRE((uint8_t*)sa.pool_start() + sa.pool_size() <= arena.end());
+		while(auto* p = sa.allocate()) {
+			REQUIRE((reinterpret_cast<uintptr_t>(p) & (alignment - 1)) == 0);
+			std::memset(p, 0xDA, object_size);
+		}
+	}
+
 	SECTION("allocation with excess bitmap elements") {
 		static constexpr size_t arena_size = 4096;
 		static constexpr size_t object_size = 2048;
@@ -0,0 +1,279 @@
+#pragma once
+#include <stddef.h>
+
+namespace gen {
+	/*
+	 *  Links of a node in an intrusive AVL tree.
+	 *  Types stored in an AVLTree must publicly inherit from this.
+	 */
+	template<class T>
+	struct AVLNode {
+		T* avl_parent {};
+		T* avl_left {};
+		T* avl_right {};
+		int avl_height { 1 };
+	};
+
+	/*
+	 *  Augmentation that does nothing, used for plain ordered trees.
+	 */
+	struct AVLNoAugment {
+		template<class T>
+		static constexpr void update(T&) {}
+	};
+
+	/*
+	 *  Intrusive, self-balancing binary search tree
+	 *
+	 *  The tree does not own or allocate its nodes. Nodes are ordered using
+	 *  `Compare`, which must provide `static bool less(T const&, T const&)`.
+	 *  Nodes that compare equal are kept in insertion order.
+	 *
+	 *  The tree can be augmented with per-subtree data (for example, the
+	 *  largest free gap in a subtree) by providing `Augment`, which must
+	 *  provide `static void update(T&)`. It is called for a node every time
+	 *  its children change, after its children were already updated, and
+	 *  should recompute the augmented data of the node from its own data and
+	 *  its children. If the data of a node that affects the augmented values
+	 *  is modified, `update` must be called on the tree to propagate it.
+	 */
+	template<class T, class Compare, class Augment = AVLNoAugment>
+	class AVLTree {
+	public:
+		constexpr AVLTree() = default;
+		AVLTree(AVLTree const&) = delete;
+		AVLTree& operator=(AVLTree const&) = delete;
+
+		[[nodiscard]] constexpr T* root() const { return m_root; }
+
+		[[nodiscard]] constexpr size_t size() const { return m_size; }
+
+		[[nodiscard]] constexpr bool empty() const { return m_size == 0; }
+
+		void insert(T* node) {
+			node->avl_left = nullptr;
+			node->avl_right = nullptr;
+			node->avl_height = 1;
+
+			T* parent = nullptr;
+			T** link = &m_root;
+			while(*link) {
+				parent = *link;
+				link = Compare::less(*node, *parent) ? &parent->avl_left : &parent->avl_right;
+			}
+			node->avl_parent = parent;
+			*link = node;
+			++m_size;
+			rebalance_from(node);
+		}
+
+		void remove(T* node) {
+			T* rebalance_start;
+			if(!node->avl_left || !node->avl_right) {
+				T* child = node->avl_left ? node->avl_left : node->avl_right;
+				rebalance_start = node->avl_parent;
+				replace_child(node->avl_parent, node, child);
+				if(child) {
+					child->avl_parent = node->avl_parent;
+				}
+			} else {
+				//  Replace the node with its in-order successor, which has no left child
+				T* successor = leftmost(node->avl_right);
+				if(successor->avl_parent != node) {
+					rebalance_start = successor->avl_parent;
+					rebalance_start->avl_left = successor->avl_right;
+					if(successor->avl_right) {
+						successor->avl_right->avl_parent = rebalance_start;
+					}
+					successor->avl_right = node->avl_right;
+					node->avl_right->avl_parent = successor;
+				} else {
+					rebalance_start = successor;
+				}
+				successor->avl_left = node->avl_left;
+				node->avl_left->avl_parent = successor;
+				successor->avl_parent = node->avl_parent;
+				successor->avl_height = node->avl_height;
+				replace_child(node->avl_parent, node, successor);
+			}
+
+			node->avl_parent = nullptr;
+			node->avl_left = nullptr;
+			node->avl_right = nullptr;
+			--m_size;
+			rebalance_from(rebalance_start);
+		}
+
+		/*
+		 *  Propagate changes of the augmented data of a node up to the root.
+		 *  The position of the node in the ordering must not have changed.
+		 */
+		void update(T* node) { rebalance_from(node); }
+
+		[[nodiscard]] T* first() const { return m_root ? leftmost(m_root) : nullptr; }
+
+		[[nodiscard]] T* last() const {
+			T* node = m_root;
+			while(node && node->avl_right) {
+				node = node->avl_right;
+			}
+			return node;
+		}
+
+		[[nodiscard]] static T* next(T* node) {
+			if(node->avl_right) {
+				return leftmost(node->avl_right);
+			}
+			while(node->avl_parent && node == node->avl_parent->avl_right) {
+				node = node->avl_parent;
+			}
+			return node->avl_parent;
+		}
+
+		[[nodiscard]] static T* prev(T* node) {
+			if(node->avl_left) {
+				node = node->avl_left;
+				while(node->avl_right) {
+					node = node->avl_right;
+				}
+				return node;
+			}
+			while(node->avl_parent && node == node->avl_parent->avl_left) {
+				node = node->avl_parent;
+			}
+			return node->avl_parent;
+		}
+
+		/*
+		 *  Find the last node for which `before(node)` is true, where `before`
+		 *  must be true for a prefix of the ordering. For example, with a tree
+		 *  ordered by address, passing `node.base <= address` finds the node
+		 *  that starts at or below the address.
+		 */
+		template<class Predicate>
+		[[nodiscard]] T* find_last(Predicate before) const {
+			T* result = nullptr;
+			T* node = m_root;
+			while(node) {
+				if(before(*node)) {
+					result = node;
+					node = node->avl_right;
+				} else {
+					node = node->avl_left;
+				}
+			}
+			return result;
+		}
+
+		/*
+		 *  Find the first node for which `after(node)` is true, where `after`
+		 *  must be true for a suffix of the ordering.
+		 */
+		template<class Predicate>
+		[[nodiscard]] T* find_first(Predicate after) const {
+			T* result = nullptr;
+			T* node = m_root;
+			while(node) {
+				if(after(*node)) {
+					result = node;
+					node = node->avl_left;
+				} else {
+					node = node->avl_right;
+				}
+			}
+			return result;
+		}
+
+		/*
+		 *  Call the function for every node in order.
+		 */
+		template<class Function>
+		void for_each(Function fn) const {
+			for(T* node = first(); node; node = next(node)) {
+				fn(*node);
+			}
+		}
+	private:
+		T* m_root {};
+		size_t m_size {};
+
+		static int height(T* node) { return node ? node->avl_height : 0; }
+
+		static T* leftmost(T* node) {
+			while(node->avl_left) {
+				node = node->avl_left;
+			}
+			return node;
+		}
+
+		static void fix(T* node) {
+			const auto lh = height(node->avl_left);
+			const auto rh = height(node->avl_right);
+			node->avl_height = 1 + (lh > rh ? lh : rh);
+			Augment::update(*node);
+		}
+
+		void replace_child(T* parent, T* old_child, T* new_child) {
+			if(!parent) {
+				m_root = new_child;
+			} else if(parent->avl_left == old_child) {
+				parent->avl_left = new_child;
+			} else {
+				parent->avl_right = new_child;
+			}
+		}
+
+		T* rotate_left(T* node) {
+			T* pivot = node->avl_right;
+			node->avl_right = pivot->avl_left;
+			if(pivot->avl_left) {
+				pivot->avl_left->avl_parent = node;
+			}
+			pivot->avl_parent = node->avl_parent;
+			replace_child(node->avl_parent, node, pivot);
+			pivot->avl_left = node;
+			node->avl_parent = pivot;
+			fix(node);
+			fix(pivot);
+			return pivot;
+		}
+
+		T* rotate_right(T* node) {
+			T* pivot = node->avl_left;
+			node->avl_left = pivot->avl_right;
+			if(pivot->avl_right) {
+				pivot->avl_right->avl_parent = node;
+			}
+			pivot->avl_parent = node->avl_parent;
+			replace_child(node->avl_parent, node, pivot);
+			pivot->avl_right = node;
+			node->avl_parent = pivot;
+			fix(node);
+			fix(pivot);
+			return pivot;
+		}
+
+		/*
+		 *  Walk from the node up to the root, restoring balance and updating
+		 *  heights and augmented data on the way.
+		 */
+		void rebalance_from(T* node) {
+			while(node) {
+				fix(node);
+				const auto balance = height(node->avl_left) - height(node->avl_right);
+				if(balance > 1) {
+					if(height(node->avl_left->avl_left) < height(node->avl_left->avl_right)) {
+						rotate_left(node->avl_left);
+					}
+					node = rotate_right(node);
+				} else if(balance < -1) {
+					if(height(node->avl_right->avl_right) < height(node->avl_right->avl_left)) {
+						rotate_right(node->avl_right);
+					}
+					node = rotate_left(node);
+				}
+				node = node->avl_parent;
+			}
+		}
+	};
+}
@@ -3,7 +3,8 @@
 #include <LibGeneric/Allocator.hpp>
 
 void* gen::__platform_alloc(size_t n) {
-	return core::mem::hmalloc(n);
+	//  All containers allocate through here, charge the allocation to the container code instead
+	return core::mem::hmalloc_at(n, core::mem::NUMA_NODE_LOCAL, __builtin_return_address(0));
 }
 
 void gen::__platform_free(void* p, size_t) {
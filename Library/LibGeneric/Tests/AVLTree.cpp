@@ -0,0 +1,172 @@
+#include <algorithm>
+#include <catch2/catch.hpp>
+#include <LibGeneric/AVLTree.hpp>
+#include <random>
+#include <vector>
+
+struct Extent : gen::AVLNode<Extent> {
+	size_t base;
+	size_t size;
+	size_t max_size;
+};
+
+struct ExtentCompare {
+	static bool less(Extent const& a, Extent const& b) { return a.base < b.base; }
+};
+
+struct ExtentAugment {
+	static void update(Extent& e) {
+		e.max_size = e.size;
+		if(e.avl_left && e.avl_left->max_size > e.max_size) {
+			e.max_size = e.avl_left->max_size;
+		}
+		if(e.avl_right && e.avl_right->max_size > e.max_size) {
+			e.max_size = e.avl_right->max_size;
+		}
+	}
+};
+
+using ExtentTree = gen::AVLTree<Extent, ExtentCompare, ExtentAugment>;
+
+//  Verify ordering, parent links, heights, balance and augmented data of a subtree.
+//  Returns the height of the subtree.
+static int verify(Extent* node, Extent* parent) {
+	if(!node) {
+		return 0;
+	}
+	REQUIRE(node->avl_parent == parent);
+	if(node->avl_left) {
+		REQUIRE(node->avl_left->base <= node->base);
+	}
+	if(node->avl_right) {
+		REQUIRE(node->avl_right->base >= node->base);
+	}
+	const auto lh = verify(node->avl_left, node);
+	const auto rh = verify(node->avl_right, node);
+	REQUIRE(std::abs(lh - rh) <= 1);
+	REQUIRE(node->avl_height == 1 + std::max(lh, rh));
+
+	size_t max_size = node->size;
+	if(node->avl_left) {
+		max_size = std::max(max_size, node->avl_left->max_size);
+	}
+	if(node->avl_right) {
+		max_size = std::max(max_size, node->avl_right->max_size);
+	}
+	REQUIRE(node->max_size == max_size);
+	return node->avl_height;
+}
+
+TEST_CASE("gen::AVLTree", "[structs]") {
+	SECTION("default constructed tree is empty") {
+		ExtentTree tree {};
+		REQUIRE(tree.empty());
+		REQUIRE(tree.root() == nullptr);
+		REQUIRE(tree.first() == nullptr);
+		REQUIRE(tree.last() == nullptr);
+	}
+
+	SECTION("sequential inserts stay balanced and ordered") {
+		std::vector<Extent> nodes(1000);
+		ExtentTree tree {};
+		for(size_t i = 0; i < nodes.size(); ++i) {
+			nodes[i].base = i;
+			nodes[i].size = i % 17;
+			tree.insert(&nodes[i]);
+		}
+		REQUIRE(tree.size() == nodes.size());
+		REQUIRE(verify(tree.root(), nullptr) <= 15);
+
+		size_t expected = 0;
+		tree.for_each([&expected](Extent& e) { REQUIRE(e.base == expected++); });
+		REQUIRE(expected == nodes.size());
+		REQUIRE(tree.first()->base == 0);
+		REQUIRE(tree.last()->base == nodes.size() - 1);
+		REQUIRE(ExtentTree::prev(tree.first()) == nullptr);
+		REQUIRE(ExtentTree::next(tree.last()) == nullptr);
+	}
+
+	SECTION("searching") {
+		std::vector<Extent> nodes(100);
+		ExtentTree tree {};
+		for(size_t i = 0; i < nodes.size(); ++i) {
+			nodes[i].base = i * 10;
+			nodes[i].size = 1;
+			tree.insert(&nodes[i]);
+		}
+
+		auto* below = tree.find_last([](Extent const& e) { return e.base <= 255; });
+		REQUIRE(below);
+		REQUIRE(below->base == 250);
+		auto* above = tree.find_first([](Extent const& e) { return e.base > 255; });
+		REQUIRE(above);
+		REQUIRE(above->base == 260);
+		REQUIRE(tree.find_last([](Extent const& e) { return e.base < 5; }) == &nodes[0]);
+		REQUIRE(tree.find_first([](Extent const& e) { return e.base > 10000; }) == nullptr);
+	}
+
+	SECTION("updating augmented data") {
+		std::vector<Extent> nodes(64);
+		ExtentTree tree {};
+		for(size_t i = 0; i < nodes.size(); ++i) {
+			nodes[i].base = i;
+			nodes[i].size = 1;
+			tree.insert(&nodes[i]);
+		}
+		REQUIRE(tree.root()->max_size == 1);
+		nodes[37].size = 500;
+		tree.update(&nodes[37]);
+		REQUIRE(tree.root()->max_size == 500);
+		verify(tree.root(), nullptr);
+	}
+
+	SECTION("random inserts and removals keep all invariants") {
+		std::mt19937 rng { 1234 };
+		std::vector<Extent> nodes(2000);
+		std::vector<Extent*> in_tree;
+		std::vector<Extent*> out_of_tree;
+		for(auto& node : nodes) {
+			out_of_tree.push_back(&node);
+		}
+
+		ExtentTree tree {};
+		for(size_t op = 0; op < 20000; ++op) {
+			const bool insert = in_tree.empty() || (!out_of_tree.empty() && rng() % 3 != 0);
+			if(insert) {
+				const auto index = rng() % out_of_tree.size();
+				auto* node = out_of_tree[index];
+				out_of_tree.erase(out_of_tree.begin() + index);
+				node->base = rng() % 5000;
+				node->size = rng() % 100000;
+				tree.insert(node);
+				in_tree.push_back(node);
+			} else {
+				const auto index = rng() % in_tree.size();
+				auto* node = in_tree[index];
+				in_tree.erase(in_tree.begin() + index);
+				tree.remove(node);
+				out_of_tree.push_back(node);
+			}
+			REQUIRE(tree.size() == in_tree.size());
+			if(op % 500 == 0) {
+				verify(tree.root(), nullptr);
+			}
+		}
+		verify(tree.root(), nullptr);
+
+		std::vector<size_t> expected;
+		for(auto* node : in_tree) {
+			expected.push_back(node->base);
+		}
+		std::sort(expected.begin(), expected.end());
+		std::vector<size_t> actual;
+		tree.for_each([&actual](Extent& e) { actual.push_back(e.base); });
+		REQUIRE(actual == expected);
+
+		for(auto* node : in_tree) {
+			tree.remove(node);
+		}
+		REQUIRE(tree.empty());
+		REQUIRE(tree.root() == nullptr);
+	}
+}